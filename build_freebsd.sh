@@ -8,15 +8,16 @@ then
 fi
 
 test -z "$ENABLE_PCI_DB" || CFLAGS="$CFLAGS -DUHWI_ENABLE_PCI_DB=1"
+test -z "$ENABLE_TRACE" || CFLAGS="$CFLAGS -DUHWI_ENABLE_TRACE=1"
 
 set -ve
 
-for fn in uhwi.c lsuhwi.c
+for fn in uhwi.c uhwi_addr.c uhwi_alloc.c uhwi_async.c uhwi_strpool.c uhwi_scan.c uhwi_sysfs.c uhwi_snapshot.c uhwi_cache.c uhwi_shm.c uhwi_db.c uhwi_db_shared.c uhwi_trace.c lsuhwi.c
 do
-	clang -c -o "`basename "$fn" .c`.o" -std=c99 -I. $CFLAGS "$fn"
+	clang -c -o "`basename "$fn" .c`.o" -std=c99 -pthread -I. $CFLAGS "$fn"
 done
 
 ar crs libuhwi.a *.o
-clang -o lsuhwi lsuhwi.o -L. -luhwi -lusb
+clang -o lsuhwi lsuhwi.o -L. -luhwi -lusb -pthread
 
 exit 0
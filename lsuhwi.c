@@ -1,88 +1,676 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#elif defined(__FreeBSD__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+# define LSUHWI_JSON_SSE2 1
+# include <emmintrin.h>
+#endif
 
 #include "uhwi.h"
 
 int show_usage(const char* argv0) {
-    fprintf(stderr, "Usage: %s [-u|-l|-?]\n", argv0);
+    fprintf(stderr, "Usage: %s [-u|-l|-c|-m|-b|-d|-r snapshot|-S|-C] [-J|-N|-B] [-T ms] [-?]\n", argv0);
+    fprintf(stderr, "       %s -t [-r snapshot|-S|-C]\n", argv0);
+    fprintf(stderr, "       %s -s name [-J|-N]\n", argv0);
+    fprintf(stderr, "       %s -D [-i seconds]\n", argv0);
+#ifdef UHWI_ENABLE_TRACE
+    fprintf(stderr, "       %s -x ... (any of the above, tracing to stderr)\n", argv0);
+#endif
     return 1;
 }
 
+// indexed by uhwi_dev_t
+const char* const lsuhwi_type_names[] = { "NULL", "PCI", "USB", "CPU", "MEM",
+                                          "BLOCK" };
+
+#ifdef UHWI_ENABLE_TRACE
+// indexed by uhwi_trace_point_t
+const char* const lsuhwi_trace_names[] = { "dev-begin", "dev-end", "attr",
+                                           "db-open-begin", "db-open-end",
+                                           "db-lookup", "db-resolve" };
+
+// prints every trace event on a line of its own, stderr keeps them apart from
+// the listing itself
+void lsuhwi_trace(const uhwi_trace_event* event, void* userdata) {
+    (void)userdata;
+
+    fprintf(stderr, "[trace] %-13s %-5s %10.1f us result=%lld",
+            lsuhwi_trace_names[event->point],
+            (event->point >= UHWI_TRACE_DB_OPEN_BEGIN) ? "DB" :
+            lsuhwi_type_names[event->type],
+            (double)event->elapsed_ns / 1e3, (long long)event->result);
+
+    if (event->label)
+        fprintf(stderr, " %s%s%s", event->label, event->attr ? "/" : "",
+                event->attr ? event->attr : "");
+    else if (event->attr)
+        fprintf(stderr, " %s", event->attr);
+
+    if (event->vendor || event->device)
+        fprintf(stderr, " vendor=0x%04x device=0x%04x", event->vendor,
+                event->device);
+
+    fputc('\n', stderr);
+}
+#endif
+
 #define UHWI_DEV_TYPE_TO_CSTR(type) \
-    ((type == UHWI_DEV_USB) ? "USB" : "PCI")
+    (((size_t)(type) < sizeof(lsuhwi_type_names) / sizeof(char*)) ? \
+     lsuhwi_type_names[type] : "?")
 
-void format_as_json(uhwi_dev* current, FILE* where) {
-    if (!current || current->type == UHWI_DEV_NULL)
-        return; // impossible though
+#define LSUHWI_OUT_MAX 16384
+
+// the longest a single device can get once escaped (every name byte might
+// turn into a \u00XX sequence), the buffer is flushed before it could overflow
+#define LSUHWI_JSON_DEV_MAX (192 + 6 * UHWI_DEV_NAME_MAX_LEN)
+
+typedef struct {
+    FILE* where;
+
+    char data[LSUHWI_OUT_MAX];
+    size_t len;
+} lsuhwi_out;
+
+void lsuhwi_out_flush(lsuhwi_out* out) {
+    if (out->len > 0)
+        fwrite(out->data, 1, out->len, out->where);
+
+    out->len = 0;
+}
+
+#define LSUHWI_OUT_LITERAL(out, literal) { \
+    memcpy((out)->data + (out)->len, literal, sizeof(literal) - 1); \
+    (out)->len += sizeof(literal) - 1; \
+}
+
+// formats an unsigned integer in decimal form without going through printf
+void lsuhwi_out_uint(lsuhwi_out* out, unsigned int value) {
+    char digits[10];
+    size_t count = 0;
 
-    fprintf(where, "{");
-    fprintf(where, "\"type\":\"%s\",\"vendor\":%u,\"device\":%u,",
-                   UHWI_DEV_TYPE_TO_CSTR(current->type),
-                   current->vendor, current->device);
-    fprintf(where, "\"subvendor\":%u,\"subdevice\":%u,",
-                   current->subvendor, current->subdevice);
-    fprintf(where, "\"name\":\"");
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
 
+    while (count > 0)
+        out->data[out->len++] = digits[--count];
+}
+
+// amount of leading bytes that can be copied into a JSON string as is (i.e.
+// neither '"', '\\' nor control characters)
+size_t lsuhwi_json_plain_len(const char* from, const size_t len) {
     size_t index = 0;
 
-    while (1) {
-        const char cc = current->name[index];
+#ifdef LSUHWI_JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    for (; index + 16 <= len; index += 16) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i*)(from + index));
 
-        if (cc == '\0')
+        // unsigned "chunk <= 0x1f" is "max(chunk, 0x1f) == 0x1f"
+        const __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                         _mm_cmpeq_epi8(chunk, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+
+        const unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+
+        if (mask != 0)
+            return index + (size_t)__builtin_ctz(mask);
+    }
+#endif
+
+    for (; index < len; index++) {
+        const unsigned char cc = (unsigned char)from[index];
+
+        if (cc == '"' || cc == '\\' || cc < 0x20)
+            break;
+    }
+
+    return index;
+}
+
+// appends a quoted & escaped JSON string
+void lsuhwi_out_json_str(lsuhwi_out* out, const char* from, const size_t len) {
+    static const char hex[] = "0123456789abcdef";
+
+    out->data[out->len++] = '"';
+
+    size_t index = 0;
+
+    while (index < len) {
+        // copy everything up to the next byte that has to be escaped in bulk
+        const size_t plain = lsuhwi_json_plain_len(from + index, len - index);
+
+        memcpy(out->data + out->len, from + index, plain);
+        out->len += plain;
+        index += plain;
+
+        if (index >= len)
             break;
 
+        const unsigned char cc = (unsigned char)from[index++];
+        char* to = out->data + out->len;
+
+        to[0] = '\\';
+
         switch (cc) {
             case '"':
             case '\\': {
-                fputc('\\', where);
+                to[1] = (char)cc;
+                out->len += 2;
                 break;
             }
+            case '\b': { to[1] = 'b'; out->len += 2; break; }
+            case '\f': { to[1] = 'f'; out->len += 2; break; }
+            case '\n': { to[1] = 'n'; out->len += 2; break; }
+            case '\r': { to[1] = 'r'; out->len += 2; break; }
+            case '\t': { to[1] = 't'; out->len += 2; break; }
+
+            default: {
+                // any other control character
+                memcpy(to + 1, "u00", 3);
+                to[4] = hex[cc >> 4];
+                to[5] = hex[cc & 0xf];
 
-            default:
+                out->len += 6;
                 break;
+            }
+        }
+    }
+
+    out->data[out->len++] = '"';
+}
+
+void format_as_json(const uhwi_dev* current, lsuhwi_out* out) {
+    if (!current || current->type == UHWI_DEV_NULL)
+        return; // impossible though
+
+    if (out->len + LSUHWI_JSON_DEV_MAX > LSUHWI_OUT_MAX)
+        lsuhwi_out_flush(out);
+
+    const char* type = UHWI_DEV_TYPE_TO_CSTR(current->type);
+    const size_t type_len = strlen(type);
+
+    LSUHWI_OUT_LITERAL(out, "{\"type\":\"")
+    memcpy(out->data + out->len, type, type_len);
+    out->len += type_len;
+    out->data[out->len++] = '"';
+
+    if (current->addr != 0) {
+        // bus address as formatted by the OS, for correlating with other tools
+        LSUHWI_OUT_LITERAL(out, ",\"addr\":\"")
+        out->len += uhwi_addr_format(current->addr, out->data + out->len, 64);
+        out->data[out->len++] = '"';
+    }
+
+    LSUHWI_OUT_LITERAL(out, ",\"vendor\":")
+    lsuhwi_out_uint(out, current->vendor);
+    LSUHWI_OUT_LITERAL(out, ",\"device\":")
+    lsuhwi_out_uint(out, current->device);
+    LSUHWI_OUT_LITERAL(out, ",\"subvendor\":")
+    lsuhwi_out_uint(out, current->subvendor);
+    LSUHWI_OUT_LITERAL(out, ",\"subdevice\":")
+    lsuhwi_out_uint(out, current->subdevice);
+    LSUHWI_OUT_LITERAL(out, ",\"name\":")
+
+    // the name is not guaranteed to be NUL-terminated within its buffer
+    const char* end = memchr(current->name, '\0', UHWI_DEV_NAME_MAX_LEN);
+
+    lsuhwi_out_json_str(out, current->name,
+                        end ? (size_t)(end - current->name) :
+                              UHWI_DEV_NAME_MAX_LEN);
+
+    // optional attributes were skipped because of the -T deadline
+    if (current->flags & UHWI_DEV_PARTIAL)
+        LSUHWI_OUT_LITERAL(out, ",\"partial\":true")
+
+    out->data[out->len++] = '}';
+}
+
+typedef enum {
+    LSUHWI_FORMAT_TEXT = 0,
+
+    // a single JSON array
+    LSUHWI_FORMAT_JSON,
+    // newline-delimited JSON, one device object per line
+    LSUHWI_FORMAT_NDJSON,
+    // binary snapshot (see uhwi_snapshot_save())
+    LSUHWI_FORMAT_BINARY
+} lsuhwi_format_t;
+
+typedef struct {
+    uhwi_dev_t type;
+    lsuhwi_format_t format;
+
+    // amount of devices printed so far
+    size_t count;
+
+    // JSON output buffer
+    lsuhwi_out out;
+} lsuhwi_state;
+
+int print_dev(const uhwi_dev* current, void* userdata) {
+    lsuhwi_state* state = userdata;
+
+    if (state->format == LSUHWI_FORMAT_JSON) {
+        // devices are streamed, so the separator goes in front of every but
+        // the first one
+        if (state->count > 0)
+            state->out.data[state->out.len++] = ',';
+
+        format_as_json(current, &state->out);
+    } else if (state->format == LSUHWI_FORMAT_NDJSON) {
+        format_as_json(current, &state->out);
+        state->out.data[state->out.len++] = '\n';
+
+        // every line is handed over as soon as it is complete, so that
+        // collectors reading from a pipe don't wait for the whole listing
+        lsuhwi_out_flush(&state->out);
+        fflush(state->out.where);
+    } else {
+        if (state->type == UHWI_DEV_NULL)
+            fprintf(stdout, "[%s] ", UHWI_DEV_TYPE_TO_CSTR(current->type));
+
+        // system devices are told apart by their addresses rather than IDs
+        if (current->type >= UHWI_DEV_CPU && current->addr != 0) {
+            char addr[32];
+            uhwi_addr_format(current->addr, addr, sizeof(addr));
+
+            fprintf(stdout, "%s: ", addr);
         }
 
-        fputc(cc, where);
-        index++;
+        if (current->type == UHWI_DEV_CPU)
+            fprintf(stdout, "package=%u, core=%u", current->vendor,
+                                                 current->device);
+        else if (current->type == UHWI_DEV_MEM)
+            fprintf(stdout, "state=%s", current->name);
+        else
+            fprintf(stdout, "vendor=0x%04x, device=0x%04x", current->vendor,
+                                                        current->device);
+
+        if (current->type == UHWI_DEV_PCI)
+            fprintf(stdout, ", subvendor=0x%04x, subdevice=0x%04x",
+                            current->subvendor, current->subdevice);
+
+        if (current->name[0] != '\0' && current->type != UHWI_DEV_MEM)
+            fprintf(stdout, ", name: %s", current->name);
+
+        if (current->flags & UHWI_DEV_PARTIAL)
+            fprintf(stdout, " (partial)");
+
+        fprintf(stdout, "%c", '\n');
     }
 
-    fprintf(where, "\"}");
+    state->count++;
+    return 0;
+}
+
+// prints the devices of a previously saved binary snapshot as if they were
+// just enumerated
+int print_snapshot(const uhwi_snapshot* snap, lsuhwi_state* state) {
+    uhwi_dev current;
 
-    if (current->next)
-        fputc(',', where);
+    for (size_t index = 0; index < uhwi_snapshot_count(snap); index++) {
+        uhwi_snapshot_view(snap, index, &current);
+
+        if (state->type == UHWI_DEV_NULL || current.type == state->type)
+            print_dev(&current, state);
+    }
+
+    return 0;
+}
+
+// prints a USB device indented by its depth in the hub/port tree
+int print_tree_dev(const uhwi_snapshot* snap, const size_t index,
+                   const size_t depth, void* userdata) {
+    uhwi_dev current;
+    uhwi_snapshot_view(snap, index, &current);
+
+    for (size_t level = 0; level < depth; level++)
+        fputs("    ", stdout);
+
+    if (current.addr != 0) {
+        char addr[32];
+        uhwi_addr_format(current.addr, addr, sizeof(addr));
+
+        fprintf(stdout, "%s: ", addr);
+    }
+
+    return print_dev(&current, userdata);
+}
+
+//
+// daemon mode
+//
+
+#define LSUHWI_INTERVAL_DEFAULT 60
+#define LSUHWI_INTERVAL_MAX 86400
+
+// a device showing up is followed by a burst of events for its interfaces and
+// drivers, the snapshot is only refreshed once it has been quiet for this long
+#define LSUHWI_HOTPLUG_SETTLE_MS 250
+
+volatile sig_atomic_t lsuhwi_stop = 0;
+
+void lsuhwi_on_signal(int sig) {
+    (void)sig;
+    lsuhwi_stop = 1;
+}
+
+// opens a source of hotplug events to wait on (-1 if there's none, the
+// snapshot is then only refreshed on the timer)
+int lsuhwi_hotplug_open(void) {
+#ifdef __linux__
+    const int fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+
+    // kernel uevents
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+#elif defined(__FreeBSD__)
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+             "/var/run/devd.seqpacket.pipe");
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+void lsuhwi_hotplug_drain(const int fd) {
+    char buf[4096];
+
+    // the events themselves don't matter, everything is enumerated anew
+    while (read(fd, buf, sizeof(buf)) > 0) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, 0) <= 0)
+            break;
+    }
+}
+
+int lsuhwi_daemon(const unsigned int interval) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+
+    // (no SA_RESTART, poll() has to be interrupted)
+    sa.sa_handler = lsuhwi_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    const int hotplug = lsuhwi_hotplug_open();
+
+    // poll() ignores negative descriptors and then merely sleeps
+    struct pollfd pfd = { hotplug, POLLIN, 0 };
+
+    while (!lsuhwi_stop) {
+        uhwi_snapshot* snap = uhwi_snapshot_take(UHWI_DEV_NULL);
+
+        // readers fall back to enumerating on their own once a few refreshes
+        // have been missed
+        if (!snap || uhwi_shm_publish(snap, 3 * interval * 1000) < 0)
+            fprintf(stderr, "failed to publish a UHWI snapshot (errno %d)!!\n",
+                            (int)uhwi_get_errno());
+
+        uhwi_snapshot_free(snap);
+
+        if (poll(&pfd, 1, (int)interval * 1000) > 0) {
+            do
+                lsuhwi_hotplug_drain(hotplug);
+            while (!lsuhwi_stop &&
+                   poll(&pfd, 1, LSUHWI_HOTPLUG_SETTLE_MS) > 0);
+        }
+    }
+
+    uhwi_shm_unpublish();
+
+    if (hotplug >= 0)
+        close(hotplug);
+
+    return 0;
+}
+
+typedef enum {
+    // devices are enumerated (and streamed) right away
+    LSUHWI_SOURCE_ENUM = 0,
+
+    // a binary snapshot file (-r)
+    LSUHWI_SOURCE_FILE,
+    // the shared memory snapshot of a running lsuhwi -D (-S)
+    LSUHWI_SOURCE_SHARED,
+    // the on-disk cache under /run/uhwi (-C)
+    LSUHWI_SOURCE_DISK
+} lsuhwi_source_t;
+
+uhwi_snapshot* lsuhwi_take_snapshot(const lsuhwi_source_t source,
+                                    const uhwi_dev_t type, const char* path,
+                                    const uhwi_opts* opts) {
+    switch (source) {
+        case LSUHWI_SOURCE_FILE:
+            return uhwi_snapshot_load(path);
+        case LSUHWI_SOURCE_SHARED:
+            return uhwi_snapshot_take_shared(type);
+        case LSUHWI_SOURCE_DISK:
+            return uhwi_snapshot_take_persistent(type);
+
+        default:
+            return uhwi_snapshot_take_ex(type, opts);
+    }
 }
 
 #ifdef UHWI_ENABLE_PCI_DB
-uhwi_dev* uhwi_db_init(void);
+// prints the PCI DB vendors & devices whose name contains the query, the same
+// way lsuhwi -d would
+int lsuhwi_search_db(const char* query, lsuhwi_state* state) {
+    // (the search index covers every name, so the whole DB gets parsed)
+    uhwi_db* db = uhwi_db_open_ex(NULL, UHWI_DB_PARALLEL);
+
+    if (!db)
+        return -1;
+
+    // (the second search reuses the index built by the first one)
+    const size_t count = uhwi_db_search(db, query, NULL, 0);
+    uhwi_db_match* matches = malloc((count ? count : 1) * sizeof(uhwi_db_match));
+
+    if (!matches) {
+        uhwi_db_close(db);
+        return -1;
+    }
+
+    uhwi_db_search(db, query, matches, count);
+
+    uhwi_dev current;
+
+    for (size_t index = 0; index < count; index++) {
+        memset(&current, 0, sizeof(uhwi_dev));
+
+        current.type = UHWI_DEV_PCI;
+        current.vendor = matches[index].vendor;
+        current.device = matches[index].device;
+
+        uhwi_db_strncpy_name(db, current.vendor, current.device, current.name,
+                             UHWI_DEV_NAME_MAX_LEN);
+
+        print_dev(&current, state);
+    }
+
+    free(matches);
+    uhwi_db_close(db);
+
+    return 0;
+}
 #else
 uhwi_dev* uhwi_db_init(void) {
     return NULL;
 }
+
+int lsuhwi_search_db(const char* query, lsuhwi_state* state) {
+    (void)query;
+    (void)state;
+
+    return -1;
+}
 #endif
 
 int main(const int argc, const char** argv) {
-    uhwi_dev_t type = UHWI_DEV_NULL;
+    // (the output buffer is too large for the stack)
+    static lsuhwi_state state;
 
-    size_t as_json = 0;
+    state.type = UHWI_DEV_NULL;
+    state.out.where = stdout;
     size_t dump_pci_db = 0;
+    size_t usb_tree = 0;
+    const char* search_query = NULL;
+    const char* snapshot_path = NULL;
+    lsuhwi_source_t source = LSUHWI_SOURCE_ENUM;
+
+    uhwi_opts opts;
+    memset(&opts, 0, sizeof(opts));
+
+    size_t run_daemon = 0;
+    unsigned long interval = LSUHWI_INTERVAL_DEFAULT;
 
     for (size_t index = 1; index < (size_t)argc; index++) {
         if (argv[index][0] == '-' && argv[index][1] != '\0') {
             switch (argv[index][1]) {
                 case 'u': {
-                    type = UHWI_DEV_USB;
+                    state.type = UHWI_DEV_USB;
                     break;
                 }
                 case 'l': {
-                    type = UHWI_DEV_PCI;
+                    state.type = UHWI_DEV_PCI;
+                    break;
+                }
+                case 'c': {
+                    state.type = UHWI_DEV_CPU;
+                    break;
+                }
+                case 'm': {
+                    state.type = UHWI_DEV_MEM;
+                    break;
+                }
+                case 'b': {
+                    state.type = UHWI_DEV_BLOCK;
                     break;
                 }
                 case 'd': {
                     dump_pci_db = 1;
                     break;
                 }
+                case 's': {
+                    if (index + 1 >= (size_t)argc)
+                        return show_usage(argv[0]);
+
+                    search_query = argv[++index];
+                    break;
+                }
+                case 't': {
+                    usb_tree = 1;
+                    break;
+                }
                 case 'J': {
-                    as_json = 1;
+                    state.format = LSUHWI_FORMAT_JSON;
+                    break;
+                }
+                case 'N': {
+                    state.format = LSUHWI_FORMAT_NDJSON;
+                    break;
+                }
+                case 'B': {
+                    state.format = LSUHWI_FORMAT_BINARY;
+                    break;
+                }
+                case 'r': {
+                    if (index + 1 >= (size_t)argc)
+                        return show_usage(argv[0]);
+
+                    snapshot_path = argv[++index];
+                    source = LSUHWI_SOURCE_FILE;
+                    break;
+                }
+                case 'S': {
+                    source = LSUHWI_SOURCE_SHARED;
+                    break;
+                }
+                case 'C': {
+                    source = LSUHWI_SOURCE_DISK;
+
+#ifdef UHWI_ENABLE_PCI_DB
+                    // (already writing to the disk cache directory anyway)
+                    uhwi_pci_db_sidecar_enable(1);
+#endif
+                    break;
+                }
+                case 'T': {
+                    if (index + 1 >= (size_t)argc)
+                        return show_usage(argv[0]);
+
+                    opts.deadline_ms = (unsigned int)strtoul(argv[++index],
+                                                             NULL, 10);
+                    break;
+                }
+                case 'D': {
+                    run_daemon = 1;
+                    break;
+                }
+#ifdef UHWI_ENABLE_TRACE
+                case 'x': {
+                    uhwi_set_trace_cb(lsuhwi_trace, NULL);
+                    break;
+                }
+#endif
+                case 'i': {
+                    if (index + 1 >= (size_t)argc)
+                        return show_usage(argv[0]);
+
+                    interval = strtoul(argv[++index], NULL, 10);
+
+                    if (interval == 0 || interval > LSUHWI_INTERVAL_MAX)
+                        return show_usage(argv[0]);
+
                     break;
                 }
                 default:
@@ -91,44 +679,100 @@ int main(const int argc, const char** argv) {
         }
     }
 
-    uhwi_dev* first = dump_pci_db ? uhwi_db_init() : uhwi_get_devs(type);
+    if (run_daemon)
+        return lsuhwi_daemon((unsigned int)interval);
 
-    if (!first && uhwi_get_errno() != UHWI_ERRNO_OK) {
-        fprintf(stderr, "failed to obtain UHWI device info (or no devices of this type are connected to the system)!!\n");
-        return 1;
-    }
+    if (usb_tree) {
+        // the tree is a text-only view of the USB devices
+        if (dump_pci_db || state.format != LSUHWI_FORMAT_TEXT)
+            return show_usage(argv[0]);
+
+        state.type = UHWI_DEV_USB;
 
-    if (as_json)
-        fputc('[', stdout);
+        uhwi_snapshot* snap = lsuhwi_take_snapshot(source, UHWI_DEV_USB,
+                                                   snapshot_path, &opts);
 
-    while (first) {
-        uhwi_dev* next = first->next;
+        if (snap)
+            uhwi_usb_walk(snap, print_tree_dev, &state);
 
-        if (as_json)
-            format_as_json(first, stdout);
-        else {
-            if (type == UHWI_DEV_NULL)
-                fprintf(stdout, "[%s] ", UHWI_DEV_TYPE_TO_CSTR(first->type));
+        uhwi_snapshot_free(snap);
 
-            fprintf(stdout, "vendor=0x%04x, device=0x%04x", first->vendor,
-                                                        first->device);
+        if (state.count == 0) {
+            fprintf(stderr, "failed to obtain UHWI device info (or no devices of this type are connected to the system)!!\n");
+            return 1;
+        }
 
-            if (first->type == UHWI_DEV_PCI)
-                fprintf(stdout, ", subvendor=0x%04x, subdevice=0x%04x",
-                                first->subvendor, first->subdevice);
+        return 0;
+    }
 
-            if (first->name[0] != '\0')
-                fprintf(stdout, ", name: %s", first->name);
+    if (state.format == LSUHWI_FORMAT_BINARY) {
+        // the PCI DB is not a device listing
+        if (dump_pci_db || search_query)
+            return show_usage(argv[0]);
 
-            fprintf(stdout, "%c", '\n');
+        uhwi_snapshot* snap = lsuhwi_take_snapshot(source, state.type,
+                                                   snapshot_path, &opts);
+
+        const int rc = uhwi_snapshot_save(snap, STDOUT_FILENO);
+        uhwi_snapshot_free(snap);
+
+        if (rc < 0) {
+            fprintf(stderr, "failed to write a UHWI binary snapshot!!\n");
+            return 1;
         }
 
-        free(first);
-        first = next;
+        return 0;
+    }
+
+    if (state.format == LSUHWI_FORMAT_JSON)
+        state.out.data[state.out.len++] = '[';
+
+    int rc = 0;
+
+    if (source != LSUHWI_SOURCE_ENUM) {
+        // converts a binary snapshot back into text or JSON, or lists the one
+        // kept by a running lsuhwi -D or saved under /run/uhwi
+        uhwi_snapshot* snap = lsuhwi_take_snapshot(source, state.type,
+                                                   snapshot_path, &opts);
+        rc = (snap) ? print_snapshot(snap, &state) : -1;
+
+        uhwi_snapshot_free(snap);
+    } else if (search_query) {
+        // looks the PCI DB up by name instead of dumping all of it
+        rc = lsuhwi_search_db(search_query, &state);
+
+        if (rc == 0 && state.count == 0)
+            fprintf(stderr, "no PCI DB entries match \"%s\"\n", search_query);
+    } else if (dump_pci_db) {
+        // the PCI DB is still handed out as a linked list
+        uhwi_dev* first = uhwi_db_init();
+        rc = (!first && uhwi_get_errno() != UHWI_ERRNO_OK) ? -1 : 0;
+
+        for (uhwi_dev* current = first; current; current = current->next)
+            print_dev(current, &state);
+
+        uhwi_clean_up(first);
+    } else // devices are printed as soon as they are enumerated
+        rc = uhwi_foreach_dev_ex(state.type, &opts, print_dev, &state);
+
+    // like before, a partial listing (e.g. PCI devices without USB ones) is
+    // still a success
+    if (rc < 0 && state.count == 0) {
+        state.out.len = 0;
+
+        fprintf(stderr, "failed to obtain UHWI device info (or no devices of this type are connected to the system)!!\n");
+        return 1;
+    }
+
+    if (state.format == LSUHWI_FORMAT_JSON) {
+        // (the last device might have filled the buffer up to the brim)
+        if (state.out.len + 2 > LSUHWI_OUT_MAX)
+            lsuhwi_out_flush(&state.out);
+
+        LSUHWI_OUT_LITERAL(&state.out, "]\n")
     }
 
-    if (as_json)
-        fputc(']', stdout);
+    lsuhwi_out_flush(&state.out);
 
     return 0;
 }
@@ -31,6 +31,7 @@
 #include <errno.h>
 
 #include <unistd.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -43,390 +44,104 @@
 #include <libusb20.h>
 #include <libusb20_desc.h>
 
-#define UHWI_PCI_DEV_PATH_CONST "/dev/pci"
 #define UHWI_PCI_IORS_SZ_BASE 32
-#elif defined(__linux__)
-#include <linux/limits.h>
-#include <dirent.h>
-
-#define UHWI_PCI_DIR_PATH_CONST "/sys/bus/pci/devices"
-#define UHWI_PCI_PBSZ_CONST 7
-
-#define UHWI_USB_DIR_PATH_CONST "/sys/bus/usb/devices"
 #endif
 
-#include "uhwi.h"
+#include "uhwi_internal.h"
 
-uhwi_errno_t uhwi_last_errno = UHWI_ERRNO_OK;
+__thread uhwi_errno_t uhwi_last_errno = UHWI_ERRNO_OK;
 
 #ifdef __APPLE__
 // use an IOKit wrapper function since the f/w supports device filtering by
 // type natively (kinda)
-uhwi_dev* uhwi_get_macos_devs(const uhwi_dev_t type, uhwi_dev** lpp);
+int uhwi_foreach_macos_dev(const uhwi_dev_t type, uhwi_dev_cb cb,
+                           void* userdata);
 #endif
 
-#define SSCANF_ID(from, into, prefixed) { \
-    const char* pfmt = "0x%04x"; \
-    \
-    if (!prefixed) /* afaik only Linux sysfs PCI IDs are prefixed with a 0x */ \
-        pfmt += 2; \
-    \
-    /* on most OSses scanf() and its counterparts try to write "%x"-ed values into uint32_t-s, */ \
-    /* which is problematic since uhwi_id_t is a 16-bit unsigned integer, hence we need a */ \
-    /* proxy 32-bit unsigned integer variable to perform a cast almost immediately after the */ \
-    /* sscanf() call */ \
-    uint32_t conv = 0; \
-    sscanf(from, pfmt, &conv); \
-    \
-    into = (uhwi_id_t)conv; \
-}
-
-#ifdef UHWI_ENABLE_PCI_DB
-
-# ifndef UHWI_PCI_DB_PATH_CONST
-#  ifdef __FreeBSD__
-#   define UHWI_PCI_DB_PATH_CONST "/usr/share/misc/pci_vendors"
-#  elif defined(__linux__)
-#   define UHWI_PCI_DB_PATH_CONST "/usr/share/misc/pci.ids"
-#  else
-#   error "Please define UHWI_PCI_DB_PATH_CONST (path to PCI IDs DB) via your C compiler flags."
-#  endif
-
-# endif
-
-typedef enum {
-    // newline
-    UHWI_DB_STATE_NL = 0,
-    // device newline
-    UHWI_DB_STATE_DEVICE_NL,
-
-    // comment
-    UHWI_DB_STATE_COMMENT,
-
-    // vendor/device name C string
-    UHWI_DB_STATE_NAME,
-} uhwi_db_state_t;
-
-#define INIT_DB_ENTRY(first, current, dfv, dfd) { \
-    /* there could be default vendor and device IDs specified */ \
-    uhwi_id_t vcur = dfv; \
-    uhwi_id_t dcur = dfd; \
-    \
-    if (current) { \
-        current->next = malloc(sizeof(uhwi_dev)); \
-        current = current->next; \
-    } else { \
-        first = malloc(sizeof(uhwi_dev)); \
-        current = first; \
-    } \
-    \
-    memset(current, 0, sizeof(uhwi_dev)); \
-    current->type = UHWI_DEV_PCI; \
-    \
-    current->vendor = vcur; \
-    current->device = dcur; \
-}
-
-#define RESET_TOKEN(token, max, index) { \
-    memset(token, 0, max); \
-    index = 0; \
-}
-
-#define SCAN_DB_ID_INTO_NEW_ENTRY(first, current, dfv, dfd, field) { \
-    /* initialize a new uhwi_dev* representing a DB entry */ \
-    INIT_DB_ENTRY(first, current, dfv, dfd) \
-    \
-    /* read in the currently stored C string form of ID into the provided field of the */ \
-    /* DB entry */ \
-    SSCANF_ID(token, current->field, 0) \
-    \
-    /* don't forget to reset the token */ \
-    RESET_TOKEN(token, UHWI_DEV_NAME_MAX_LEN, index) \
-}
-
-uhwi_dev* uhwi_db_init(void) {
-    uhwi_last_errno = UHWI_ERRNO_OK;
-
-    uhwi_dev* first = NULL;
-    int fd = open(UHWI_PCI_DB_PATH_CONST, O_RDONLY, 0);
-
-    if (fd < 0) {
-        uhwi_last_errno = UHWI_ERRNO_PCI_DB_NO_ACCESS;
-        return NULL;
-    }
-
-    // the state machine for processing the PCI vendors DB file
-    uhwi_db_state_t state = UHWI_DB_STATE_NL;
-
-    // C string token
-    char token[UHWI_DEV_NAME_MAX_LEN];
-    size_t index = 0;
-
-    RESET_TOKEN(token, UHWI_DEV_NAME_MAX_LEN, index)
-
-    uhwi_dev* current = NULL;
-
-    while (1) {
-        char cc = '\0';
-        read(fd, &cc, 1);
-
-        if (cc == '\r' || cc == '\n' || cc == '\0') {
-            // newline encountered
-            if (state == UHWI_DB_STATE_NAME && index > 0 && current)
-                strncpy(current->name, token, UHWI_DEV_NAME_MAX_LEN);
-
-            // reset current token & state
-            state = UHWI_DB_STATE_NL;
-            RESET_TOKEN(token, UHWI_DEV_NAME_MAX_LEN, index)
-
-            if (cc == '\0')
-                break; // EOF or error, doesn't matter - time to stop regardless
-        } else if (cc == '#' && state != UHWI_DB_STATE_NAME)
-            state = UHWI_DB_STATE_COMMENT; // the entire line is a comment
-        else if (isspace(cc) == 0 && cc != 'C' &&
-                 (index + 1) < UHWI_DEV_NAME_MAX_LEN &&
-                 state != UHWI_DB_STATE_COMMENT)
-            token[index++] = cc; // add the character to the token as is
-        else {
-            switch (state) {
-                case UHWI_DB_STATE_NL: {
-                    // vendor  vendor_name
-                    if (index < 1) {
-                        if (cc == 'C') // TODO: use more conventional way to end the loop
-                            lseek(fd, 0, SEEK_END); // classification -> forced EOF
-                        else if (current)
-                            state = UHWI_DB_STATE_DEVICE_NL; // one tab -> device line
-                    } else {
-                        state = UHWI_DB_STATE_NAME;
-                        SCAN_DB_ID_INTO_NEW_ENTRY(first, current, 0, 0, vendor)
-                    }
-
-                    break;
-                }
-                case UHWI_DB_STATE_DEVICE_NL: {
-                    //    device  device_name
-                    if (index < 1)
-                        state = UHWI_DB_STATE_COMMENT; // [currently TODO] two tabs -> subvendor line
-                    else {
-                        state = UHWI_DB_STATE_NAME;
-                        SCAN_DB_ID_INTO_NEW_ENTRY(first, current, current->vendor, 0,
-                                                  device)
-                    }
-
-                    break;
-                }
-                case UHWI_DB_STATE_COMMENT:
-                    break; // ignore during a comment
-                default: {
-                    // treat the current space character as part of a vendor/device name
-                    // C string
-                    token[index++] = cc;
-                    break;
-                }
-            }
-        }
-    }
-
-    // clean up and return the first entry in the PCI DB
-    close(fd);
-    return first;
-}
-
-void uhwi_strncpy_pci_db_dev_name(uhwi_dev* current, uhwi_dev* db) {
-    const char* vname = "Unknown";
-    const char* dname = NULL;
-
-    while (db) {
-        if (db->vendor == current->vendor) {
-            if (db->device == current->device) {
-                // exact match (TODO: support subvendor/subdevice IDs)
-                dname = db->name;
-                break;
-            } else // only the vendor name C string is known for now
-                vname = db->name;
-        }
-
-        // go through each PCI DB device entry
-        db = db->next;
+#ifdef __FreeBSD__
+// libusb20_dev_req_string_simple_sync() waits up to a second per request
+#define UHWI_USB_REQ_TIMEOUT_MS 1000
+
+// same as libusb20_dev_req_string_simple_sync() (the first supported language,
+// non-ASCII characters turned into dots), but with requests bounded by what is
+// left until the deadline
+int uhwi_libusb20_req_string(struct libusb20_device* dvp, const uint8_t idx,
+                             char* buf, const size_t max) {
+    struct LIBUSB20_CONTROL_SETUP_DECODED req;
+    uint8_t desc[255];
+    uint16_t actlen = 0;
+
+    LIBUSB20_INIT(LIBUSB20_CONTROL_SETUP, &req);
+
+    req.bmRequestType = LIBUSB20_ENDPOINT_IN | LIBUSB20_REQUEST_TYPE_STANDARD |
+                        LIBUSB20_RECIPIENT_DEVICE;
+    req.bRequest = LIBUSB20_REQUEST_GET_DESCRIPTOR;
+
+    // string descriptor 0 lists the supported language IDs
+    req.wValue = LIBUSB20_DT_STRING << 8;
+    req.wIndex = 0;
+    req.wLength = sizeof(desc);
+
+    if (libusb20_dev_request_sync(dvp, &req, desc, &actlen,
+                                  uhwi_deadline_left_ms(UHWI_USB_REQ_TIMEOUT_MS),
+                                  0) != 0 || actlen < 4)
+        return -1;
+
+    req.wValue = (LIBUSB20_DT_STRING << 8) | idx;
+    req.wIndex = (uint16_t)(desc[2] | (desc[3] << 8));
+
+    if (libusb20_dev_request_sync(dvp, &req, desc, &actlen,
+                                  uhwi_deadline_left_ms(UHWI_USB_REQ_TIMEOUT_MS),
+                                  0) != 0 || actlen < 2)
+        return -1;
+
+    // UTF-16LE code units follow the 2-byte descriptor header
+    const size_t end = (desc[0] < actlen) ? desc[0] : actlen;
+    size_t len = 0;
+
+    for (size_t offset = 2; offset + 1 < end && len + 1 < max; offset += 2) {
+        const uint16_t unit = (uint16_t)(desc[offset] | (desc[offset + 1] << 8));
+        buf[len++] = (unit >= 0x20 && unit < 0x7f) ? (char)unit : '.';
     }
 
-    // if any name is detected for the PCI device, use it, overriding
-    // the one returned by the OS itself (if any)
-    strncpy(current->name, vname, UHWI_DEV_NAME_MAX_LEN - 1);
-
-    if (dname)
-        strncat(current->name, dname, UHWI_DEV_NAME_MAX_LEN - 1);
-}
-
-#undef SCAN_DB_ID_INTO_NEW_ENTRY
-#undef INIT_DB_ENTRY
-
-#undef RESET_TOKEN
-#endif
-
-#ifdef __linux__
-#define COMBINE_PATH(base, label, fn) { \
-    memset(path, 0, PATH_MAX); \
-    snprintf(path, PATH_MAX - 1, "%s/%s/%s", base, label, fn); \
-}
-
-#define POPULATE_ID_FROM_PATH(result, path, prefixed, mandatory) { \
-    if (access(path, F_OK) == 0) { \
-        int pfd = open(path, O_RDONLY, 0); \
-        \
-        if (pfd >= 0) { \
-            /* buffer that stores the prettified contents of the specified */ \
-            /* sysfs pseudo-file, which are probably in a format of a 4-digit */ \
-            /* hexademical value prepended with a 0x */ \
-            char pbuf[UHWI_PCI_PBSZ_CONST]; \
-            \
-            /* read in pseudo-file contents into the buffer */ \
-            memset(pbuf, 0, UHWI_PCI_PBSZ_CONST); \
-            if (read(pfd, pbuf, UHWI_PCI_PBSZ_CONST) > 0) \
-                SSCANF_ID(pbuf, result, prefixed) \
-            \
-            /* clean up */ \
-            close(pfd); \
-        } \
-    } else if (mandatory) \
-        return NULL; /* fail as is (keep in mind, NO CLEAN UP PERFORMED!!) */ \
-}
-
-#define POPULATE_ID_FROM_COMBINED_PATH(base, label, fn, result, prefixed, mandatory) { \
-    COMBINE_PATH(base, label, fn) \
-    POPULATE_ID_FROM_PATH(result, path, prefixed, mandatory) \
+    buf[len] = '\0';
+    return 0;
 }
 
-uhwi_dev* uhwi_cat_sysfs_pci_dev(const char* label, uhwi_dev* db) {
-    char path[PATH_MAX];
+// returns -1 if the string was skipped because the deadline has passed
+int uhwi_strncat_libusb20_indexed_cstr(struct libusb20_device* dvp,
+                                       const uint8_t idx,
+                                       char* target,
+                                       const size_t max) {
+    if (uhwi_deadline_passed())
+        return -1;
 
-    uhwi_id_t vendor = 0;
-    uhwi_id_t device = 0;
-
-    uhwi_id_t subvendor = 0;
-    uhwi_id_t subdevice = 0;
-
-    // obtain utmost important values - PCI vendor and device IDs
-    POPULATE_ID_FROM_COMBINED_PATH(UHWI_PCI_DIR_PATH_CONST,
-                                   label, "vendor",
-                                   vendor, 1, 1)
-    POPULATE_ID_FROM_COMBINED_PATH(UHWI_PCI_DIR_PATH_CONST,
-                                   label, "device",
-                                   device, 1, 1)
-
-    // then obtain the rest, if available (subvendor and subdevice IDs)
-    POPULATE_ID_FROM_COMBINED_PATH(UHWI_PCI_DIR_PATH_CONST,
-                                   label, "subsystem_vendor",
-                                   subvendor, 1, 0)
-    POPULATE_ID_FROM_COMBINED_PATH(UHWI_PCI_DIR_PATH_CONST,
-                                   label, "subsystem_device",
-                                   subdevice, 1, 0)
-
-    // prepare the resulting uhwi_dev* populated with all the values we have
-    // obtained so far
-    uhwi_dev* result = malloc(sizeof(uhwi_dev));
-    memset(result, 0, sizeof(uhwi_dev));
-
-    result->type = UHWI_DEV_PCI;
-
-    result->vendor = vendor;
-    result->device = device;
-
-    result->subvendor = subvendor;
-    result->subdevice = subdevice;
-
-# ifdef UHWI_ENABLE_PCI_DB
-    // try to detect PCI device name C string, if possible
-    uhwi_strncpy_pci_db_dev_name(result, db);
-# endif
-
-    return result;
-}
-
-#define READ_USB_DEVICE_CSTR_DIRECTLY_FROM_COMBINED_PATH(label, fn, into, max) { \
-    COMBINE_PATH(UHWI_USB_DIR_PATH_CONST, label, fn) \
-    \
-    int pfd = open(path, O_RDONLY, 0); \
-    \
-    if (pfd) { \
-        char pbuf[max]; \
-        memset(pbuf, 0, max); \
-        \
-        ssize_t rdsz = read(pfd, pbuf, max); \
-        \
-        if (rdsz > 1) { \
-            pbuf[rdsz - 1] = ' '; /* replace trailing newline to combine C strings */ \
-            strncat(into, pbuf, max - 1); \
-        } \
-        \
-        close(pfd); \
-    } \
-}
-
-uhwi_dev* uhwi_sysfs_cat_usb_dev(const char* label) {
-    char path[PATH_MAX];
-
-    uhwi_id_t vendor = 0;
-    uhwi_id_t device = 0;
-
-    // obtain USB vendor and product/device IDs (all are mandatory)
-    POPULATE_ID_FROM_COMBINED_PATH(UHWI_USB_DIR_PATH_CONST,
-                                   label, "idVendor",
-                                   vendor, 0, 1)
-    POPULATE_ID_FROM_COMBINED_PATH(UHWI_USB_DIR_PATH_CONST,
-                                   label, "idProduct",
-                                   device, 0, 1)
-
-    uhwi_dev* result = malloc(sizeof(uhwi_dev));
-    memset(result, 0, sizeof(uhwi_dev));
-
-    result->type = UHWI_DEV_USB;
-
-    result->vendor = vendor;
-    result->device = device;
-
-    // attempt to read in self-reported USB device manufacturer + product/model
-    // name
-    READ_USB_DEVICE_CSTR_DIRECTLY_FROM_COMBINED_PATH(label, "manufacturer",
-                                                     result->name,
-                                                     UHWI_DEV_NAME_MAX_LEN)
-    READ_USB_DEVICE_CSTR_DIRECTLY_FROM_COMBINED_PATH(label, "product",
-                                                     result->name,
-                                                     UHWI_DEV_NAME_MAX_LEN)
-
-    return result;
-}
-
-#undef READ_USB_DEVICE_CSTR_DIRECTLY_FROM_COMBINED_PATH
-
-#undef POPULATE_ID_FROM_COMBINED_PATH
-#undef POPULATE_ID_FROM_PATH
-
-#undef COMBINE_PATH
-#endif
-
-#ifdef __FreeBSD__
-void uhwi_strncat_libusb20_indexed_cstr(struct libusb20_device* dvp,
-                                        const uint8_t idx,
-                                        char* target,
-                                        const size_t max) {
     // attempt to open USB device in control transfer-exclusive mode
-    if (libusb20_dev_open(dvp, 0) != 0)
-        return;
+    if (idx == 0 || libusb20_dev_open(dvp, 0) != 0)
+        return 0;
 
     char buf[max];
     memset(buf, 0, max);
 
+    UHWI_TRACE_START(since)
+
     // try to obtain ASCII C string on the specified USB index
-    if (libusb20_dev_req_string_simple_sync(dvp, idx, buf, max - 1) == 0) {
-        // on success, strncat() it with a trailing space (to make additional
+    const int rc = uhwi_libusb20_req_string(dvp, idx, buf, max);
+
+    UHWI_TRACE_ATTR(since, UHWI_DEV_USB, NULL, "string descriptor",
+                    (rc == 0) ? (int64_t)strlen(buf) : -1)
+
+    if (rc == 0) {
+        // on success, append it with a trailing space (to make additional
         // reads to the same C string buffer combineable)
-        strncat(target, buf, max - 1);
-        strncat(target, " ", max - 1);
+        const size_t used = strlen(target);
+
+        snprintf(target + used, max - used, "%s ", buf);
     }
 
     // clean up
     libusb20_dev_close(dvp);
+    return 0;
 }
 #endif
 
@@ -441,20 +156,37 @@ void uhwi_strncat_libusb20_indexed_cstr(struct libusb20_device* dvp,
     } \
 }
 
-uhwi_dev* uhwi_get_pci_devs(uhwi_dev** lpp) {
-    uhwi_dev* first = NULL;
-    uhwi_dev* last = NULL;
+typedef struct {
+    uhwi_dev* first;
+    uhwi_dev* last;
+} uhwi_dev_list;
 
-    uhwi_dev* db = NULL;
-    uhwi_last_errno = UHWI_ERRNO_OK;
+int uhwi_dev_list_append(const uhwi_dev* dev, void* userdata) {
+    uhwi_dev_list* list = userdata;
 
-#ifdef UHWI_ENABLE_PCI_DB
-    // parse PCI device naming DB into memory
-    db = uhwi_db_init();
+    // the record handed out by the enumeration loop is reused for the next
+    // device, hence a heap copy of it is made for the linked list
+    uhwi_dev* current = uhwi_mem_alloc(sizeof(uhwi_dev));
 
-    if (!db && uhwi_last_errno != UHWI_ERRNO_OK)
-        return NULL; // fail in case if parsing failed
-#endif
+    // (stops the enumeration, which then fails as a whole)
+    if (!current) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    memcpy(current, dev, sizeof(uhwi_dev));
+
+    current->next = NULL;
+
+    ADD_TO_LINKED_LIST(list->first, list->last, current)
+    return 0;
+}
+
+int uhwi_foreach_pci_dev(uhwi_dev_cb cb, void* userdata, uhwi_db* db) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    // result of the last callback invocation (non-zero stops the loop)
+    int rc = 0;
 
 #ifdef __FreeBSD__
     // open the PCI global control device for read first
@@ -462,14 +194,19 @@ uhwi_dev* uhwi_get_pci_devs(uhwi_dev** lpp) {
 
     if (fd < 0) {
         uhwi_last_errno = UHWI_ERRNO_PCI_OPEN;
-
-        uhwi_clean_up(db);
-        return NULL;
+        return -1;
     }
 
     // iors -> I/O (ioctl) result
     size_t iors_sz = sizeof(struct pci_conf) * UHWI_PCI_IORS_SZ_BASE;
-    struct pci_conf* iors = malloc(iors_sz);
+    struct pci_conf* iors = uhwi_mem_alloc(iors_sz);
+
+    if (!iors) {
+        close(fd);
+
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
 
     // try to obtain as much PCI devices into the iors buffer as possible
     struct pci_conf_io cnf;
@@ -478,103 +215,106 @@ uhwi_dev* uhwi_get_pci_devs(uhwi_dev** lpp) {
     cnf.match_buf_len = iors_sz;
     cnf.matches = iors;
 
+    // a single record is reused for every device handed out to the callback
+    uhwi_dev current;
+
     while (1) {
         if (ioctl(fd, PCIOCGETCONF, &cnf) == -1 ||
             cnf.status == PCI_GETCONF_LIST_CHANGED ||
             cnf.status == PCI_GETCONF_ERROR) {
             // clean up and fail
-            uhwi_clean_up(db);
-
-            free(iors);
+            uhwi_mem_free(iors);
             close(fd);
 
             uhwi_last_errno = UHWI_ERRNO_PCI_IOCTL;
-            return NULL;
+            return -1;
         }
 
         size_t index = 0;
 
-        while (index < cnf.num_matches) {
-            uhwi_dev* current = malloc(sizeof(uhwi_dev));
-            memset(current, 0, sizeof(uhwi_dev));
+        while (rc == 0 && index < cnf.num_matches) {
+            UHWI_TRACE_DEV_BEGIN(since, UHWI_DEV_PCI, NULL)
+
+            memset(&current, 0, sizeof(uhwi_dev));
+
+            current.type = UHWI_DEV_PCI;
+            current.vendor = iors[index].pc_vendor;
+            current.device = iors[index].pc_device;
 
-            current->type = UHWI_DEV_PCI;
-            current->vendor = iors[index].pc_vendor;
-            current->device = iors[index].pc_device;
+            current.subvendor = iors[index].pc_subvendor;
+            current.subdevice = iors[index].pc_subdevice;
 
-            current->subvendor = iors[index].pc_subvendor;
-            current->subdevice = iors[index].pc_subdevice;
+            current.addr = UHWI_ADDR_PCI(iors[index].pc_sel.pc_domain,
+                                         iors[index].pc_sel.pc_bus,
+                                         iors[index].pc_sel.pc_dev,
+                                         iors[index].pc_sel.pc_func);
 
+            // (the rest comes with the same ioctl, only the name is optional)
+            if (uhwi_deadline_passed())
+                current.flags |= UHWI_DEV_PARTIAL;
 # ifdef UHWI_ENABLE_PCI_DB
             // try to guess PCI device C string from the DB, if possible
-            uhwi_strncpy_pci_db_dev_name(current, db);
+            else if (db)
+                uhwi_db_strncpy_name(db, current.vendor, current.device,
+                                     current.name, UHWI_DEV_NAME_MAX_LEN);
 # endif
 
-            ADD_TO_LINKED_LIST(first, last, current)
+            UHWI_TRACE_DEV_END(since, UHWI_DEV_PCI, NULL, &current)
+
+            rc = cb(&current, userdata);
             index++;
         }
 
-        if (cnf.status == PCI_GETCONF_LAST_DEVICE)
+        if (rc != 0 || cnf.status == PCI_GETCONF_LAST_DEVICE)
             break;
     }
 
     // clean up
-    free(iors);
+    uhwi_mem_free(iors);
     close(fd);
 #elif defined(__APPLE__)
-    first = uhwi_get_macos_devs(UHWI_DEV_PCI, &last);
+    rc = uhwi_foreach_macos_dev(UHWI_DEV_PCI, cb, userdata);
 #elif defined(__linux__)
-    DIR* descd = opendir(UHWI_PCI_DIR_PATH_CONST);
-
-    if (!descd) {
-        // failed to access /sys/bus/pci/devices directory -> clean up & fail
-        uhwi_clean_up(db);
-
-        uhwi_last_errno = UHWI_ERRNO_SYSFS_OPEN;
-        return NULL;
-    }
+    rc = uhwi_sysfs_foreach(uhwi_sysfs_class_of(UHWI_DEV_PCI), cb, userdata, db);
+#endif
 
-    // each PCI device is represented by a directory
-    struct dirent* entry = NULL;
+    return rc;
+}
 
-    while (1) {
-        entry = readdir(descd);
+#ifdef UHWI_ENABLE_PCI_DB
+// whether uhwi_pci_db_sidecar_enable() turned the sidecar on
+int uhwi_pci_db_sidecar = 0;
 
-        if (!entry)
-            break; // end of directory listing
-        else if (entry->d_name[0] == '.')
-            continue; // skip all hidden or parent reference entries
+void uhwi_pci_db_sidecar_enable(const int enable) {
+    __atomic_store_n(&uhwi_pci_db_sidecar, enable ? 1 : 0, __ATOMIC_RELAXED);
+}
+#endif
 
-        // prepare uhwi_dev* from the specified PCI device-representing
-        // pseudo-directory
-        uhwi_dev* current = uhwi_cat_sysfs_pci_dev(entry->d_name, db);
+int uhwi_pci_db_open(uhwi_db** dbp) {
+    (*dbp) = NULL;
 
-        if (!current)
-            continue;
+#ifdef UHWI_ENABLE_PCI_DB
+    // skim PCI device naming DB for where each vendor's block is (or take that
+    // from the sidecar, if enabled), only the vendors actually present in the
+    // system are parsed any further
+    const int sidecar = __atomic_load_n(&uhwi_pci_db_sidecar, __ATOMIC_RELAXED);
 
-        ADD_TO_LINKED_LIST(first, last, current)
-    }
+    (*dbp) = uhwi_db_open_ex(NULL, UHWI_DB_SKIM |
+                                   (sidecar ? UHWI_DB_SIDECAR : 0));
 
-    // clean up
-    closedir(descd);
+    if (!(*dbp))
+        return -1; // fail in case if parsing failed
 #endif
 
-    // return pointer to the last detected PCI device, if requested
-    if (lpp)
-        (*lpp) = last;
-
-    // unload PCI DB from memory, if it was loaded in the first place
-    uhwi_clean_up(db);
-
-    return first;
+    return 0;
 }
 
-uhwi_dev* uhwi_get_usb_devs(void) {
-    uhwi_dev* first = NULL;
-    uhwi_dev* last = NULL;
-
+int uhwi_foreach_usb_dev(uhwi_dev_cb cb, void* userdata) {
     uhwi_last_errno = UHWI_ERRNO_OK;
 
+    // result of the last callback invocation (non-zero stops the loop)
+    int rc = 0;
+
 #ifdef __FreeBSD__
     //
     // FreeBSD comes with its copy of libusb 1.0, which seems to be broken,
@@ -594,13 +334,14 @@ uhwi_dev* uhwi_get_usb_devs(void) {
 
     if (!bke) {
         uhwi_last_errno = UHWI_ERRNO_USB_INIT;
-        return NULL;
+        return -1;
     }
 
     // try to go through a list of USB devices plugged into the current system
     struct libusb20_device* dvp = NULL;
+    uhwi_dev current;
 
-    while (1) {
+    while (rc == 0) {
         dvp = libusb20_be_device_foreach(bke, dvp);
 
         if (!dvp)
@@ -611,80 +352,169 @@ uhwi_dev* uhwi_get_usb_devs(void) {
         if (!desc)
             continue; // skip devices the description of which is unavailable
 
-        // populate a new uhwi_dev* with the information from the description
-        // structure
-        uhwi_dev* current = malloc(sizeof(uhwi_dev));
-        memset(current, 0, sizeof(uhwi_dev));
+        // populate the reusable record with the information from the
+        // description structure
+        memset(&current, 0, sizeof(uhwi_dev));
 
-        current->type = UHWI_DEV_USB;
+        current.type = UHWI_DEV_USB;
 
-        current->vendor = desc->idVendor;
-        current->device = desc->idProduct;
+        current.vendor = desc->idVendor;
+        current.device = desc->idProduct;
 
-        if (current->vendor == 0 || current->device == 0) {
-            // skip invalid USB devices
-            free(current);
-            continue;
-        }
+        if (current.vendor == 0 || current.device == 0)
+            continue; // skip invalid USB devices
+
+        // (the descriptor came with the listing, the strings are what's slow)
+        UHWI_TRACE_DEV_BEGIN(since, UHWI_DEV_USB, NULL)
+
+        // bus number followed by the chain of hub ports leading to the device
+        uint8_t ports[UHWI_ADDR_USB_DEPTH_MAX];
+        const int depth = libusb20_dev_get_port_path(dvp, ports, sizeof(ports));
+
+        current.addr = UHWI_ADDR_USB(libusb20_dev_get_bus_number(dvp));
+
+        for (int pindex = 0; pindex < depth; pindex++)
+            current.addr = UHWI_ADDR_USB_WITH_PORT(current.addr, pindex,
+                                                   ports[pindex]);
 
         // try to obtain manufacturer and product name C strings
-        uhwi_strncat_libusb20_indexed_cstr(dvp, desc->iManufacturer,
-                                           current->name,
-                                           UHWI_DEV_NAME_MAX_LEN);
-        uhwi_strncat_libusb20_indexed_cstr(dvp, desc->iProduct,
-                                           current->name,
-                                           UHWI_DEV_NAME_MAX_LEN);
-
-        // don't forget to add the uhwi_dev* to the linked list
-        ADD_TO_LINKED_LIST(first, last, current)
+        if (uhwi_strncat_libusb20_indexed_cstr(dvp, desc->iManufacturer,
+                                               current.name,
+                                               UHWI_DEV_NAME_MAX_LEN) < 0)
+            current.flags |= UHWI_DEV_PARTIAL;
+
+        if (uhwi_strncat_libusb20_indexed_cstr(dvp, desc->iProduct,
+                                               current.name,
+                                               UHWI_DEV_NAME_MAX_LEN) < 0)
+            current.flags |= UHWI_DEV_PARTIAL;
+
+        UHWI_TRACE_DEV_END(since, UHWI_DEV_USB, NULL, &current)
+
+        // hand the device out while the libusb20 backend is still iterating
+        rc = cb(&current, userdata);
     }
 
     // clean up
     libusb20_be_free(bke);
 #elif defined(__APPLE__)
-    first = uhwi_get_macos_devs(UHWI_DEV_USB, &last);
+    rc = uhwi_foreach_macos_dev(UHWI_DEV_USB, cb, userdata);
 #elif defined(__linux__)
-    DIR* drd = opendir(UHWI_USB_DIR_PATH_CONST);
+    rc = uhwi_sysfs_foreach(uhwi_sysfs_class_of(UHWI_DEV_USB), cb, userdata,
+                            NULL);
+#endif
+
+    return rc;
+}
+
+int uhwi_foreach_sys_dev(const uhwi_dev_t type, uhwi_dev_cb cb,
+                         void* userdata) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+#ifdef __linux__
+    // the same table-driven reader as for the buses, just with other tables
+    return uhwi_sysfs_foreach(uhwi_sysfs_class_of(type), cb, userdata, NULL);
+#else
+    // (listing none at all would look like a successful enumeration)
+    (void)type;
+    (void)cb;
+    (void)userdata;
+
+    uhwi_last_errno = UHWI_ERRNO_UNSUPPORTED;
+    return -1;
+#endif
+}
+
+uhwi_dev* uhwi_get_pci_devs(uhwi_dev** lpp) {
+    uhwi_dev_list list = { NULL, NULL };
+    uhwi_db* db = NULL;
+
+    if (uhwi_pci_db_open(&db) < 0)
+        return NULL;
+
+    // names are left out during the enumeration itself...
+    if (uhwi_foreach_pci_dev(uhwi_dev_list_append, &list, NULL) < 0) {
+        uhwi_clean_up(list.first);
+        uhwi_db_close(db);
 
-    if (!drd) {
-        uhwi_last_errno = UHWI_ERRNO_SYSFS_OPEN;
         return NULL;
     }
 
-    struct dirent* entry = NULL;
+#if defined(UHWI_ENABLE_PCI_DB) && !defined(__APPLE__)
+    // ...and resolved all at once in a single merge pass over the sorted DB
+    // instead (IOKit provides its own names on macOS)
+    if (uhwi_db_resolve_list(db, list.first) < 0) {
+        uhwi_clean_up(list.first);
+        uhwi_db_close(db);
 
-    while (1) {
-        entry = readdir(drd);
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+#endif
 
-        if (!entry)
-            break; // end of directory listing
-        else if (entry->d_name[0] == '.')
-            continue; // skip hidden and parent reference entries
+    // unload PCI DB from memory
+    uhwi_db_close(db);
 
-        // try to process sysfs representation of the USB device into a
-        // uhwi_dev*
-        uhwi_dev* current = uhwi_sysfs_cat_usb_dev(entry->d_name);
+    // return pointer to the last detected PCI device, if requested
+    if (lpp)
+        (*lpp) = list.last;
+
+    return list.first;
+}
 
-        // skip this USB device in case of failure
-        if (!current)
-            continue;
+uhwi_dev* uhwi_get_usb_devs(void) {
+    uhwi_dev_list list = { NULL, NULL };
 
-        ADD_TO_LINKED_LIST(first, last, current)
+    if (uhwi_foreach_usb_dev(uhwi_dev_list_append, &list) < 0) {
+        uhwi_clean_up(list.first);
+        return NULL;
     }
 
-    // clean up
-    closedir(drd);
-#endif
+    return list.first;
+}
 
-    return first;
+uhwi_dev* uhwi_get_sys_devs(const uhwi_dev_t type) {
+    uhwi_dev_list list = { NULL, NULL };
+
+    if (uhwi_foreach_sys_dev(type, uhwi_dev_list_append, &list) < 0) {
+        uhwi_clean_up(list.first);
+        return NULL;
+    }
+
+    return list.first;
 }
 
 uhwi_dev* uhwi_get_devs(const uhwi_dev_t type) {
+    // with caching enabled, the list is copied out of a still fresh snapshot
+    // instead of rescanning every bus
+    if (uhwi_cache_enabled()) {
+        uhwi_snapshot* snap = uhwi_snapshot_take_cached(type);
+        uhwi_dev* first = uhwi_snapshot_to_list(snap);
+
+        uhwi_snapshot_free(snap);
+        return first;
+    }
+
+    // system devices are a class of their own, never mixed with the buses
+    if (type != UHWI_DEV_NULL && !UHWI_DEV_IS_BUS(type))
+        return uhwi_get_sys_devs(type);
+
     uhwi_dev* pci_last = NULL;
 
-    uhwi_dev* pci = (type != UHWI_DEV_USB) ? uhwi_get_pci_devs(&pci_last) :
-                                             NULL;
-    uhwi_dev* usb = (type != UHWI_DEV_PCI) ? uhwi_get_usb_devs() : NULL;
+    uhwi_dev* pci = UHWI_DEV_TYPE_INCLUDES(type, UHWI_DEV_PCI) ?
+                    uhwi_get_pci_devs(&pci_last) : NULL;
+
+    // a bus that can't be read doesn't keep the other one from being listed,
+    // running out of memory fails the whole enumeration though
+    if (!pci && uhwi_last_errno == UHWI_ERRNO_NO_MEM)
+        return NULL;
+
+    uhwi_dev* usb = UHWI_DEV_TYPE_INCLUDES(type, UHWI_DEV_USB) ?
+                    uhwi_get_usb_devs() : NULL;
+
+    if (!usb && uhwi_last_errno == UHWI_ERRNO_NO_MEM) {
+        uhwi_clean_up(pci);
+        return NULL;
+    }
 
     switch (type) {
         case UHWI_DEV_PCI:
@@ -702,15 +532,105 @@ uhwi_dev* uhwi_get_devs(const uhwi_dev_t type) {
     }
 }
 
+int uhwi_foreach_dev(const uhwi_dev_t type, uhwi_dev_cb cb, void* userdata) {
+    int rc = 0;
+
+    if (!cb)
+        return 0; // nothing to hand the devices out to
+
+    if (type != UHWI_DEV_NULL && !UHWI_DEV_IS_BUS(type))
+        return uhwi_foreach_sys_dev(type, cb, userdata);
+
+    if (UHWI_DEV_TYPE_INCLUDES(type, UHWI_DEV_PCI)) {
+        uhwi_db* db = NULL;
+
+        // streamed devices are named one by one as they come (unless the
+        // deadline has passed already, they'd go unnamed anyway)
+        if (uhwi_deadline_passed())
+            rc = uhwi_foreach_pci_dev(cb, userdata, NULL);
+        else
+            rc = (uhwi_pci_db_open(&db) < 0) ? -1 :
+                                               uhwi_foreach_pci_dev(cb, userdata, db);
+
+        // unload PCI DB from memory, if it was loaded in the first place
+        uhwi_db_close(db);
+
+        // as with uhwi_get_devs(), a PCI enumeration failure doesn't prevent
+        // USB devices from being listed, but a callback request to stop does
+        // (and so does running out of memory)
+        if (rc != 0 && (uhwi_last_errno == UHWI_ERRNO_OK ||
+                        uhwi_last_errno == UHWI_ERRNO_NO_MEM))
+            return rc;
+    }
+
+    if (UHWI_DEV_TYPE_INCLUDES(type, UHWI_DEV_USB))
+        rc = uhwi_foreach_usb_dev(cb, userdata);
+
+    return rc;
+}
+
+int uhwi_foreach_dev_ex(const uhwi_dev_t type, const uhwi_opts* opts,
+                        uhwi_dev_cb cb, void* userdata) {
+    const uint64_t outer_deadline_ns = uhwi_deadline_ns;
+
+    if (opts && opts->deadline_ms > 0)
+        uhwi_deadline_ns = uhwi_now_ns() + opts->deadline_ms * 1000000ULL;
+
+    const int rc = uhwi_foreach_dev(type, cb, userdata);
+
+    // (callbacks may enumerate on their own)
+    uhwi_deadline_ns = outer_deadline_ns;
+    return rc;
+}
+
+uhwi_dev* uhwi_get_devs_ex(const uhwi_dev_t type, const uhwi_opts* opts) {
+    if (!opts || opts->deadline_ms == 0)
+        return uhwi_get_devs(type);
+
+    // bounded enumerations always rescan, but otherwise go the same way as
+    // streamed ones
+    uhwi_snapshot* snap = uhwi_snapshot_take_ex(type, opts);
+    uhwi_dev* first = uhwi_snapshot_to_list(snap);
+
+    uhwi_snapshot_free(snap);
+    return first;
+}
+
 void uhwi_clean_up(uhwi_dev* first) {
     while (first) {
         uhwi_dev* next = first->next;
 
-        free(first);
+        uhwi_mem_free(first);
         first = next;
     }
 }
 
+uint64_t uhwi_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+__thread uint64_t uhwi_deadline_ns = 0;
+
+int uhwi_deadline_passed(void) {
+    return uhwi_deadline_ns != 0 && uhwi_now_ns() >= uhwi_deadline_ns;
+}
+
+unsigned int uhwi_deadline_left_ms(const unsigned int fallback) {
+    if (uhwi_deadline_ns == 0)
+        return fallback;
+
+    const uint64_t now = uhwi_now_ns();
+
+    if (now >= uhwi_deadline_ns)
+        return 1;
+
+    const uint64_t left_ms = (uhwi_deadline_ns - now + 999999) / 1000000;
+    return (left_ms < fallback) ? (unsigned int)left_ms : fallback;
+}
+
 uhwi_errno_t uhwi_get_errno(void) {
     return uhwi_last_errno;
 }
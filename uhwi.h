@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 /// vendor & hw ID for PCI/USB
@@ -32,11 +33,79 @@ typedef enum {
     UHWI_DEV_NULL = 0,
 
     UHWI_DEV_PCI,
-    UHWI_DEV_USB
+    UHWI_DEV_USB,
+
+    // system devices (Linux-only, UHWI_ERRNO_UNSUPPORTED elsewhere), never
+    // listed unless asked for explicitly, UHWI_DEV_NULL stands for PCI & USB
+    // devices only
+    UHWI_DEV_CPU,
+    UHWI_DEV_MEM,
+    UHWI_DEV_BLOCK
 } uhwi_dev_t;
 
 #define UHWI_DEV_NAME_MAX_LEN 128
 
+/// packed bus address of a device (0 if unknown): the device type in the top
+/// byte, followed by either the PCI domain:bus:device.function, the USB bus
+/// number and port chain, the CPU or memory block number or the major:minor of
+/// a block device, see the UHWI_ADDR_* macros below
+typedef uint64_t uhwi_addr_t;
+
+#define UHWI_ADDR_TYPE(addr) ((uhwi_dev_t)((addr) >> 56))
+
+/// PCI: domain in bits 16-47, bus in bits 8-15, device in bits 3-7 and
+/// function in bits 0-2
+#define UHWI_ADDR_PCI(domain, bus, dev, fn) \
+    (((uhwi_addr_t)UHWI_DEV_PCI << 56) | \
+     ((uhwi_addr_t)(uint32_t)(domain) << 16) | \
+     ((uhwi_addr_t)((bus) & 0xff) << 8) | \
+     ((uhwi_addr_t)((dev) & 0x1f) << 3) | (uhwi_addr_t)((fn) & 0x7))
+
+#define UHWI_ADDR_PCI_DOMAIN(addr) ((uint32_t)((addr) >> 16))
+#define UHWI_ADDR_PCI_BUS(addr) ((uint8_t)((addr) >> 8))
+#define UHWI_ADDR_PCI_DEV(addr) ((uint8_t)(((addr) >> 3) & 0x1f))
+#define UHWI_ADDR_PCI_FN(addr) ((uint8_t)((addr) & 0x7))
+
+/// USB: bus number in bits 48-55, then up to UHWI_ADDR_USB_DEPTH_MAX 8-bit
+/// port numbers starting with the root hub's port in bits 40-47 (a port number
+/// of 0 ends the chain, root hubs themselves have none)
+#define UHWI_ADDR_USB_DEPTH_MAX 6
+
+#define UHWI_ADDR_USB(bus) \
+    (((uhwi_addr_t)UHWI_DEV_USB << 56) | ((uhwi_addr_t)((bus) & 0xff) << 48))
+
+#define UHWI_ADDR_USB_BUS(addr) ((uint8_t)((addr) >> 48))
+#define UHWI_ADDR_USB_PORT(addr, depth) ((uint8_t)((addr) >> (40 - 8 * (depth))))
+
+/// appends the port at the specified depth to a USB address
+#define UHWI_ADDR_USB_WITH_PORT(addr, depth, port) \
+    ((addr) | ((uhwi_addr_t)((port) & 0xff) << (40 - 8 * (depth))))
+
+/// CPU & memory blocks: logical CPU or memory block number in bits 0-31
+#define UHWI_ADDR_CPU(cpu) \
+    (((uhwi_addr_t)UHWI_DEV_CPU << 56) | (uhwi_addr_t)(uint32_t)(cpu))
+#define UHWI_ADDR_MEM(block) \
+    (((uhwi_addr_t)UHWI_DEV_MEM << 56) | (uhwi_addr_t)(uint32_t)(block))
+
+#define UHWI_ADDR_NUM(addr) ((uint32_t)(addr))
+
+/// block devices: major number in bits 32-55, minor number in bits 0-31
+#define UHWI_ADDR_BLOCK(major, minor) \
+    (((uhwi_addr_t)UHWI_DEV_BLOCK << 56) | \
+     ((uhwi_addr_t)((major) & 0xffffff) << 32) | (uhwi_addr_t)(uint32_t)(minor))
+
+#define UHWI_ADDR_BLOCK_MAJOR(addr) ((uint32_t)((addr) >> 32) & 0xffffff)
+#define UHWI_ADDR_BLOCK_MINOR(addr) ((uint32_t)(addr))
+
+/// formats the address the way the OS does ("0000:00:1f.3" for PCI, "1-1.2"
+/// or "usb1" for USB, "cpu3", "memory12" and "259:0" for the system devices),
+/// returns the length of the C string
+size_t uhwi_addr_format(const uhwi_addr_t addr, char* buf, const size_t max);
+
+/// parses an address formatted as above (the PCI domain is optional), returns
+/// 0 if it is malformed
+uhwi_addr_t uhwi_addr_parse(const char* str);
+
 typedef struct {
     /// device type
     uhwi_dev_t type;
@@ -51,6 +120,17 @@ typedef struct {
     /// subdevice ID (16-bit unsigned integer, PCI-only)
     uhwi_id_t subdevice;
 
+    // CPUs have their package ID in vendor and core ID in device, block
+    // devices the IDs of whatever they sit on (e.g. the PCI IDs of an NVMe
+    // controller), if it has any, and memory blocks no IDs at all
+
+    /// packed bus address (0 if unknown), a stable key of the device for as
+    /// long as it stays plugged in
+    uhwi_addr_t addr;
+
+    /// UHWI_DEV_* flags
+    uint16_t flags;
+
     /// device user-friendly name C string
     char name[UHWI_DEV_NAME_MAX_LEN];
 
@@ -58,12 +138,466 @@ typedef struct {
     void* next;
 } uhwi_dev;
 
+/// optional attributes (subsystem IDs, the name) were skipped because the
+/// deadline of the enumeration had passed
+#define UHWI_DEV_PARTIAL (1 << 0)
+
 /// enumerates devices of a specified type available in the system
 uhwi_dev* uhwi_get_devs(const uhwi_dev_t type);
 
+/// per-call enumeration options (zero-initialized means the defaults)
+typedef struct {
+    /// time budget of the call in milliseconds (0 means none); once it is used
+    /// up, mandatory IDs are still read for every device but optional
+    /// attributes are skipped and such devices are marked UHWI_DEV_PARTIAL
+    /// (Linux & FreeBSD, where USB string descriptor requests are also bounded
+    /// by what is left of it)
+    unsigned int deadline_ms;
+} uhwi_opts;
+
+/// uhwi_get_devs() with options (a deadline bypasses the cache)
+uhwi_dev* uhwi_get_devs_ex(const uhwi_dev_t type, const uhwi_opts* opts);
+
 /// frees the entire linked list of devices
 void uhwi_clean_up(uhwi_dev* first);
 
+/// per-device callback for uhwi_foreach_dev() (the record is reused for every
+/// device, so copy it if it has to outlive the call; return a positive value to
+/// stop the enumeration early)
+typedef int (*uhwi_dev_cb)(const uhwi_dev* dev, void* userdata);
+
+/// streams devices of a specified type to the callback while they are being
+/// enumerated, without building a linked list; returns 0 once every device was
+/// visited, the callback's non-zero value if it stopped early or -1 on failure
+int uhwi_foreach_dev(const uhwi_dev_t type, uhwi_dev_cb cb, void* userdata);
+
+/// uhwi_foreach_dev() with options
+int uhwi_foreach_dev_ex(const uhwi_dev_t type, const uhwi_opts* opts,
+                        uhwi_dev_cb cb, void* userdata);
+
+/// offset of a C string within a string pool (0 is always the empty C string)
+typedef uint32_t uhwi_str_t;
+
+/// compact device record (24 bytes) with its name interned into a string pool
+/// shared by the whole snapshot or DB instead of an inline buffer
+typedef struct {
+    /// device type (uhwi_dev_t)
+    uint16_t type;
+
+    /// vendor & device IDs
+    uhwi_id_t vendor;
+    uhwi_id_t device;
+
+    /// subvendor & subdevice IDs (PCI-only)
+    uhwi_id_t subvendor;
+    uhwi_id_t subdevice;
+
+    /// UHWI_DEV_* flags (always 0 in snapshots saved before they existed)
+    uint16_t flags;
+
+    /// device user-friendly name C string offset within the string pool
+    uhwi_str_t name;
+
+    /// packed bus address (0 if unknown)
+    uhwi_addr_t addr;
+} uhwi_dev_rec;
+
+/// an array of compact device records along with their name string pool
+typedef struct uhwi_snapshot uhwi_snapshot;
+
+/// enumerates devices of a specified type into a compact snapshot
+uhwi_snapshot* uhwi_snapshot_take(const uhwi_dev_t type);
+
+/// uhwi_snapshot_take() with options
+uhwi_snapshot* uhwi_snapshot_take_ex(const uhwi_dev_t type,
+                                     const uhwi_opts* opts);
+
+/// amount of device records within the snapshot
+size_t uhwi_snapshot_count(const uhwi_snapshot* snap);
+
+/// device record at the specified index (NULL if out of bounds)
+const uhwi_dev_rec* uhwi_snapshot_get(const uhwi_snapshot* snap,
+                                      const size_t index);
+
+/// record of the device at the specified bus address (NULL if there's none),
+/// takes constant time thanks to a hash index built on first use (or linear
+/// time if the index can't be allocated)
+const uhwi_dev_rec* uhwi_find_by_addr(const uhwi_snapshot* snap,
+                                      const uhwi_addr_t addr);
+
+/// "no such device" record index
+#define UHWI_NO_DEV ((size_t)-1)
+
+/// record index of the hub the USB device at the specified index is plugged
+/// into (UHWI_NO_DEV for root hubs, devices behind a hub that is not part of
+/// the snapshot and non-USB devices); the hub/port tree is derived from the
+/// devices' bus addresses once, on first use, without touching the buses again
+/// (every link reads as UHWI_NO_DEV, with UHWI_ERRNO_NO_MEM, if the tree can't
+/// be allocated)
+size_t uhwi_usb_parent(const uhwi_snapshot* snap, const size_t index);
+
+/// record index of the device plugged into the lowest port of the USB hub at
+/// the specified index (UHWI_NO_DEV if there's none)
+size_t uhwi_usb_first_child(const uhwi_snapshot* snap, const size_t index);
+
+/// record index of the device plugged into the next port of the same USB hub,
+/// or of the next root for the roots of the tree (UHWI_NO_DEV if there's none)
+size_t uhwi_usb_next_sibling(const uhwi_snapshot* snap, const size_t index);
+
+/// per-device callback for uhwi_usb_walk(), depth is 0 for the roots of the
+/// tree; return a non-zero value to stop the walk
+typedef int (*uhwi_usb_walk_cb)(const uhwi_snapshot* snap, const size_t index,
+                                const size_t depth, void* userdata);
+
+/// walks the USB hub/port tree of the snapshot depth-first, parents before
+/// their children and children in port order; returns 0 once every USB device
+/// was visited or the callback's non-zero value if it stopped early (-1 with
+/// UHWI_ERRNO_NO_MEM if the tree can't be allocated)
+int uhwi_usb_walk(const uhwi_snapshot* snap, uhwi_usb_walk_cb cb,
+                  void* userdata);
+
+/// resolves a string pool reference of the snapshot into a C string
+const char* uhwi_snapshot_str(const uhwi_snapshot* snap, const uhwi_str_t str);
+
+/// fills a classic uhwi_dev (compatibility view) from the record at the
+/// specified index, returns NULL if the index is out of bounds
+uhwi_dev* uhwi_snapshot_view(const uhwi_snapshot* snap, const size_t index,
+                             uhwi_dev* into);
+
+/// converts the snapshot into a classic linked list (free with uhwi_clean_up())
+uhwi_dev* uhwi_snapshot_to_list(const uhwi_snapshot* snap);
+
+/// binary snapshot format version written by uhwi_snapshot_save()
+#define UHWI_SNAPSHOT_VERSION 2
+
+/// writes the snapshot to a file descriptor in the versioned binary format: a
+/// header, the fixed-width records as is and their string table (returns 0 on
+/// success, -1 on failure)
+int uhwi_snapshot_save(const uhwi_snapshot* snap, const int fd);
+
+/// maps a binary snapshot file, records & names are used in place without any
+/// parsing (snapshots of a different version or byte order are rejected)
+uhwi_snapshot* uhwi_snapshot_load(const char* path);
+
+/// same as uhwi_snapshot_load() for a snapshot that is already in memory (the
+/// 8-byte aligned buffer has to outlive the returned snapshot)
+uhwi_snapshot* uhwi_snapshot_from_buf(const void* data, const size_t len);
+
+/// takes another reference to the (immutable) snapshot, it is only freed once
+/// uhwi_snapshot_free() has been called for every reference
+uhwi_snapshot* uhwi_snapshot_ref(uhwi_snapshot* snap);
+
+/// drops a reference to the snapshot, the last one frees it along with its
+/// string pool (or unmaps its file)
+void uhwi_snapshot_free(uhwi_snapshot* snap);
+
+/// publishes the snapshot in a host-wide shared memory segment for
+/// uhwi_snapshot_take_shared() to pick up, it goes stale ttl_ms milliseconds
+/// later (0 means never); there must only be one publisher, i.e. lsuhwi -D,
+/// and it fails if the segment was created by another user
+int uhwi_shm_publish(const uhwi_snapshot* snap, const unsigned int ttl_ms);
+
+/// marks the published snapshot stale, so that readers stop using it
+void uhwi_shm_unpublish(void);
+
+/// copies the snapshot published by a running lsuhwi -D out of shared memory
+/// (no syscalls once attached), enumerates directly if there's none, it is
+/// stale or the segment can't be trusted (it must belong to root or the
+/// calling user and mustn't be writable by anybody else), same as
+/// uhwi_snapshot_take()
+uhwi_snapshot* uhwi_snapshot_take_shared(const uhwi_dev_t type);
+
+typedef enum {
+    /// also drop a cached result early once a cheap probe notices a hotplug
+    /// event (the uevent sequence number on Linux, the pci(4) generation number
+    /// on FreeBSD, which only covers PCI devices); ignored on macOS, cached
+    /// results then only go stale with their TTL
+    UHWI_CACHE_PROBE = 1 << 0
+} uhwi_cache_flags_t;
+
+/// caches enumeration results for ttl_ms milliseconds (0 disables caching,
+/// which is the default), uhwi_get_devs() then copies its list out of the
+/// cached snapshot while it is fresh instead of rescanning every bus
+void uhwi_cache_enable(const unsigned int ttl_ms, const int flags);
+
+/// drops every cached result, the next enumeration rescans the buses
+void uhwi_cache_flush(void);
+
+/// returns a reference to the cached snapshot of the specified type while it
+/// is fresh, takes (and caches) a new one otherwise; the snapshot is shared,
+/// release it with uhwi_snapshot_free() as usual
+uhwi_snapshot* uhwi_snapshot_take_cached(const uhwi_dev_t type);
+
+/// like uhwi_snapshot_take(), but maps the result of a previous enumeration
+/// saved under /run/uhwi as long as a cheap fingerprint of the bus directories
+/// (entry names, inodes & mtimes) and of the PCI DB still matches, and saves
+/// the new result there otherwise; CPUs also go by the mask of online ones,
+/// memory blocks are always rescanned since their state can't be fingerprinted
+/// cheaply (Linux-only: on FreeBSD & macOS, which have no cheap fingerprint of
+/// the buses, the disk cache is bypassed and this is uhwi_snapshot_take())
+uhwi_snapshot* uhwi_snapshot_take_persistent(const uhwi_dev_t type);
+
+/// enumeration running on a worker thread
+typedef struct uhwi_async uhwi_async;
+
+typedef enum {
+    /// classic linked list, as returned by uhwi_get_devs()
+    UHWI_ASYNC_LIST = 0,
+    /// compact snapshot, as returned by uhwi_snapshot_take()
+    UHWI_ASYNC_SNAPSHOT
+} uhwi_async_form_t;
+
+/// starts enumerating devices of a specified type (and naming them) on a
+/// worker thread, the result is produced in the specified form; returns NULL
+/// if the worker couldn't be started
+uhwi_async* uhwi_get_devs_async(const uhwi_dev_t type,
+                                const uhwi_async_form_t form);
+
+/// fd that becomes readable (and stays so) once the request is complete, meant
+/// for poll()/epoll/kqueue; it must not be read from or closed by the caller
+int uhwi_async_fd(const uhwi_async* req);
+
+/// whether the request is complete, without blocking
+int uhwi_async_done(const uhwi_async* req);
+
+/// asks the worker to give up, which it does before the next device (a
+/// cancelled request still completes, but without a result); safe to call from
+/// any thread
+void uhwi_async_cancel(uhwi_async* req);
+
+/// takes the result of a UHWI_ASYNC_LIST request out, waiting for it if it is
+/// not complete yet; NULL on failure, cancellation or if it was already taken
+uhwi_dev* uhwi_async_list(uhwi_async* req);
+
+/// same as above for UHWI_ASYNC_SNAPSHOT requests
+uhwi_snapshot* uhwi_async_snapshot(uhwi_async* req);
+
+/// cancels the request if it is still running, waits for the worker and frees
+/// everything (including a result that was never taken out)
+void uhwi_async_free(uhwi_async* req);
+
+/// library-wide counters
+typedef struct {
+    /// enumerations served from the cache
+    uint64_t cache_hits;
+    /// enumerations that had to rescan the buses while caching was enabled
+    uint64_t cache_misses;
+    /// cached results dropped before their TTL because the probe saw a change
+    uint64_t cache_invalidations;
+
+    /// uhwi_snapshot_take_persistent() calls served from the on-disk cache
+    uint64_t disk_cache_hits;
+    /// uhwi_snapshot_take_persistent() calls that had to rescan the buses
+    uint64_t disk_cache_misses;
+
+    /// bytes of heap memory currently held by the library (lists, snapshots,
+    /// DBs & scratch buffers, excluding allocator overhead and mappings)
+    uint64_t mem_current;
+    /// the most bytes ever held at once (since the last reset)
+    uint64_t mem_peak;
+    /// bytes allocated in total (since the last reset)
+    uint64_t mem_total;
+} uhwi_stats;
+
+/// copies the current counters
+void uhwi_get_stats(uhwi_stats* stats);
+
+/// zeroes every counter (the memory peak restarts from what's currently held)
+void uhwi_reset_stats(void);
+
+/// heap allocator used for everything the library allocates
+typedef struct {
+    /// returns a block of at least the specified size aligned to 16 bytes, or
+    /// NULL
+    void* (*alloc)(const size_t size, void* userdata);
+    /// grows or shrinks a block (may be NULL, blocks are then moved through
+    /// alloc & free)
+    void* (*realloc)(void* ptr, const size_t old_size, const size_t new_size,
+                     void* userdata);
+    /// releases a block, along with the size it was allocated with
+    void (*free)(void* ptr, const size_t size, void* userdata);
+
+    /// handed to every callback as is
+    void* userdata;
+} uhwi_allocator;
+
+/// routes all allocations of the library through the specified allocator (the
+/// vtable is copied, NULL restores malloc & free); it must be set before any
+/// other call, or at least while nothing allocated by the previous one is
+/// still alive
+void uhwi_set_allocator(const uhwi_allocator* allocator);
+
+#ifdef UHWI_ENABLE_TRACE
+/// where in the enumeration & PCI DB code trace events come from (requires
+/// UHWI_ENABLE_TRACE)
+typedef enum {
+    /// a device (a sysfs entry on Linux) is about to be read
+    UHWI_TRACE_DEV_BEGIN = 0,
+    /// the device has been read, right before it is handed out to the callback
+    /// (result is 1, or 0 if it was skipped)
+    UHWI_TRACE_DEV_END,
+    /// one attribute of a device (a sysfs file, a USB string descriptor) has
+    /// been read (result is its length or -1)
+    UHWI_TRACE_ATTR,
+    /// the PCI DB is about to be opened
+    UHWI_TRACE_DB_OPEN_BEGIN,
+    /// the PCI DB has been opened (result is its number of vendors or -1)
+    UHWI_TRACE_DB_OPEN_END,
+    /// a single device name has been looked up in the PCI DB (result is 1 if
+    /// its vendor is known)
+    UHWI_TRACE_DB_LOOKUP,
+    /// a batch of devices has been named from the PCI DB (result is the size
+    /// of the batch)
+    UHWI_TRACE_DB_RESOLVE
+} uhwi_trace_point_t;
+
+typedef struct {
+    uhwi_trace_point_t point;
+
+    /// CLOCK_MONOTONIC timestamp, in nanoseconds
+    uint64_t ns;
+    /// time since the matching *_BEGIN event, or how long the read or lookup
+    /// took (0 for *_BEGIN events themselves)
+    uint64_t elapsed_ns;
+
+    /// type of the device being read (UHWI_DEV_NULL for the PCI DB)
+    uhwi_dev_t type;
+    /// sysfs entry of the device or path of the DB (NULL if there's none)
+    const char* label;
+    /// path of the attribute, relative to the entry (UHWI_TRACE_ATTR only)
+    const char* attr;
+
+    /// IDs known by then (device ends & DB lookups)
+    uhwi_id_t vendor;
+    uhwi_id_t device;
+
+    int64_t result;
+} uhwi_trace_event;
+
+typedef void (*uhwi_trace_cb)(const uhwi_trace_event* event, void* userdata);
+
+/// registers a callback receiving every trace event (NULL unregisters it); it
+/// is invoked on whichever thread does the work (e.g. uhwi_get_devs_async()
+/// workers), always along with its own userdata, even if it gets replaced
+/// while enumerations are running; the same points are USDT probes of the "uhwi" provider on Linux, if
+/// <sys/sdt.h> was available at build time
+void uhwi_set_trace_cb(uhwi_trace_cb cb, void* userdata);
+#endif
+
+/// indexed in-memory PCI vendors DB (requires UHWI_ENABLE_PCI_DB)
+typedef struct uhwi_db uhwi_db;
+
+#ifdef UHWI_ENABLE_PCI_DB
+typedef enum {
+    /// only IDs and vendor names are parsed upfront, device names of a vendor
+    /// are read from the (kept open) DB file once that vendor is first queried
+    UHWI_DB_LAZY = 1 << 0,
+
+    /// uhwi_db_shared_open() only: reload the DB in a background thread
+    /// whenever its file changes
+    UHWI_DB_WATCH = 1 << 1,
+
+    /// UHWI_DB_LAZY taken further: opening merely skims the file for the
+    /// offsets of vendor blocks (and counts their device lines), the IDs and
+    /// names of a vendor and its devices are parsed once it is first queried
+    UHWI_DB_SKIM = 1 << 2,
+
+    /// UHWI_DB_SKIM only: keep the skimmed offsets in a sidecar file under
+    /// the disk cache directory (written if missing or outdated, writing it
+    /// requires access to that directory), so that opening doesn't even read
+    /// the DB file
+    UHWI_DB_SIDECAR = 1 << 3,
+
+    /// split the file into chunks of whole vendor blocks which are parsed on
+    /// a thread per online CPU and then merged (for DBs needed as a whole, e.g.
+    /// when searching or listing every entry; ignored with UHWI_DB_LAZY or
+    /// UHWI_DB_SKIM, for layered paths and for unsorted files)
+    UHWI_DB_PARALLEL = 1 << 4
+} uhwi_db_flags_t;
+
+/// parses the PCI vendors DB at the specified path (or the default one if NULL,
+/// UHWI_PCI_DB_PATH_CONST); either may also be a colon-separated list of
+/// layers, e.g. "/usr/share/misc/pci.ids:/etc/site.ids", which are merged into
+/// a single index with later layers overriding the vendor & device names of
+/// earlier ones (missing layers are skipped, UHWI_DB_LAZY only applies to a
+/// lone file, and so does UHWI_DB_SKIM)
+uhwi_db* uhwi_db_open(const char* path);
+
+/// same as uhwi_db_open(), with uhwi_db_flags_t flags
+uhwi_db* uhwi_db_open_ex(const char* path, const int flags);
+
+/// resolves the names of an array of devices at once: they are sorted by ID
+/// internally and matched against the DB in a single merge pass (USB devices
+/// are left untouched, the array's order is preserved), UHWI_ERRNO_NO_MEM is
+/// set if out of memory (some of the names are left unresolved then)
+void uhwi_db_resolve_batch(uhwi_db* db, uhwi_dev* devs, const size_t count);
+
+/// amount of heap memory held by the DB, in bytes
+size_t uhwi_db_size(const uhwi_db* db);
+
+/// vendor or device found by uhwi_db_search()
+typedef struct {
+    uhwi_id_t vendor;
+    /// 0 if it was the vendor's own name that matched (like the vendor entries
+    /// of uhwi_db_init())
+    uhwi_id_t device;
+} uhwi_db_match;
+
+/// finds the vendors & devices whose name contains the query (ASCII letters
+/// compared case-insensitively), writes up to max of them in DB order and
+/// returns how many there are in total; the first search builds a trigram
+/// index over every name (which decodes a lazy DB entirely), queries shorter
+/// than 3 characters can't use it and check every name instead (nothing is
+/// found, with UHWI_ERRNO_NO_MEM, if the index couldn't be built)
+size_t uhwi_db_search(uhwi_db* db, const char* query, uhwi_db_match* matches,
+                      const size_t max);
+
+/// copies "vendor device" name of a PCI device into the buffer, returns 0 if
+/// even the vendor is unknown to the DB (the buffer then holds "Unknown"), or
+/// if its names couldn't be read in (with UHWI_ERRNO_NO_MEM)
+int uhwi_db_strncpy_name(uhwi_db* db, const uhwi_id_t vendor,
+                         const uhwi_id_t device, char* buf, const size_t max);
+
+/// converts the indexed DB into a classic linked list of vendor & device
+/// entries (this is what lsuhwi -d dumps)
+uhwi_dev* uhwi_db_init(void);
+
+void uhwi_db_close(uhwi_db* db);
+
+/// lets enumeration keep the offsets it skims off the PCI DB in a sidecar
+/// (UHWI_DB_SIDECAR), so that later enumerations don't even read the DB file;
+/// off by default, enumeration then never writes to the disk cache directory
+void uhwi_pci_db_sidecar_enable(const int enable);
+
+/// PCI vendors DB shared by many threads, which query it without taking any
+/// locks while newer versions of the DB file are swapped in underneath them
+typedef struct uhwi_db_shared uhwi_db_shared;
+
+/// parses the PCI vendors DB at the specified path (or the default one if NULL)
+/// into a shared DB (UHWI_DB_LAZY is ignored, the DB is always fully parsed,
+/// with UHWI_DB_PARALLEL on reloads as well)
+uhwi_db_shared* uhwi_db_shared_open(const char* path, const int flags);
+
+/// reparses the DB file if it has changed (or anyway if force is set) and swaps
+/// the new version in, the previous one is freed once no reader can still be
+/// using it; returns 1 if swapped, 0 if unchanged and -1 on failure (the
+/// previous version then stays in place)
+int uhwi_db_shared_reload(uhwi_db_shared* shared, const int force);
+
+/// uhwi_db_strncpy_name() for a shared DB, safe to call from any thread
+int uhwi_db_shared_strncpy_name(uhwi_db_shared* shared, const uhwi_id_t vendor,
+                                const uhwi_id_t device, char* buf,
+                                const size_t max);
+
+/// uhwi_db_resolve_batch() for a shared DB, safe to call from any thread
+void uhwi_db_shared_resolve_batch(uhwi_db_shared* shared, uhwi_dev* devs,
+                                  const size_t count);
+
+/// stops the watcher thread and frees the shared DB (no thread may be querying
+/// it anymore)
+void uhwi_db_shared_close(uhwi_db_shared* shared);
+#endif
+
 typedef enum {
     // successful operation
     UHWI_ERRNO_OK = 0,
@@ -103,7 +637,50 @@ typedef enum {
     //
 
     // opendir("/sys/bus/.../devices") failed
-    UHWI_ERRNO_SYSFS_OPEN
+    UHWI_ERRNO_SYSFS_OPEN,
+
+    //
+    // binary snapshots
+    //
+
+    // the snapshot file couldn't be read, mapped or written
+    UHWI_ERRNO_SNAPSHOT_IO,
+    // bad magic, unsupported version/byte order or a truncated snapshot
+    UHWI_ERRNO_SNAPSHOT_FORMAT,
+
+    //
+    // shared memory publication
+    //
+
+    // shm_open(), ftruncate() or mmap() of the segment failed, or it belongs
+    // to another user
+    UHWI_ERRNO_SHM_OPEN,
+    // the snapshot doesn't fit into the segment
+    UHWI_ERRNO_SHM_FULL,
+
+    //
+    // asynchronous enumeration
+    //
+
+    // the request's completion fd or worker thread couldn't be created
+    UHWI_ERRNO_ASYNC_START,
+    // the request was cancelled before it completed
+    UHWI_ERRNO_CANCELLED,
+
+    //
+    // platform support
+    //
+
+    // the requested kind of devices can't be enumerated on this platform
+    UHWI_ERRNO_UNSUPPORTED,
+
+    //
+    // memory
+    //
+
+    // the allocator came back empty (or the requested size overflowed)
+    UHWI_ERRNO_NO_MEM
 } uhwi_errno_t;
 
+/// error of the last library call made by the calling thread
 uhwi_errno_t uhwi_get_errno(void);
@@ -0,0 +1,207 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "uhwi_internal.h"
+
+size_t uhwi_addr_format(const uhwi_addr_t addr, char* buf, const size_t max) {
+    int len = 0;
+
+    if (max == 0)
+        return 0;
+
+    buf[0] = '\0';
+
+    switch (UHWI_ADDR_TYPE(addr)) {
+        case UHWI_DEV_PCI: {
+            len = snprintf(buf, max, "%04x:%02x:%02x.%x",
+                           (unsigned int)UHWI_ADDR_PCI_DOMAIN(addr),
+                           (unsigned int)UHWI_ADDR_PCI_BUS(addr),
+                           (unsigned int)UHWI_ADDR_PCI_DEV(addr),
+                           (unsigned int)UHWI_ADDR_PCI_FN(addr));
+            break;
+        }
+        case UHWI_DEV_USB: {
+            const unsigned int bus = UHWI_ADDR_USB_BUS(addr);
+
+            // root hubs have no port of their own
+            if (UHWI_ADDR_USB_PORT(addr, 0) == 0) {
+                len = snprintf(buf, max, "usb%u", bus);
+                break;
+            }
+
+            len = snprintf(buf, max, "%u", bus);
+
+            for (size_t depth = 0; depth < UHWI_ADDR_USB_DEPTH_MAX &&
+                                   len >= 0 && (size_t)len < max; depth++) {
+                const unsigned int port = UHWI_ADDR_USB_PORT(addr, depth);
+
+                if (port == 0)
+                    break;
+
+                len += snprintf(buf + len, max - (size_t)len, "%c%u",
+                                (depth == 0) ? '-' : '.', port);
+            }
+
+            break;
+        }
+        case UHWI_DEV_CPU: {
+            len = snprintf(buf, max, "cpu%u",
+                           (unsigned int)UHWI_ADDR_NUM(addr));
+            break;
+        }
+        case UHWI_DEV_MEM: {
+            len = snprintf(buf, max, "memory%u",
+                           (unsigned int)UHWI_ADDR_NUM(addr));
+            break;
+        }
+        case UHWI_DEV_BLOCK: {
+            len = snprintf(buf, max, "%u:%u",
+                           (unsigned int)UHWI_ADDR_BLOCK_MAJOR(addr),
+                           (unsigned int)UHWI_ADDR_BLOCK_MINOR(addr));
+            break;
+        }
+
+        default:
+            break; // unknown
+    }
+
+    if (len < 0)
+        return 0;
+
+    return ((size_t)len < max) ? (size_t)len : max - 1;
+}
+
+// reads a number in the specified base, NULL if there are no digits at all or
+// it doesn't fit into 32 bits
+const char* uhwi_addr_parse_num(const char* from, const unsigned int base,
+                                uint32_t* value) {
+    const char* start = from;
+    *value = 0;
+
+    while (1) {
+        const uint8_t digit = uhwi_hex_digits[(uint8_t)*from];
+
+        // (uhwi_hex_digits holds the digit value + 1, 0 for non-digits)
+        if (digit == 0 || (uint8_t)(digit - 1) >= base)
+            break;
+
+        // (a number that doesn't fit is as malformed as one without digits,
+        // rather than wrapping around to another device)
+        if (*value > (UINT32_MAX - (uint32_t)(digit - 1)) / base)
+            return NULL;
+
+        *value = *value * base + (uint32_t)(digit - 1);
+        from++;
+    }
+
+    return (from > start) ? from : NULL;
+}
+
+uhwi_addr_t uhwi_addr_parse(const char* str) {
+    uint32_t values[4];
+
+    if (!str)
+        return 0;
+
+    // "cpuN" & "memoryN"
+    if (strncmp(str, "cpu", 3) == 0 || strncmp(str, "memory", 6) == 0) {
+        const int cpu = (str[0] == 'c');
+        const char* at = uhwi_addr_parse_num(str + (cpu ? 3 : 6), 10,
+                                             &values[0]);
+
+        if (!at || *at != '\0')
+            return 0;
+
+        return cpu ? UHWI_ADDR_CPU(values[0]) : UHWI_ADDR_MEM(values[0]);
+    }
+
+    // block devices are "major:minor", unlike PCI addresses there's no dot
+    if (strchr(str, ':') && !strchr(str, '.')) {
+        const char* at = uhwi_addr_parse_num(str, 10, &values[0]);
+
+        if (!at || *at != ':' || values[0] > 0xffffff ||
+            !(at = uhwi_addr_parse_num(at + 1, 10, &values[1])) || *at != '\0')
+            return 0;
+
+        return UHWI_ADDR_BLOCK(values[0], values[1]);
+    }
+
+    if (strchr(str, ':')) {
+        // "[domain:]bus:device.function"
+        const char* at = uhwi_addr_parse_num(str, 16, &values[0]);
+
+        if (!at || *at != ':' || !(at = uhwi_addr_parse_num(at + 1, 16,
+                                                            &values[1])))
+            return 0;
+
+        if (*at == ':') {
+            if (!(at = uhwi_addr_parse_num(at + 1, 16, &values[2])))
+                return 0;
+        } else {
+            // no domain
+            values[2] = values[1];
+            values[1] = values[0];
+            values[0] = 0;
+        }
+
+        if (*at != '.' || !(at = uhwi_addr_parse_num(at + 1, 16, &values[3])) ||
+            *at != '\0' || values[1] > 0xff || values[2] > 0x1f ||
+            values[3] > 0x7)
+            return 0;
+
+        return UHWI_ADDR_PCI(values[0], values[1], values[2], values[3]);
+    }
+
+    // root hubs are "usbN"
+    if (strncmp(str, "usb", 3) == 0) {
+        const char* at = uhwi_addr_parse_num(str + 3, 10, &values[0]);
+
+        if (!at || *at != '\0' || values[0] > 0xff)
+            return 0;
+
+        return UHWI_ADDR_USB(values[0]);
+    }
+
+    // "bus-port[.port...]"
+    const char* at = uhwi_addr_parse_num(str, 10, &values[0]);
+
+    if (!at || *at != '-' || values[0] > 0xff)
+        return 0;
+
+    uhwi_addr_t addr = UHWI_ADDR_USB(values[0]);
+
+    for (size_t depth = 0; *at == ((depth == 0) ? '-' : '.'); depth++) {
+        if (depth >= UHWI_ADDR_USB_DEPTH_MAX ||
+            !(at = uhwi_addr_parse_num(at + 1, 10, &values[1])) ||
+            values[1] == 0 || values[1] > 0xff)
+            return 0;
+
+        addr = UHWI_ADDR_USB_WITH_PORT(addr, depth, values[1]);
+    }
+
+    // (interfaces, e.g. "1-1:1.0", are not devices)
+    return (*at == '\0') ? addr : 0;
+}
@@ -0,0 +1,210 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "uhwi_internal.h"
+
+// every block is preceded by a header remembering what was asked for, so that
+// internal callers don't have to carry sizes around to free or grow it
+typedef struct {
+    /// bytes requested by the caller
+    size_t size;
+    /// distance from the start of the underlying allocation to the block
+    size_t offset;
+} uhwi_mem_hdr;
+
+#define UHWI_MEM_HDR_SIZE 16
+
+#define UHWI_MEM_HDR(ptr) \
+    ((uhwi_mem_hdr*)((char*)(ptr) - sizeof(uhwi_mem_hdr)))
+
+void* uhwi_mem_default_alloc(const size_t size, void* userdata) {
+    (void)userdata;
+    return malloc(size);
+}
+
+void* uhwi_mem_default_realloc(void* ptr, const size_t old_size,
+                               const size_t new_size, void* userdata) {
+    (void)old_size;
+    (void)userdata;
+
+    return realloc(ptr, new_size);
+}
+
+void uhwi_mem_default_free(void* ptr, const size_t size, void* userdata) {
+    (void)size;
+    (void)userdata;
+
+    free(ptr);
+}
+
+uhwi_allocator uhwi_mem_allocator = {
+    uhwi_mem_default_alloc,
+    uhwi_mem_default_realloc,
+    uhwi_mem_default_free,
+    NULL
+};
+
+// bytes currently held, the most ever held at once & allocated in total
+uint64_t uhwi_mem_current = 0;
+uint64_t uhwi_mem_peak = 0;
+uint64_t uhwi_mem_total = 0;
+
+void uhwi_mem_account_alloc(const size_t size) {
+    const uint64_t current = __atomic_add_fetch(&uhwi_mem_current, size,
+                                                __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&uhwi_mem_peak, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&uhwi_mem_total, size, __ATOMIC_RELAXED);
+
+    while (current > peak &&
+           !__atomic_compare_exchange_n(&uhwi_mem_peak, &peak, current, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void uhwi_mem_account_free(const size_t size) {
+    __atomic_sub_fetch(&uhwi_mem_current, size, __ATOMIC_RELAXED);
+}
+
+void uhwi_set_allocator(const uhwi_allocator* allocator) {
+    if (!allocator || !allocator->alloc || !allocator->free) {
+        uhwi_mem_allocator.alloc = uhwi_mem_default_alloc;
+        uhwi_mem_allocator.realloc = uhwi_mem_default_realloc;
+        uhwi_mem_allocator.free = uhwi_mem_default_free;
+        uhwi_mem_allocator.userdata = NULL;
+        return;
+    }
+
+    uhwi_mem_allocator = *allocator;
+}
+
+void* uhwi_mem_alloc_aligned(const size_t size, const size_t align) {
+    // (blocks are always at least as aligned as the header is large)
+    const size_t offset = (align > UHWI_MEM_HDR_SIZE) ? align :
+                                                        UHWI_MEM_HDR_SIZE;
+
+    // (the header mustn't wrap a huge size around to a tiny allocation)
+    if (size > SIZE_MAX - offset)
+        return NULL;
+
+    char* raw = uhwi_mem_allocator.alloc(size + offset,
+                                         uhwi_mem_allocator.userdata);
+
+    if (!raw)
+        return NULL;
+
+    // the allocator only guarantees 16-byte alignment, the header goes into
+    // whatever is left in front of the aligned block
+    char* ptr = raw + offset;
+
+    if (align > UHWI_MEM_HDR_SIZE)
+        ptr = (char*)((uintptr_t)ptr & ~(uintptr_t)(align - 1));
+
+    UHWI_MEM_HDR(ptr)->size = size;
+    UHWI_MEM_HDR(ptr)->offset = (size_t)(ptr - raw);
+
+    uhwi_mem_account_alloc(size);
+    return ptr;
+}
+
+void* uhwi_mem_alloc(const size_t size) {
+    return uhwi_mem_alloc_aligned(size, UHWI_MEM_HDR_SIZE);
+}
+
+void* uhwi_mem_calloc(const size_t count, const size_t size) {
+    if (size > 0 && count > SIZE_MAX / size)
+        return NULL;
+
+    void* ptr = uhwi_mem_alloc(count * size);
+
+    if (ptr)
+        memset(ptr, 0, count * size);
+
+    return ptr;
+}
+
+void* uhwi_mem_realloc(void* ptr, const size_t size) {
+    if (!ptr)
+        return uhwi_mem_alloc(size);
+
+    const uhwi_mem_hdr hdr = *UHWI_MEM_HDR(ptr);
+    char* raw = (char*)ptr - hdr.offset;
+
+    if (size > SIZE_MAX - hdr.offset)
+        return NULL;
+
+    // over-aligned blocks can't be moved around by the allocator
+    if (hdr.offset != UHWI_MEM_HDR_SIZE || !uhwi_mem_allocator.realloc) {
+        void* moved = uhwi_mem_alloc(size);
+
+        if (!moved)
+            return NULL;
+
+        memcpy(moved, ptr, (hdr.size < size) ? hdr.size : size);
+        uhwi_mem_free(ptr);
+
+        return moved;
+    }
+
+    raw = uhwi_mem_allocator.realloc(raw, hdr.size + hdr.offset,
+                                     size + hdr.offset,
+                                     uhwi_mem_allocator.userdata);
+
+    if (!raw)
+        return NULL;
+
+    ptr = raw + hdr.offset;
+    UHWI_MEM_HDR(ptr)->size = size;
+
+    uhwi_mem_account_free(hdr.size);
+    uhwi_mem_account_alloc(size);
+
+    return ptr;
+}
+
+void uhwi_mem_free(void* ptr) {
+    if (!ptr)
+        return;
+
+    const uhwi_mem_hdr hdr = *UHWI_MEM_HDR(ptr);
+
+    uhwi_mem_account_free(hdr.size);
+    uhwi_mem_allocator.free((char*)ptr - hdr.offset, hdr.size + hdr.offset,
+                            uhwi_mem_allocator.userdata);
+}
+
+void uhwi_mem_stats(uhwi_stats* stats) {
+    stats->mem_current = __atomic_load_n(&uhwi_mem_current, __ATOMIC_RELAXED);
+    stats->mem_peak = __atomic_load_n(&uhwi_mem_peak, __ATOMIC_RELAXED);
+    stats->mem_total = __atomic_load_n(&uhwi_mem_total, __ATOMIC_RELAXED);
+}
+
+void uhwi_mem_stats_reset(void) {
+    // live blocks are still live, the peak starts over from them
+    __atomic_store_n(&uhwi_mem_peak,
+                     __atomic_load_n(&uhwi_mem_current, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&uhwi_mem_total, 0, __ATOMIC_RELAXED);
+}
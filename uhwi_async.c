@@ -0,0 +1,255 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "uhwi_internal.h"
+
+struct uhwi_async {
+    uhwi_dev_t type;
+    uhwi_async_form_t form;
+
+    pthread_t worker;
+    // whether the worker still has to be joined
+    int joinable;
+
+    // set by uhwi_async_cancel(), checked by the worker between devices
+    int cancelled;
+    // set by the worker right before it signals the completion fd
+    int done;
+
+    // completion fd handed out to the caller (the read end of the pipe on
+    // systems without eventfd) and the one the worker writes into
+    int fd;
+    int signal_fd;
+
+    // the result (exactly one of them, depending on the form) along with the
+    // worker's error, both only read once the worker was joined
+    uhwi_dev* list;
+    uhwi_snapshot* snap;
+    uhwi_errno_t last_errno;
+};
+
+int uhwi_async_append(const uhwi_dev* dev, void* userdata) {
+    uhwi_async* req = userdata;
+
+    if (__atomic_load_n(&req->cancelled, __ATOMIC_RELAXED))
+        return 1;
+
+    return uhwi_snapshot_append(dev, req->snap);
+}
+
+void* uhwi_async_worker(void* userdata) {
+    uhwi_async* req = userdata;
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    if (uhwi_cache_enabled()) {
+        // a fresh cached snapshot is handed out right away, same as with
+        // uhwi_get_devs()
+        req->snap = uhwi_snapshot_take_cached(req->type);
+    } else if (!__atomic_load_n(&req->cancelled, __ATOMIC_RELAXED)) {
+        req->snap = uhwi_snapshot_alloc();
+
+        // (out of memory, the request then comes back empty-handed)
+        if (req->snap &&
+            uhwi_foreach_dev(req->type, uhwi_async_append, req) < 0 &&
+            (uhwi_snapshot_count(req->snap) == 0 ||
+             uhwi_last_errno == UHWI_ERRNO_NO_MEM)) {
+            // same as with uhwi_snapshot_take(), nothing at all could be
+            // enumerated or not everything that was fit into the snapshot
+            uhwi_snapshot_free(req->snap);
+            req->snap = NULL;
+        } else if (req->snap)
+            uhwi_snapshot_finish(req->snap);
+    }
+
+    // a cancelled request never hands out a partial result
+    if (__atomic_load_n(&req->cancelled, __ATOMIC_RELAXED)) {
+        uhwi_snapshot_free(req->snap);
+        req->snap = NULL;
+
+        uhwi_last_errno = UHWI_ERRNO_CANCELLED;
+    }
+
+    if (req->snap && req->form == UHWI_ASYNC_LIST) {
+        // the DB lookups already happened during the enumeration, the list
+        // is just a copy
+        req->list = uhwi_snapshot_to_list(req->snap);
+
+        uhwi_snapshot_free(req->snap);
+        req->snap = NULL;
+    }
+
+    req->last_errno = uhwi_last_errno;
+    __atomic_store_n(&req->done, 1, __ATOMIC_RELEASE);
+
+#ifdef __linux__
+    const uint64_t one = 1;
+#else
+    const uint8_t one = 1;
+#endif
+
+    // the fd then stays readable until the request is freed (neither the
+    // eventfd counter nor the pipe can be full at this point)
+    const ssize_t written = write(req->signal_fd, &one, sizeof(one));
+    (void)written;
+
+    return NULL;
+}
+
+int uhwi_async_open_fds(uhwi_async* req) {
+#ifdef __linux__
+    req->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    req->signal_fd = req->fd;
+
+    return (req->fd < 0) ? -1 : 0;
+#else
+    int fds[2];
+
+    if (pipe(fds) < 0)
+        return -1;
+
+    for (size_t index = 0; index < 2; index++) {
+        fcntl(fds[index], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[index], F_SETFL, fcntl(fds[index], F_GETFL) | O_NONBLOCK);
+    }
+
+    req->fd = fds[0];
+    req->signal_fd = fds[1];
+
+    return 0;
+#endif
+}
+
+void uhwi_async_close_fds(uhwi_async* req) {
+    if (req->signal_fd >= 0 && req->signal_fd != req->fd)
+        close(req->signal_fd);
+
+    if (req->fd >= 0)
+        close(req->fd);
+}
+
+uhwi_async* uhwi_get_devs_async(const uhwi_dev_t type,
+                                const uhwi_async_form_t form) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    uhwi_async* req = uhwi_mem_calloc(1, sizeof(uhwi_async));
+
+    if (!req) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+
+    req->type = type;
+    req->form = form;
+    req->fd = -1;
+    req->signal_fd = -1;
+
+    if (uhwi_async_open_fds(req) < 0 ||
+        pthread_create(&req->worker, NULL, uhwi_async_worker, req) != 0) {
+        uhwi_async_close_fds(req);
+        uhwi_mem_free(req);
+
+        uhwi_last_errno = UHWI_ERRNO_ASYNC_START;
+        return NULL;
+    }
+
+    req->joinable = 1;
+    return req;
+}
+
+int uhwi_async_fd(const uhwi_async* req) {
+    return (req) ? req->fd : -1;
+}
+
+int uhwi_async_done(const uhwi_async* req) {
+    return (req) ? __atomic_load_n(&req->done, __ATOMIC_ACQUIRE) : 1;
+}
+
+void uhwi_async_cancel(uhwi_async* req) {
+    if (req)
+        __atomic_store_n(&req->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+// waits for the worker and hands its error over to the calling thread
+void uhwi_async_join(uhwi_async* req) {
+    if (req->joinable) {
+        pthread_join(req->worker, NULL);
+        req->joinable = 0;
+    }
+
+    uhwi_last_errno = req->last_errno;
+}
+
+uhwi_dev* uhwi_async_list(uhwi_async* req) {
+    if (!req)
+        return NULL;
+
+    uhwi_async_join(req);
+
+    // (the result can only be taken once)
+    uhwi_dev* first = req->list;
+    req->list = NULL;
+
+    return first;
+}
+
+uhwi_snapshot* uhwi_async_snapshot(uhwi_async* req) {
+    if (!req)
+        return NULL;
+
+    uhwi_async_join(req);
+
+    uhwi_snapshot* snap = req->snap;
+    req->snap = NULL;
+
+    return snap;
+}
+
+void uhwi_async_free(uhwi_async* req) {
+    if (!req)
+        return;
+
+    const uhwi_errno_t last_errno = uhwi_last_errno;
+
+    uhwi_async_cancel(req);
+    uhwi_async_join(req);
+
+    uhwi_last_errno = last_errno;
+
+    // results that were never taken out
+    uhwi_clean_up(req->list);
+    uhwi_snapshot_free(req->snap);
+
+    uhwi_async_close_fds(req);
+    uhwi_mem_free(req);
+}
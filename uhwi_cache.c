@@ -0,0 +1,468 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdio.h>
+
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+#ifdef __FreeBSD__
+#include <sys/ioctl.h>
+#include <sys/pciio.h>
+#endif
+
+#include "uhwi_internal.h"
+
+/// one cache slot per uhwi_dev_t
+#define UHWI_CACHE_SLOTS (UHWI_DEV_BLOCK + 1)
+
+typedef struct {
+    /// shared snapshot (the cache holds a reference of its own)
+    uhwi_snapshot* snap;
+
+    /// CLOCK_MONOTONIC timestamp (ns) the snapshot goes stale at
+    uint64_t expires;
+    /// probe value observed right before the snapshot was taken
+    uint64_t probe;
+} uhwi_cache_slot;
+
+unsigned int uhwi_cache_ttl_ms = 0;
+int uhwi_cache_flags = 0;
+
+uhwi_cache_slot uhwi_cache_slots[UHWI_CACHE_SLOTS];
+
+// guards the slots, which are only ever held for a few pointer swaps
+char uhwi_cache_lock = 0;
+
+#define UHWI_CACHE_LOCK() \
+    while (__atomic_test_and_set(&uhwi_cache_lock, __ATOMIC_ACQUIRE));
+
+#define UHWI_CACHE_UNLOCK() \
+    __atomic_clear(&uhwi_cache_lock, __ATOMIC_RELEASE);
+
+uhwi_stats uhwi_stats_counters;
+
+#define UHWI_STATS_INC(counter) \
+    __atomic_add_fetch(&uhwi_stats_counters.counter, 1, __ATOMIC_RELAXED);
+
+// cheap hotplug generation number, 0 if unknown (always on macOS, where a
+// cached result then only goes stale with its TTL)
+uint64_t uhwi_cache_probe(void) {
+#ifdef __linux__
+    // bumped by the kernel on every uevent, hotplug included
+    const int fd = open("/sys/kernel/uevent_seqnum", O_RDONLY);
+
+    if (fd < 0)
+        return 0;
+
+    char buf[32];
+    const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+
+    close(fd);
+
+    if (len <= 0)
+        return 0;
+
+    buf[len] = '\0';
+    return strtoull(buf, NULL, 10);
+#elif defined(__FreeBSD__)
+    // pci(4) bumps its generation number whenever a device is added or
+    // removed, it comes along with even a single matching device
+    const int fd = open(UHWI_PCI_DEV_PATH_CONST, O_RDONLY, 0);
+
+    if (fd < 0)
+        return 0;
+
+    struct pci_conf match;
+    struct pci_conf_io cnf;
+
+    memset(&cnf, 0, sizeof(struct pci_conf_io));
+
+    cnf.match_buf_len = sizeof(struct pci_conf);
+    cnf.matches = &match;
+
+    const int rc = ioctl(fd, PCIOCGETCONF, &cnf);
+    close(fd);
+
+    if (rc == -1 || cnf.status == PCI_GETCONF_ERROR)
+        return 0;
+
+    // (0 is taken for unknown)
+    return (uint64_t)cnf.generation + 1;
+#else
+    return 0;
+#endif
+}
+
+int uhwi_cache_enabled(void) {
+    return __atomic_load_n(&uhwi_cache_ttl_ms, __ATOMIC_RELAXED) > 0;
+}
+
+void uhwi_cache_flush(void) {
+    uhwi_snapshot* stale[UHWI_CACHE_SLOTS];
+
+    UHWI_CACHE_LOCK()
+
+    for (size_t index = 0; index < UHWI_CACHE_SLOTS; index++) {
+        stale[index] = uhwi_cache_slots[index].snap;
+        memset(&uhwi_cache_slots[index], 0, sizeof(uhwi_cache_slot));
+    }
+
+    UHWI_CACHE_UNLOCK()
+
+    // (snapshots still referenced by callers stay valid)
+    for (size_t index = 0; index < UHWI_CACHE_SLOTS; index++)
+        uhwi_snapshot_free(stale[index]);
+}
+
+void uhwi_cache_enable(const unsigned int ttl_ms, const int flags) {
+    __atomic_store_n(&uhwi_cache_flags, flags, __ATOMIC_RELAXED);
+    __atomic_store_n(&uhwi_cache_ttl_ms, ttl_ms, __ATOMIC_RELAXED);
+
+    uhwi_cache_flush();
+}
+
+uhwi_snapshot* uhwi_snapshot_take_cached(const uhwi_dev_t type) {
+    const unsigned int ttl_ms = __atomic_load_n(&uhwi_cache_ttl_ms,
+                                                __ATOMIC_RELAXED);
+
+    if (ttl_ms == 0 || (size_t)type >= UHWI_CACHE_SLOTS)
+        return uhwi_snapshot_take(type);
+
+    const uint64_t now = uhwi_now_ns();
+
+    // read before enumerating, so that a hotplug event racing with the rescan
+    // invalidates its result next time around
+    const uint64_t probe = (__atomic_load_n(&uhwi_cache_flags,
+                                            __ATOMIC_RELAXED) &
+                            UHWI_CACHE_PROBE) ? uhwi_cache_probe() : 0;
+
+    uhwi_cache_slot* slot = &uhwi_cache_slots[type];
+    uhwi_snapshot* snap = NULL;
+
+    UHWI_CACHE_LOCK()
+
+    if (slot->snap && now < slot->expires) {
+        if (slot->probe == probe)
+            snap = uhwi_snapshot_ref(slot->snap);
+        else
+            UHWI_STATS_INC(cache_invalidations)
+    }
+
+    UHWI_CACHE_UNLOCK()
+
+    if (snap) {
+        UHWI_STATS_INC(cache_hits)
+
+        uhwi_last_errno = UHWI_ERRNO_OK;
+        return snap;
+    }
+
+    UHWI_STATS_INC(cache_misses)
+
+    // concurrent misses all rescan, the last one to finish wins the slot
+    snap = uhwi_snapshot_take(type);
+
+    if (!snap)
+        return NULL;
+
+    UHWI_CACHE_LOCK()
+
+    uhwi_snapshot* stale = slot->snap;
+
+    slot->snap = uhwi_snapshot_ref(snap);
+    slot->expires = now + (uint64_t)ttl_ms * 1000000ULL;
+    slot->probe = probe;
+
+    UHWI_CACHE_UNLOCK()
+
+    uhwi_snapshot_free(stale);
+    return snap;
+}
+
+//
+// on-disk cache
+//
+
+#define UHWI_DISK_CACHE_MAGIC "UHWC"
+#define UHWI_DISK_CACHE_VERSION 1
+
+/// precedes the binary snapshot within a cache file
+typedef struct {
+    /// UHWI_DISK_CACHE_MAGIC
+    char magic[4];
+    /// UHWI_DISK_CACHE_VERSION
+    uint32_t version;
+
+    /// uhwi_disk_cache_fingerprint() at the time the snapshot was taken
+    uint64_t fingerprint;
+} uhwi_disk_cache_hdr;
+
+uint64_t uhwi_fnv1a64(uint64_t hash, const void* data, const size_t len) {
+    const uint8_t* from = data;
+
+    for (size_t index = 0; index < len; index++) {
+        hash ^= from[index];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+#ifdef __linux__
+// mixes every entry of a sysfs bus directory into the fingerprint: a device
+// being added or removed changes the names, one being replaced within the same
+// slot gets a new sysfs inode
+int uhwi_disk_cache_hash_dir(const char* path, uint64_t* hash) {
+    DIR* dir = opendir(path);
+
+    if (!dir)
+        return -1;
+
+    // (the order of entries doesn't matter)
+    uint64_t sum = 0;
+    size_t count = 0;
+
+    struct dirent* entry = NULL;
+
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        struct stat st;
+
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            memset(&st, 0, sizeof(st));
+
+        uint64_t entry_hash = uhwi_fnv1a64(UHWI_FNV1A64_INIT, entry->d_name,
+                                           strlen(entry->d_name));
+
+        entry_hash = uhwi_fnv1a64(entry_hash, &st.st_ino, sizeof(st.st_ino));
+        entry_hash = uhwi_fnv1a64(entry_hash, &st.st_mtime,
+                                  sizeof(st.st_mtime));
+
+        sum += entry_hash;
+        count++;
+    }
+
+    closedir(dir);
+
+    *hash = uhwi_fnv1a64(*hash, &sum, sizeof(sum));
+    *hash = uhwi_fnv1a64(*hash, &count, sizeof(count));
+
+    return 0;
+}
+
+// mixes the contents of a (small) sysfs file into the fingerprint
+int uhwi_disk_cache_hash_file(const char* path, uint64_t* hash) {
+    const int fd = open(path, O_RDONLY, 0);
+
+    if (fd < 0)
+        return -1;
+
+    char buf[256];
+    ssize_t rdsz = 0;
+
+    while ((rdsz = read(fd, buf, sizeof(buf))) > 0)
+        *hash = uhwi_fnv1a64(*hash, buf, (size_t)rdsz);
+
+    close(fd);
+    return (rdsz < 0) ? -1 : 0;
+}
+#endif
+
+// fingerprint of whatever the enumeration result of the specified type depends
+// on (0 if it can't be determined, the cache is then bypassed)
+uint64_t uhwi_disk_cache_fingerprint(const uhwi_dev_t type) {
+#ifdef __linux__
+    // a memory block going on- or offline only changes its own state file,
+    // reading every one of them costs as much as enumerating them
+    if (type == UHWI_DEV_MEM)
+        return 0;
+
+    uint64_t hash = UHWI_FNV1A64_INIT;
+    int rc = 0;
+
+    hash = uhwi_fnv1a64(hash, &type, sizeof(type));
+
+    // a missing directory is a valid state as well (e.g. no USB)
+    for (uhwi_dev_t of = UHWI_DEV_PCI; of < UHWI_CACHE_SLOTS; of++)
+        if (UHWI_DEV_TYPE_INCLUDES(type, of) &&
+            uhwi_disk_cache_hash_dir(uhwi_sysfs_class_of(of)->dir, &hash) < 0)
+            rc--;
+
+    // a CPU going on- or offline doesn't change its directory entry, but does
+    // take its topology along, the mask of online CPUs covers all of them
+    if (type == UHWI_DEV_CPU) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/online",
+                 uhwi_sysfs_class_of(UHWI_DEV_CPU)->dir);
+
+        if (uhwi_disk_cache_hash_file(path, &hash) < 0)
+            rc--;
+    }
+
+    hash = uhwi_fnv1a64(hash, &rc, sizeof(rc));
+
+    // device names come from the PCI DB
+    const uint64_t db = uhwi_db_fingerprint(NULL);
+    hash = uhwi_fnv1a64(hash, &db, sizeof(db));
+
+    return hash ? hash : 1;
+#else
+    // neither pci(4) & libusb on FreeBSD nor IOKit on macOS can tell whether
+    // the bus contents changed without enumerating them, the disk cache is
+    // bypassed there
+    (void)type;
+    return 0;
+#endif
+}
+
+void uhwi_disk_cache_path(const uhwi_dev_t type, char* path, const size_t max) {
+    const char* const names[] = { "all", "pci", "usb", "cpu", "mem", "block" };
+
+    snprintf(path, max, "%s/%s.uhws", UHWI_DISK_CACHE_DIR,
+             names[((size_t)type < UHWI_CACHE_SLOTS) ? type : 0]);
+}
+
+// saves the snapshot next to the cache file and renames it over, so that
+// concurrent readers only ever see a complete file (failures are ignored, the
+// cache is merely an optimization)
+void uhwi_disk_cache_store(const uhwi_snapshot* snap, const char* path,
+                           const uint64_t fingerprint) {
+    if (mkdir(UHWI_DISK_CACHE_DIR, 0755) < 0 && errno != EEXIST)
+        return;
+
+    // (a fresh file nobody could have planted or linked elsewhere beforehand,
+    // mkstemp() creates it readable by its owner only)
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    const int fd = mkstemp(tmp);
+
+    if (fd < 0)
+        return;
+
+    if (fchmod(fd, 0644) < 0) {
+        close(fd);
+        unlink(tmp);
+
+        return;
+    }
+
+    uhwi_disk_cache_hdr hdr;
+    memset(&hdr, 0, sizeof(uhwi_disk_cache_hdr));
+
+    memcpy(hdr.magic, UHWI_DISK_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = UHWI_DISK_CACHE_VERSION;
+    hdr.fingerprint = fingerprint;
+
+    const int rc = (write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr)) ?
+                   uhwi_snapshot_save(snap, fd) : -1;
+
+    if (close(fd) < 0 || rc < 0 || rename(tmp, path) < 0)
+        unlink(tmp);
+}
+
+uhwi_snapshot* uhwi_snapshot_take_persistent(const uhwi_dev_t type) {
+    const uint64_t fingerprint = uhwi_disk_cache_fingerprint(type);
+
+    if (fingerprint == 0)
+        return uhwi_snapshot_take(type);
+
+    char path[256];
+    uhwi_disk_cache_path(type, path, sizeof(path));
+
+    uhwi_disk_cache_hdr hdr;
+    uhwi_snapshot* snap = uhwi_snapshot_load_prefixed(path, &hdr,
+                                                      sizeof(hdr));
+
+    if (snap && memcmp(hdr.magic, UHWI_DISK_CACHE_MAGIC,
+                       sizeof(hdr.magic)) == 0 &&
+        hdr.version == UHWI_DISK_CACHE_VERSION &&
+        hdr.fingerprint == fingerprint) {
+        UHWI_STATS_INC(disk_cache_hits)
+
+        uhwi_last_errno = UHWI_ERRNO_OK;
+        return snap;
+    }
+
+    // missing, outdated or written by another version
+    uhwi_snapshot_free(snap);
+    UHWI_STATS_INC(disk_cache_misses)
+
+    snap = uhwi_snapshot_take(type);
+
+    if (snap) {
+        const uhwi_errno_t last_errno = uhwi_last_errno;
+
+        uhwi_disk_cache_store(snap, path, fingerprint);
+        uhwi_last_errno = last_errno;
+    }
+
+    return snap;
+}
+
+void uhwi_get_stats(uhwi_stats* stats) {
+    if (!stats)
+        return;
+
+    stats->cache_hits = __atomic_load_n(&uhwi_stats_counters.cache_hits,
+                                        __ATOMIC_RELAXED);
+    stats->cache_misses = __atomic_load_n(&uhwi_stats_counters.cache_misses,
+                                          __ATOMIC_RELAXED);
+    stats->cache_invalidations = __atomic_load_n(
+        &uhwi_stats_counters.cache_invalidations, __ATOMIC_RELAXED);
+
+    stats->disk_cache_hits = __atomic_load_n(
+        &uhwi_stats_counters.disk_cache_hits, __ATOMIC_RELAXED);
+    stats->disk_cache_misses = __atomic_load_n(
+        &uhwi_stats_counters.disk_cache_misses, __ATOMIC_RELAXED);
+
+    uhwi_mem_stats(stats);
+}
+
+void uhwi_reset_stats(void) {
+    __atomic_store_n(&uhwi_stats_counters.cache_hits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&uhwi_stats_counters.cache_misses, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&uhwi_stats_counters.cache_invalidations, 0,
+                     __ATOMIC_RELAXED);
+
+    __atomic_store_n(&uhwi_stats_counters.disk_cache_hits, 0,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&uhwi_stats_counters.disk_cache_misses, 0,
+                     __ATOMIC_RELAXED);
+
+    uhwi_mem_stats_reset();
+}
@@ -0,0 +1,2114 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdio.h>
+
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+
+#include "uhwi_internal.h"
+
+#ifdef UHWI_ENABLE_PCI_DB
+
+# ifndef UHWI_PCI_DB_PATH_CONST
+#  ifdef __FreeBSD__
+#   define UHWI_PCI_DB_PATH_CONST "/usr/share/misc/pci_vendors"
+#  elif defined(__linux__)
+#   define UHWI_PCI_DB_PATH_CONST "/usr/share/misc/pci.ids"
+#  else
+#   error "Please define UHWI_PCI_DB_PATH_CONST (path to PCI IDs DB) via your C compiler flags."
+#  endif
+
+# endif
+
+// device names are front-coded against the preceding device of the same vendor
+// (which mostly shares a long prefix with it), with a self-contained entry
+// every UHWI_DB_FC_BUCKET devices so that decoding never walks further than that
+#define UHWI_DB_FC_BUCKET 16
+
+// vendor & device names are kept up to the same length uhwi_dev can hold
+#define UHWI_DB_NAME_MAX (UHWI_DEV_NAME_MAX_LEN - 1)
+
+#define UHWI_DB_LINES_BASE 1024
+
+// vendor lines hold at least 4 digits & a blank, device lines a tab in front
+// of that; anything shorter is taken for a comment, so that neither the ID nor
+// the name is ever read past the end of a (truncated) line
+#define UHWI_DB_IS_VENDOR(line, eol) \
+    ((eol) - (line) >= 5 && UHWI_IS_HEX((line)[0]))
+#define UHWI_DB_IS_DEVICE(line, eol) \
+    ((eol) - (line) >= 6 && (line)[0] == '\t' && UHWI_IS_HEX((line)[1]))
+
+// DB paths are colon-separated lists of layers, later ones override earlier
+#define UHWI_DB_LAYER_SEP ':'
+#define UHWI_DB_PATH_MAX 1024
+
+// UHWI_DB_PARALLEL splits a file into at most this many chunks, each at least
+// UHWI_DB_CHUNK_MIN bytes long (smaller ones aren't worth a thread)
+#define UHWI_DB_THREADS_MAX 16
+#define UHWI_DB_CHUNK_MIN (64 * 1024)
+
+// name trigrams are hashed into this many posting lists, a collision only costs
+// a few extra candidates since every one of them is verified anyway
+#define UHWI_DB_SEARCH_BUCKETS (1 << 16)
+
+// n-gram index over every vendor & device name, "documents" are numbered in DB
+// order (each vendor followed by its devices, just like in the DB file)
+typedef struct {
+    /// start of each bucket's postings (UHWI_DB_SEARCH_BUCKETS + 1 entries)
+    uint32_t* offsets;
+    /// ascending document numbers of each bucket
+    uint32_t* postings;
+} uhwi_db_search_index;
+
+struct uhwi_db {
+    int flags;
+
+    /// vendors sorted by their ID, stored as parallel arrays so that the binary
+    /// search only ever touches the packed 16-bit IDs
+    uhwi_id_t* vendor_ids;
+    uhwi_str_t* vendor_names;
+    size_t nvendors;
+
+    /// index of each vendor's first device (nvendors + 1 entries, so that the
+    /// next element always marks the end of the range)
+    uint32_t* vendor_first;
+
+    /// device IDs grouped by vendor and sorted
+    uhwi_id_t* device_ids;
+    /// front-coded device name entries (0 if not decoded yet)
+    uhwi_str_t* device_names;
+    size_t ndevs;
+
+    /// vendor names & front-coded device name entries
+    uhwi_strpool strings;
+
+    //
+    // lazy decoding (UHWI_DB_LAZY)
+    //
+
+    /// DB file kept open for reading vendor blocks on demand
+    int fd;
+
+    /// byte range of each vendor's device lines within the DB file
+    uint32_t* block_off;
+    uint32_t* block_len;
+
+    /// whether device names of a vendor were decoded already
+    uint8_t* decoded;
+
+    /// name search index, built on first search
+    uhwi_db_search_index* search;
+};
+
+// a vendor or device line of the DB file, pointing into the read buffer
+typedef struct {
+    uhwi_id_t vendor;
+    uhwi_id_t device;
+
+    const char* name;
+    uint32_t len;
+
+    /// order of appearance (keeps sorting stable) or block offset for vendors
+    uint32_t seq;
+    uint32_t block_len;
+
+    /// device lines within a vendor's block (skimming only)
+    uint32_t ndevs;
+} uhwi_db_line;
+
+// on_fail has to leave the scope, the array is kept as it was then
+#define APPEND_DB_LINE(array, count, cap, on_fail) { \
+    if (count == cap) { \
+        const size_t grown = cap ? cap * 2 : UHWI_DB_LINES_BASE; \
+        uhwi_db_line* moved = uhwi_mem_realloc(array, \
+                                               grown * sizeof(uhwi_db_line)); \
+        \
+        if (!moved) { \
+            uhwi_last_errno = UHWI_ERRNO_NO_MEM; \
+            on_fail; \
+        } \
+        \
+        array = moved; \
+        cap = grown; \
+    } \
+    \
+    memset(&array[count], 0, sizeof(uhwi_db_line)); \
+    count++; \
+}
+
+// reads the rest of an open file of the specified size, NUL-terminated (NULL
+// with UHWI_ERRNO_NO_MEM if out of memory)
+char* uhwi_db_slurp_fd(const int fd, const size_t size, size_t* lenp) {
+    // read the entire DB in a handful of syscalls instead of one per byte,
+    // the trailing NUL terminates the very last line
+    size_t len = 0;
+    char* buf = uhwi_mem_alloc(size + 1);
+
+    if (!buf) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+
+    while (len < size) {
+        ssize_t rdsz = read(fd, buf + len, size - len);
+
+        if (rdsz <= 0)
+            break; // EOF or error, doesn't matter - time to stop regardless
+
+        len += (size_t)rdsz;
+    }
+
+    buf[len] = '\0';
+
+    (*lenp) = len;
+    return buf;
+}
+
+char* uhwi_db_slurp(const char* path, size_t* lenp, int* fdp) {
+    int fd = open(path, O_RDONLY, 0);
+
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char* buf = uhwi_db_slurp_fd(fd, (size_t)st.st_size, lenp);
+
+    // lazy DBs keep the file around to decode vendor blocks later on
+    if (buf && fdp)
+        (*fdp) = fd;
+    else
+        close(fd);
+
+    return buf;
+}
+
+// strips the blanks around the name following an ID on a DB line, returns its
+// (capped) length
+uint32_t uhwi_db_trim_name(const char** fromp, const char* eol) {
+    const char* from = *fromp;
+
+    if (from > eol)
+        from = eol;
+
+    while (from < eol && (*from == ' ' || *from == '\t'))
+        from++;
+
+    while (eol > from && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r'))
+        eol--;
+
+    (*fromp) = from;
+
+    const size_t len = (size_t)(eol - from);
+    return (uint32_t)((len > UHWI_DB_NAME_MAX) ? UHWI_DB_NAME_MAX : len);
+}
+
+// appends a front-coded device name entry to the string pool: the first byte
+// holds the length of the prefix shared with the previous name plus one (so
+// that entries remain valid C strings and identical ones get interned into a
+// single copy), the rest is the differing suffix
+uhwi_str_t uhwi_db_encode_name(uhwi_db* db, const char* prev,
+                               const uint32_t prevlen, const char* name,
+                               const uint32_t len) {
+    uint32_t prefix = 0;
+
+    if (prev)
+        while (prefix < prevlen && prefix < len && prev[prefix] == name[prefix])
+            prefix++;
+
+    char entry[UHWI_DB_NAME_MAX + 2];
+
+    entry[0] = (char)(uint8_t)(prefix + 1);
+    memcpy(entry + 1, name + prefix, len - prefix);
+
+    return uhwi_strpool_intern(&db->strings, entry, len - prefix + 1);
+}
+
+// remembers which device name work currently holds, so that walking devices in
+// ascending order decodes each front-coded entry once instead of restarting
+// from the beginning of its bucket every time
+typedef struct {
+    size_t index;
+    size_t len;
+} uhwi_db_fc_cursor;
+
+#define UHWI_DB_FC_CURSOR_INIT { (size_t)-1, 0 }
+
+// decodes the device name at the specified index into work (which must be able
+// to hold UHWI_DB_NAME_MAX + 1 bytes), returns its length
+size_t uhwi_db_decode_name(const uhwi_db* db, const size_t vindex,
+                           const size_t dindex, char* work,
+                           uhwi_db_fc_cursor* cursor) {
+    const size_t first = db->vendor_first[vindex];
+    const size_t start = first + ((dindex - first) / UHWI_DB_FC_BUCKET) *
+                                 UHWI_DB_FC_BUCKET;
+
+    size_t from = start;
+    size_t len = 0;
+
+    if (cursor && cursor->index != (size_t)-1 && cursor->index >= start &&
+        cursor->index <= dindex) {
+        // continue right after the previously decoded name of the same bucket
+        from = cursor->index + 1;
+        len = cursor->len;
+    }
+
+    for (size_t index = from; index <= dindex; index++) {
+        const uint8_t* entry = (const uint8_t*)(db->strings.data +
+                                                db->device_names[index]);
+
+        size_t prefix = (entry[0] > 0) ? (size_t)entry[0] - 1 : 0;
+        size_t slen = strlen((const char*)entry + 1);
+
+        if (prefix > len)
+            prefix = len;
+
+        if (prefix + slen > UHWI_DB_NAME_MAX)
+            slen = UHWI_DB_NAME_MAX - prefix;
+
+        memcpy(work + prefix, entry + 1, slen);
+        len = prefix + slen;
+    }
+
+    work[len] = '\0';
+
+    if (cursor) {
+        cursor->index = dindex;
+        cursor->len = len;
+    }
+
+    return len;
+}
+
+int uhwi_db_cmp_lines(const void* a, const void* b) {
+    const uhwi_db_line* la = a;
+    const uhwi_db_line* lb = b;
+
+    if (la->vendor != lb->vendor)
+        return (int)la->vendor - (int)lb->vendor;
+    else if (la->device != lb->device)
+        return (int)la->device - (int)lb->device;
+
+    return (la->seq < lb->seq) ? -1 : (la->seq > lb->seq);
+}
+
+// front-codes the names of devices [first, first + count) of the lines array,
+// returns -1 if the string pool couldn't grow
+int uhwi_db_encode_names(uhwi_db* db, const uhwi_db_line* devs,
+                         const size_t first, const size_t count) {
+    for (size_t index = 0; index < count; index++) {
+        const uhwi_db_line* prev = (index % UHWI_DB_FC_BUCKET) ?
+                                   &devs[index - 1] : NULL;
+
+        const uhwi_str_t name = uhwi_db_encode_name(db, prev ? prev->name : NULL,
+                                                    prev ? prev->len : 0,
+                                                    devs[index].name,
+                                                    devs[index].len);
+
+        if (name == UHWI_STR_NONE)
+            return -1;
+
+        db->device_names[first + index] = name;
+    }
+
+    return 0;
+}
+
+// vendor & device lines collected from every layer of a DB
+typedef struct {
+    uhwi_db_line* vlines;
+    size_t nvlines;
+    size_t vcap;
+
+    uhwi_db_line* dlines;
+    size_t ndlines;
+    size_t dcap;
+} uhwi_db_lines;
+
+// collects the lines of a single DB file, base is the combined size of the
+// layers before it (so that vendor block offsets keep growing across layers),
+// returns whether the vendors and their devices come in ascending ID order (-1
+// if out of memory, the lines collected so far are kept)
+int uhwi_db_scan(uhwi_db_lines* lines, const char* buf, const size_t len,
+                 const uint32_t base) {
+    // devices belong to the last vendor of the same file
+    const size_t vfirst = lines->nvlines;
+
+    int sorted = 1;
+
+    const char* line = NULL;
+    const char* eol = NULL;
+
+    // where the last vendor's block ends
+    const char* stop = buf + len;
+
+    uhwi_lines it;
+    uhwi_lines_init(&it, buf, len);
+
+    while (uhwi_lines_next(&it, &line, &eol)) {
+        if (line[0] == 'C' && line[1] == ' ') {
+            stop = line;
+            break; // classification section -> nothing of interest past it
+        }
+        else if (UHWI_DB_IS_VENDOR(line, eol)) {
+            //  vendor  vendor_name
+            const uhwi_id_t id = uhwi_hex_id(line, 0);
+
+            if (lines->nvlines > vfirst) {
+                uhwi_db_line* prev = &lines->vlines[lines->nvlines - 1];
+
+                if (prev->vendor >= id)
+                    sorted = 0;
+
+                // the previous vendor's block of device lines ends here
+                prev->block_len = (uint32_t)((line - buf) + base - prev->seq);
+            }
+
+            APPEND_DB_LINE(lines->vlines, lines->nvlines, lines->vcap,
+                           return -1)
+            uhwi_db_line* current = &lines->vlines[lines->nvlines - 1];
+
+            current->vendor = id;
+            current->name = line + 4;
+            current->len = uhwi_db_trim_name(&current->name, eol);
+
+            // (blocks start with the vendor line itself)
+            current->seq = (uint32_t)(line - buf) + base;
+        } else if (UHWI_DB_IS_DEVICE(line, eol) && lines->nvlines > vfirst) {
+            //     device  device_name
+            // (two tabs -> [currently TODO] subvendor line, skipped)
+            const uhwi_id_t id = uhwi_hex_id(line + 1, 0);
+
+            const uhwi_id_t vendor = lines->vlines[lines->nvlines - 1].vendor;
+
+            if (lines->ndlines > 0 &&
+                lines->dlines[lines->ndlines - 1].vendor == vendor &&
+                lines->dlines[lines->ndlines - 1].device >= id)
+                sorted = 0;
+
+            APPEND_DB_LINE(lines->dlines, lines->ndlines, lines->dcap,
+                           return -1)
+            uhwi_db_line* current = &lines->dlines[lines->ndlines - 1];
+
+            current->vendor = vendor;
+            current->device = id;
+
+            current->name = line + 5;
+            current->len = uhwi_db_trim_name(&current->name, eol);
+
+            current->seq = (uint32_t)(lines->ndlines - 1);
+        }
+
+        // everything else is either a comment or an empty line
+    }
+
+    if (lines->nvlines > vfirst) {
+        uhwi_db_line* last = &lines->vlines[lines->nvlines - 1];
+        last->block_len = (uint32_t)((stop - buf) + base - last->seq);
+    }
+
+    return sorted;
+}
+
+// keeps only the last of every run of lines with equal IDs (sorted in order
+// of appearance, so that is the one of the latest layer), returns how many
+// lines are left
+size_t uhwi_db_dedup_lines(uhwi_db_line* lines, const size_t count) {
+    size_t kept = 0;
+
+    for (size_t index = 0; index < count; index++) {
+        if (index + 1 < count && lines[index + 1].vendor == lines[index].vendor &&
+            lines[index + 1].device == lines[index].device)
+            continue;
+
+        lines[kept++] = lines[index];
+    }
+
+    return kept;
+}
+
+// lays the collected lines out as the DB's index (the lines are freed either
+// way), returns -1 if out of memory
+int uhwi_db_index(uhwi_db* db, uhwi_db_lines* lines, const int sorted) {
+    uhwi_db_line* vlines = lines->vlines;
+    size_t nvlines = lines->nvlines;
+
+    uhwi_db_line* dlines = lines->dlines;
+    size_t ndlines = lines->ndlines;
+
+    if (!sorted) {
+        // pci.ids is kept sorted upstream, so this is only a fallback for
+        // hand-edited and layered DB files, vendor blocks can't be decoded
+        // lazily then
+        qsort(vlines, nvlines, sizeof(uhwi_db_line), uhwi_db_cmp_lines);
+        qsort(dlines, ndlines, sizeof(uhwi_db_line), uhwi_db_cmp_lines);
+
+        // IDs listed more than once (e.g. by an overlay) take the later name
+        nvlines = uhwi_db_dedup_lines(vlines, nvlines);
+        ndlines = uhwi_db_dedup_lines(dlines, ndlines);
+
+        db->flags &= ~UHWI_DB_LAZY;
+    }
+
+    // lay the vendors and devices out as packed parallel arrays
+    db->nvendors = nvlines;
+    db->vendor_ids = uhwi_mem_alloc(nvlines * sizeof(uhwi_id_t));
+    db->vendor_names = uhwi_mem_alloc(nvlines * sizeof(uhwi_str_t));
+    db->vendor_first = uhwi_mem_alloc((nvlines + 1) * sizeof(uint32_t));
+
+    db->ndevs = ndlines;
+    db->device_ids = uhwi_mem_alloc(ndlines * sizeof(uhwi_id_t));
+    db->device_names = uhwi_mem_calloc(ndlines, sizeof(uhwi_str_t));
+
+    if (db->flags & UHWI_DB_LAZY) {
+        db->block_off = uhwi_mem_alloc(nvlines * sizeof(uint32_t));
+        db->block_len = uhwi_mem_alloc(nvlines * sizeof(uint32_t));
+        db->decoded = uhwi_mem_calloc(nvlines, sizeof(uint8_t));
+    }
+
+    // (whatever did get allocated goes away along with the DB)
+    if (!db->vendor_ids || !db->vendor_names || !db->vendor_first ||
+        !db->device_ids || !db->device_names ||
+        ((db->flags & UHWI_DB_LAZY) &&
+         (!db->block_off || !db->block_len || !db->decoded))) {
+        uhwi_mem_free(vlines);
+        uhwi_mem_free(dlines);
+
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    for (size_t index = 0; index < ndlines; index++)
+        db->device_ids[index] = dlines[index].device;
+
+    // assign each vendor its range of devices in a single merge pass
+    size_t dindex = 0;
+    int rc = 0;
+
+    for (size_t vindex = 0; vindex < nvlines && rc == 0; vindex++) {
+        const uhwi_db_line* vendor = &vlines[vindex];
+
+        const uhwi_str_t name = uhwi_strpool_intern(&db->strings, vendor->name,
+                                                    vendor->len);
+
+        if (name == UHWI_STR_NONE) {
+            rc = -1;
+            break;
+        }
+
+        db->vendor_ids[vindex] = vendor->vendor;
+        db->vendor_names[vindex] = name;
+
+        while (dindex < ndlines && dlines[dindex].vendor < vendor->vendor)
+            dindex++;
+
+        db->vendor_first[vindex] = (uint32_t)dindex;
+
+        const size_t first = dindex;
+
+        while (dindex < ndlines && dlines[dindex].vendor == vendor->vendor)
+            dindex++;
+
+        if (db->flags & UHWI_DB_LAZY) {
+            // device names stay in the file until the vendor gets queried
+            db->block_off[vindex] = vendor->seq;
+            db->block_len[vindex] = vendor->block_len;
+        } else
+            rc = uhwi_db_encode_names(db, &dlines[first], first, dindex - first);
+    }
+
+    db->vendor_first[nvlines] = (uint32_t)ndlines;
+
+    uhwi_mem_free(vlines);
+    uhwi_mem_free(dlines);
+
+    return rc;
+}
+
+// reads a lazy DB's vendor block in, returns -1 if out of memory (the vendor
+// is then decoded again on its next lookup)
+int uhwi_db_decode_vendor(uhwi_db* db, const size_t vindex) {
+    if (!(db->flags & UHWI_DB_LAZY) || db->decoded[vindex])
+        return 0;
+
+    const size_t len = db->block_len[vindex];
+    char* block = uhwi_mem_alloc(len + 1);
+
+    if (!block) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    const ssize_t rdsz = pread(db->fd, block, len, (off_t)db->block_off[vindex]);
+    block[(rdsz > 0) ? (size_t)rdsz : 0] = '\0';
+
+    const size_t first = db->vendor_first[vindex];
+    const size_t count = db->vendor_first[vindex + 1] - first;
+
+    // only the device IDs of a skimmed vendor are not known yet
+    const int skim = db->flags & UHWI_DB_SKIM;
+    int sorted = 1;
+    int rc = 0;
+
+    // device lines come in the very same order their IDs were parsed in
+    uhwi_db_line* dlines = uhwi_mem_calloc(count ? count : 1, sizeof(uhwi_db_line));
+    size_t ndlines = 0;
+
+    if (!dlines) {
+        uhwi_mem_free(block);
+
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    const char* line = NULL;
+    const char* eol = NULL;
+
+    uhwi_lines it;
+    uhwi_lines_init(&it, block, strlen(block));
+
+    while (uhwi_lines_next(&it, &line, &eol)) {
+        if (UHWI_DB_IS_VENDOR(line, eol)) {
+            // the block starts with the vendor line, anything past it belongs
+            // to the next vendor
+            if (line != block || uhwi_hex_id(line, 0) != db->vendor_ids[vindex])
+                break;
+
+            if (skim) {
+                const char* name = line + 4;
+                const uint32_t nlen = uhwi_db_trim_name(&name, eol);
+
+                const uhwi_str_t vname = uhwi_strpool_intern(&db->strings,
+                                                             name, nlen);
+
+                if (vname == UHWI_STR_NONE) {
+                    rc = -1;
+                    break;
+                }
+
+                db->vendor_names[vindex] = vname;
+            }
+        } else if (UHWI_DB_IS_DEVICE(line, eol)) {
+            if (ndlines == count)
+                break; // the file has changed underneath us, give up
+
+            uhwi_db_line* current = &dlines[ndlines];
+            current->device = uhwi_hex_id(line + 1, 0);
+
+            if (!skim && current->device != db->device_ids[first + ndlines])
+                break; // same here
+
+            if (ndlines > 0 && dlines[ndlines - 1].device >= current->device)
+                sorted = 0;
+
+            current->name = line + 5;
+            current->len = uhwi_db_trim_name(&current->name, eol);
+            current->seq = (uint32_t)ndlines;
+
+            ndlines++;
+        }
+    }
+
+    if (rc == 0 && skim) {
+        // (the skim only checked the order of vendors)
+        if (!sorted)
+            qsort(dlines, ndlines, sizeof(uhwi_db_line), uhwi_db_cmp_lines);
+
+        for (size_t index = 0; index < count; index++)
+            db->device_ids[first + index] = (index < ndlines) ?
+                                            dlines[index].device : 0xffff;
+    }
+
+    if (rc == 0)
+        rc = uhwi_db_encode_names(db, dlines, first, ndlines);
+
+    if (rc == 0)
+        db->decoded[vindex] = 1;
+
+    uhwi_mem_free(dlines);
+    uhwi_mem_free(block);
+
+    return rc;
+}
+
+// allocates the arrays of a skimmed DB, vendor names & device IDs are filled
+// in as vendors get decoded, returns -1 if out of memory (whatever did get
+// allocated goes away along with the DB)
+int uhwi_db_skim_alloc(uhwi_db* db, const size_t nvendors,
+                       const size_t ndevs) {
+    db->nvendors = nvendors;
+    db->vendor_ids = uhwi_mem_alloc(nvendors * sizeof(uhwi_id_t));
+    db->vendor_names = uhwi_mem_calloc(nvendors, sizeof(uhwi_str_t));
+    db->vendor_first = uhwi_mem_alloc((nvendors + 1) * sizeof(uint32_t));
+
+    db->ndevs = ndevs;
+    db->device_ids = uhwi_mem_calloc(ndevs, sizeof(uhwi_id_t));
+    db->device_names = uhwi_mem_calloc(ndevs, sizeof(uhwi_str_t));
+
+    db->block_off = uhwi_mem_alloc(nvendors * sizeof(uint32_t));
+    db->block_len = uhwi_mem_alloc(nvendors * sizeof(uint32_t));
+    db->decoded = uhwi_mem_calloc(nvendors, sizeof(uint8_t));
+
+    if (!db->vendor_ids || !db->vendor_names || !db->vendor_first ||
+        !db->device_ids || !db->device_names ||
+        !db->block_off || !db->block_len || !db->decoded) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+// records where each vendor's block starts and how many device lines it has
+// without decoding any of them, returns 0 if the vendors are not in ascending
+// ID order (the DB then has to be parsed in full), -1 if out of memory
+int uhwi_db_skim(uhwi_db* db, const char* buf, const size_t len) {
+    uhwi_db_line* vlines = NULL;
+    size_t nvlines = 0;
+    size_t vcap = 0;
+
+    size_t ndevs = 0;
+
+    const char* line = NULL;
+    const char* eol = NULL;
+
+    // where the last vendor's block ends
+    const char* stop = buf + len;
+
+    uhwi_lines it;
+    uhwi_lines_init(&it, buf, len);
+
+    while (uhwi_lines_next(&it, &line, &eol)) {
+        if (line[0] == 'C' && line[1] == ' ') {
+            stop = line;
+            break; // classification section -> nothing of interest past it
+        } else if (UHWI_DB_IS_VENDOR(line, eol)) {
+            const uhwi_id_t id = uhwi_hex_id(line, 0);
+
+            if (nvlines > 0) {
+                uhwi_db_line* prev = &vlines[nvlines - 1];
+
+                if (prev->vendor >= id) {
+                    uhwi_mem_free(vlines);
+                    return 0;
+                }
+
+                prev->block_len = (uint32_t)((line - buf) - prev->seq);
+            }
+
+            APPEND_DB_LINE(vlines, nvlines, vcap, {
+                uhwi_mem_free(vlines);
+                return -1;
+            })
+            uhwi_db_line* current = &vlines[nvlines - 1];
+
+            current->vendor = id;
+            current->seq = (uint32_t)(line - buf);
+        } else if (UHWI_DB_IS_DEVICE(line, eol) && nvlines > 0) {
+            // just counted, so that every vendor gets its range of devices
+            vlines[nvlines - 1].ndevs++;
+            ndevs++;
+        }
+    }
+
+    if (nvlines > 0) {
+        uhwi_db_line* last = &vlines[nvlines - 1];
+        last->block_len = (uint32_t)((stop - buf) - last->seq);
+    }
+
+    if (uhwi_db_skim_alloc(db, nvlines, ndevs) < 0) {
+        uhwi_mem_free(vlines);
+        return -1;
+    }
+
+    uint32_t first = 0;
+
+    for (size_t vindex = 0; vindex < nvlines; vindex++) {
+        db->vendor_ids[vindex] = vlines[vindex].vendor;
+        db->vendor_first[vindex] = first;
+
+        db->block_off[vindex] = vlines[vindex].seq;
+        db->block_len[vindex] = vlines[vindex].block_len;
+
+        first += vlines[vindex].ndevs;
+    }
+
+    db->vendor_first[nvlines] = first;
+
+    uhwi_mem_free(vlines);
+    return 1;
+}
+
+//
+// skimmed offsets sidecar (UHWI_DB_SIDECAR)
+//
+
+#define UHWI_DB_SIDECAR_MAGIC "UHWX"
+#define UHWI_DB_SIDECAR_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+
+    /// of the DB file the offsets were skimmed from
+    uint64_t fingerprint;
+
+    uint32_t nvendors;
+    uint32_t ndevs;
+} uhwi_db_sidecar_hdr;
+
+// the header is followed by the block offsets, block lengths, first device
+// indices (nvendors + 1 of them) and the vendor IDs, in this order
+#define UHWI_DB_SIDECAR_LEN(nvendors) \
+    (sizeof(uhwi_db_sidecar_hdr) + \
+     (3 * (size_t)(nvendors) + 1) * sizeof(uint32_t) + \
+     (size_t)(nvendors) * sizeof(uhwi_id_t))
+
+// fingerprint of a DB file (inode, size & mtime), the same one
+// uhwi_db_fingerprint() makes of a single layer
+uint64_t uhwi_db_stat_hash(uint64_t hash, const struct stat* st) {
+    hash = uhwi_fnv1a64(hash, &st->st_ino, sizeof(st->st_ino));
+    hash = uhwi_fnv1a64(hash, &st->st_size, sizeof(st->st_size));
+    hash = uhwi_fnv1a64(hash, &st->st_mtime, sizeof(st->st_mtime));
+
+    return hash;
+}
+
+void uhwi_db_sidecar_path(const char* path, char* buf, const size_t max) {
+    const uint64_t hash = uhwi_fnv1a64(UHWI_FNV1A64_INIT, path, strlen(path));
+
+    snprintf(buf, max, "%s/db-%016llx.uhwx", UHWI_DISK_CACHE_DIR,
+             (unsigned long long)hash);
+}
+
+// checks the arrays following a sidecar's header against the DB they were
+// skimmed from, so that no block gets read from past the end of the DB and no
+// vendor's devices lie outside of the device arrays
+int uhwi_db_sidecar_valid(const char* at, const uhwi_db_sidecar_hdr* hdr,
+                          const uint64_t dbsize) {
+    const size_t vsz = hdr->nvendors * sizeof(uint32_t);
+
+    uint32_t first = 0;
+    uhwi_id_t prev = 0;
+
+    for (size_t vindex = 0; vindex <= hdr->nvendors; vindex++) {
+        uint32_t next = 0;
+        memcpy(&next, at + 2 * vsz + vindex * sizeof(uint32_t),
+               sizeof(uint32_t));
+
+        if (next < first || next > hdr->ndevs)
+            return 0;
+
+        first = next;
+
+        if (vindex == hdr->nvendors)
+            break; // (there's one more first device index than vendors)
+
+        uint32_t off = 0;
+        uint32_t blen = 0;
+        uhwi_id_t id = 0;
+
+        memcpy(&off, at + vindex * sizeof(uint32_t), sizeof(uint32_t));
+        memcpy(&blen, at + vsz + vindex * sizeof(uint32_t), sizeof(uint32_t));
+        memcpy(&id, at + 3 * vsz + sizeof(uint32_t) + vindex * sizeof(uhwi_id_t),
+               sizeof(uhwi_id_t));
+
+        // (lookups rely on the ascending vendor order a skim guarantees)
+        if ((uint64_t)off + blen > dbsize || (vindex > 0 && id <= prev))
+            return 0;
+
+        prev = id;
+    }
+
+    return 1;
+}
+
+// returns -1 if the sidecar is missing or unusable (with UHWI_ERRNO_NO_MEM if
+// out of memory, the DB's arrays might be half-allocated then)
+int uhwi_db_sidecar_load(uhwi_db* db, const char* path,
+                         const uint64_t fingerprint, const uint64_t dbsize) {
+    const int fd = open(path, O_RDONLY, 0);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0 ||
+        (size_t)st.st_size < sizeof(uhwi_db_sidecar_hdr)) {
+        if (fd >= 0)
+            close(fd);
+
+        return -1;
+    }
+
+    size_t len = 0;
+    char* buf = uhwi_db_slurp_fd(fd, (size_t)st.st_size, &len);
+
+    close(fd);
+
+    // (it might have shrunk since the fstat())
+    if (!buf || len < sizeof(uhwi_db_sidecar_hdr)) {
+        uhwi_mem_free(buf);
+        return -1;
+    }
+
+    uhwi_db_sidecar_hdr hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    const size_t vsz = hdr.nvendors * sizeof(uint32_t);
+    const char* at = buf + sizeof(hdr);
+
+    // the device count is the last of the first device indices
+    uint32_t ndevs = 0;
+
+    if (len == UHWI_DB_SIDECAR_LEN(hdr.nvendors))
+        memcpy(&ndevs, at + 3 * vsz, sizeof(uint32_t));
+
+    // missing, outdated, corrupt or written by another version
+    if (len != UHWI_DB_SIDECAR_LEN(hdr.nvendors) ||
+        memcmp(hdr.magic, UHWI_DB_SIDECAR_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != UHWI_DB_SIDECAR_VERSION ||
+        hdr.fingerprint != fingerprint || ndevs != hdr.ndevs ||
+        !uhwi_db_sidecar_valid(at, &hdr, dbsize)) {
+        uhwi_mem_free(buf);
+        return -1;
+    }
+
+    if (uhwi_db_skim_alloc(db, hdr.nvendors, hdr.ndevs) < 0) {
+        uhwi_mem_free(buf);
+        return -1;
+    }
+
+    memcpy(db->block_off, at, vsz);
+    memcpy(db->block_len, at + vsz, vsz);
+    memcpy(db->vendor_first, at + 2 * vsz, vsz + sizeof(uint32_t));
+    memcpy(db->vendor_ids, at + 3 * vsz + sizeof(uint32_t),
+           hdr.nvendors * sizeof(uhwi_id_t));
+
+    uhwi_mem_free(buf);
+    return 0;
+}
+
+// writes the sidecar next to its final path and renames it over, so that
+// concurrent readers only ever see a complete file (failures are ignored, the
+// sidecar is merely an optimization)
+void uhwi_db_sidecar_store(const uhwi_db* db, const char* path,
+                           const uint64_t fingerprint) {
+    if (mkdir(UHWI_DISK_CACHE_DIR, 0755) < 0 && errno != EEXIST)
+        return;
+
+    // (same as the disk cache, never a file that might have been planted)
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    const int fd = mkstemp(tmp);
+
+    if (fd < 0)
+        return;
+
+    if (fchmod(fd, 0644) < 0) {
+        close(fd);
+        unlink(tmp);
+
+        return;
+    }
+
+    uhwi_db_sidecar_hdr hdr;
+    memset(&hdr, 0, sizeof(uhwi_db_sidecar_hdr));
+
+    memcpy(hdr.magic, UHWI_DB_SIDECAR_MAGIC, sizeof(hdr.magic));
+    hdr.version = UHWI_DB_SIDECAR_VERSION;
+    hdr.fingerprint = fingerprint;
+
+    hdr.nvendors = (uint32_t)db->nvendors;
+    hdr.ndevs = (uint32_t)db->ndevs;
+
+    const size_t vsz = db->nvendors * sizeof(uint32_t);
+
+    const int rc = (write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+                    write(fd, db->block_off, vsz) == (ssize_t)vsz &&
+                    write(fd, db->block_len, vsz) == (ssize_t)vsz &&
+                    write(fd, db->vendor_first, vsz + sizeof(uint32_t)) ==
+                    (ssize_t)(vsz + sizeof(uint32_t)) &&
+                    write(fd, db->vendor_ids, db->nvendors * sizeof(uhwi_id_t)) ==
+                    (ssize_t)(db->nvendors * sizeof(uhwi_id_t))) ? 0 : -1;
+
+    if (close(fd) < 0 || rc < 0 || rename(tmp, path) < 0)
+        unlink(tmp);
+}
+
+#undef UHWI_DB_SIDECAR_LEN
+
+// opens a lone DB file with UHWI_DB_SKIM, NULL if it can't be skimmed (the
+// regular way then either parses it in full or fails) or with
+// UHWI_ERRNO_NO_MEM if out of memory
+uhwi_db* uhwi_db_open_skim(const char* path, const int flags) {
+    const int fd = open(path, O_RDONLY, 0);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0)
+            close(fd);
+
+        return NULL;
+    }
+
+    uhwi_db* db = uhwi_mem_alloc(sizeof(uhwi_db));
+
+    if (!db) {
+        close(fd);
+
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+
+    memset(db, 0, sizeof(uhwi_db));
+
+    // a skimmed DB is decoded lazily, just more so
+    db->flags = flags | UHWI_DB_LAZY;
+    db->fd = fd;
+
+    if (uhwi_strpool_init(&db->strings) < 0) {
+        uhwi_db_close(db);
+        return NULL;
+    }
+
+    // (taken from the open file, so that a DB replaced in the meantime doesn't
+    // get the offsets of the previous one)
+    uint64_t fingerprint = uhwi_db_stat_hash(UHWI_FNV1A64_INIT, &st);
+    fingerprint = fingerprint ? fingerprint : 1;
+
+    char sidecar[256];
+    uhwi_db_sidecar_path(path, sidecar, sizeof(sidecar));
+
+    if (flags & UHWI_DB_SIDECAR) {
+        if (uhwi_db_sidecar_load(db, sidecar, fingerprint,
+                                 (uint64_t)st.st_size) == 0)
+            return db;
+
+        // (a half-allocated DB can't be skimmed anymore)
+        if (uhwi_last_errno == UHWI_ERRNO_NO_MEM) {
+            uhwi_db_close(db);
+            return NULL;
+        }
+    }
+
+    size_t len = 0;
+    char* buf = uhwi_db_slurp_fd(fd, (size_t)st.st_size, &len);
+
+    const int skimmed = buf ? uhwi_db_skim(db, buf, len) : -1;
+    uhwi_mem_free(buf);
+
+    if (skimmed <= 0) {
+        uhwi_db_close(db);
+        return NULL;
+    }
+
+    if (flags & UHWI_DB_SIDECAR)
+        uhwi_db_sidecar_store(db, sidecar, fingerprint);
+
+    return db;
+}
+
+//
+// parallel parsing (UHWI_DB_PARALLEL)
+//
+
+size_t uhwi_db_parse_threads = 0;
+
+// whether a DB line holds a vendor ID and name, the 4 digits are followed by
+// a blank (unlike the "C xx" lines of the classification section)
+#define UHWI_DB_IS_VENDOR_LINE(line) \
+    (UHWI_IS_HEX((line)[0]) && UHWI_IS_HEX((line)[1]) && \
+     UHWI_IS_HEX((line)[2]) && UHWI_IS_HEX((line)[3]) && (line)[4] == ' ')
+
+// a slice of the DB file made of whole vendor blocks, scanned & indexed on its
+// own thread
+typedef struct {
+    const char* buf;
+    size_t len;
+    /// offset of the chunk within the file
+    uint32_t base;
+
+    /// whether the chunk's lines came in ascending ID order (only then it gets
+    /// indexed), -1 if the chunk ran out of memory
+    int sorted;
+    uhwi_db db;
+
+    pthread_t thread;
+    int started;
+} uhwi_db_chunk;
+
+// returns the first vendor line past the one from points into (or end)
+const char* uhwi_db_next_vendor(const char* from, const char* end) {
+    while (from < end) {
+        const char* nl = memchr(from, '\n', (size_t)(end - from));
+
+        if (!nl)
+            break;
+
+        from = nl + 1;
+
+        // (the whole buffer is NUL-terminated, so peeking past end is fine)
+        if (from < end && UHWI_DB_IS_VENDOR_LINE(from))
+            return from;
+    }
+
+    return end;
+}
+
+void* uhwi_db_parse_chunk(void* arg) {
+    uhwi_db_chunk* chunk = arg;
+
+    uhwi_db_lines lines;
+    memset(&lines, 0, sizeof(lines));
+
+    chunk->sorted = uhwi_db_scan(&lines, chunk->buf, chunk->len, chunk->base);
+
+    // (the indexing frees the lines on its own)
+    const int indexed = chunk->sorted > 0 && lines.nvlines > 0;
+
+    if (indexed && uhwi_strpool_init(&chunk->db.strings) == 0)
+        chunk->sorted = (uhwi_db_index(&chunk->db, &lines, 1) < 0) ? -1 : 1;
+    else {
+        if (indexed)
+            chunk->sorted = -1; // out of memory
+
+        uhwi_mem_free(lines.vlines);
+        uhwi_mem_free(lines.dlines);
+    }
+
+    return NULL;
+}
+
+// lays the chunks' indexes out back to back as the DB's index, returns 0 (with
+// the DB left untouched) unless every vendor comes in ascending ID order, -1 if
+// out of memory
+int uhwi_db_merge_chunks(uhwi_db* db, const uhwi_db_chunk* chunks,
+                         const size_t nchunks) {
+    const uhwi_db* prev = NULL;
+
+    size_t nvendors = 0;
+    size_t ndevs = 0;
+
+    for (size_t index = 0; index < nchunks; index++) {
+        const uhwi_db* cdb = &chunks[index].db;
+
+        if (chunks[index].sorted < 0) {
+            // (the error was set on the chunk's own thread)
+            uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+            return -1;
+        }
+        else if (!chunks[index].sorted)
+            return 0;
+        else if (cdb->nvendors == 0)
+            continue;
+
+        if (prev && prev->vendor_ids[prev->nvendors - 1] >= cdb->vendor_ids[0])
+            return 0;
+
+        nvendors += cdb->nvendors;
+        ndevs += cdb->ndevs;
+
+        prev = cdb;
+    }
+
+    db->nvendors = nvendors;
+    db->vendor_ids = uhwi_mem_alloc(nvendors * sizeof(uhwi_id_t));
+    db->vendor_names = uhwi_mem_alloc(nvendors * sizeof(uhwi_str_t));
+    db->vendor_first = uhwi_mem_alloc((nvendors + 1) * sizeof(uint32_t));
+
+    db->ndevs = ndevs;
+    db->device_ids = uhwi_mem_alloc(ndevs * sizeof(uhwi_id_t));
+    db->device_names = uhwi_mem_alloc(ndevs * sizeof(uhwi_str_t));
+
+    // (whatever did get allocated goes away along with the DB)
+    if (!db->vendor_ids || !db->vendor_names || !db->vendor_first ||
+        !db->device_ids || !db->device_names) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    size_t vbase = 0;
+    size_t dbase = 0;
+
+    for (size_t index = 0; index < nchunks; index++) {
+        const uhwi_db* cdb = &chunks[index].db;
+
+        if (cdb->nvendors == 0)
+            continue;
+
+        // (names interned by several chunks end up in the pool more than once)
+        const uhwi_str_t delta = uhwi_strpool_append(&db->strings,
+                                                     &cdb->strings);
+
+        if (delta == UHWI_STR_NONE)
+            return -1;
+
+        memcpy(db->vendor_ids + vbase, cdb->vendor_ids,
+               cdb->nvendors * sizeof(uhwi_id_t));
+        memcpy(db->device_ids + dbase, cdb->device_ids,
+               cdb->ndevs * sizeof(uhwi_id_t));
+
+        for (size_t vindex = 0; vindex < cdb->nvendors; vindex++) {
+            const uhwi_str_t name = cdb->vendor_names[vindex];
+
+            db->vendor_names[vbase + vindex] = name ? name + delta : 0;
+            db->vendor_first[vbase + vindex] = (uint32_t)(dbase +
+                                                   cdb->vendor_first[vindex]);
+        }
+
+        for (size_t dindex = 0; dindex < cdb->ndevs; dindex++) {
+            const uhwi_str_t name = cdb->device_names[dindex];
+            db->device_names[dbase + dindex] = name ? name + delta : 0;
+        }
+
+        vbase += cdb->nvendors;
+        dbase += cdb->ndevs;
+    }
+
+    db->vendor_first[nvendors] = (uint32_t)ndevs;
+    return 1;
+}
+
+// parses a lone DB file split into vendor-aligned chunks on as many threads,
+// returns 0 if it has to be parsed serially after all (too small to be worth
+// it or not sorted), -1 if out of memory
+int uhwi_db_parse_parallel(uhwi_db* db, const char* buf, const size_t len) {
+    size_t nchunks = uhwi_db_parse_threads;
+
+    if (nchunks == 0) {
+        const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nchunks = (ncpus > 0) ? (size_t)ncpus : 1;
+    }
+
+    if (nchunks > UHWI_DB_THREADS_MAX)
+        nchunks = UHWI_DB_THREADS_MAX;
+
+    if (nchunks > len / UHWI_DB_CHUNK_MIN)
+        nchunks = len / UHWI_DB_CHUNK_MIN;
+
+    if (nchunks < 2)
+        return 0;
+
+    uhwi_db_chunk chunks[UHWI_DB_THREADS_MAX];
+    memset(chunks, 0, nchunks * sizeof(uhwi_db_chunk));
+
+    // cut roughly equal slices, each extended up to the next vendor line (the
+    // classification section has none, so it all goes into a single chunk)
+    const char* end = buf + len;
+    const char* from = buf;
+
+    for (size_t index = 0; index < nchunks; index++) {
+        const char* to = end;
+
+        if (index + 1 < nchunks) {
+            const char* cut = buf + len / nchunks * (index + 1);
+            to = uhwi_db_next_vendor((cut > from) ? cut : from, end);
+        }
+
+        chunks[index].buf = from;
+        chunks[index].len = (size_t)(to - from);
+        chunks[index].base = (uint32_t)(from - buf);
+
+        from = to;
+    }
+
+    // the calling thread takes the first chunk itself, chunks that couldn't
+    // get a thread of their own are parsed right away as well
+    for (size_t index = 1; index < nchunks; index++)
+        chunks[index].started = pthread_create(&chunks[index].thread, NULL,
+                                               uhwi_db_parse_chunk,
+                                               &chunks[index]) == 0;
+
+    uhwi_db_parse_chunk(&chunks[0]);
+
+    for (size_t index = 1; index < nchunks; index++) {
+        if (chunks[index].started)
+            pthread_join(chunks[index].thread, NULL);
+        else
+            uhwi_db_parse_chunk(&chunks[index]);
+    }
+
+    const int merged = uhwi_db_merge_chunks(db, chunks, nchunks);
+
+    // (chunks are never lazy nor searched, this is all they hold)
+    for (size_t index = 0; index < nchunks; index++) {
+        uhwi_db* cdb = &chunks[index].db;
+
+        uhwi_mem_free(cdb->vendor_ids);
+        uhwi_mem_free(cdb->vendor_names);
+        uhwi_mem_free(cdb->vendor_first);
+
+        uhwi_mem_free(cdb->device_ids);
+        uhwi_mem_free(cdb->device_names);
+
+        uhwi_strpool_free(&cdb->strings);
+    }
+
+    return merged;
+}
+
+#undef UHWI_DB_IS_VENDOR_LINE
+
+// copies the next path of a colon-separated list of DB layers into layer
+// (UHWI_DB_PATH_MAX bytes), returns where the rest of the list starts or NULL
+// past its end
+const char* uhwi_db_next_layer(const char* list, char* layer) {
+    while (*list == UHWI_DB_LAYER_SEP)
+        list++;
+
+    if (*list == '\0')
+        return NULL;
+
+    const char* end = strchr(list, UHWI_DB_LAYER_SEP);
+
+    if (!end)
+        end = list + strlen(list);
+
+    size_t len = (size_t)(end - list);
+
+    if (len > UHWI_DB_PATH_MAX - 1)
+        len = UHWI_DB_PATH_MAX - 1;
+
+    memcpy(layer, list, len);
+    layer[len] = '\0';
+
+    return end;
+}
+
+// uhwi_db_open_ex() minus the tracing
+uhwi_db* uhwi_db_load(const char* path, const int flags) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    const char* list = path ? path : UHWI_PCI_DB_PATH_CONST;
+    char layer[UHWI_DB_PATH_MAX];
+
+    size_t nlayers = 0;
+
+    for (const char* next = list; (next = uhwi_db_next_layer(next, layer)); )
+        nlayers++;
+
+    // only a lone file can have its vendor blocks read back later on
+    const int lazy = (flags & (UHWI_DB_LAZY | UHWI_DB_SKIM)) && nlayers == 1;
+
+    if (lazy && (flags & UHWI_DB_SKIM)) {
+        uhwi_db_next_layer(list, layer);
+        uhwi_db* db = uhwi_db_open_skim(layer, flags);
+
+        if (db || uhwi_last_errno == UHWI_ERRNO_NO_MEM)
+            return db;
+
+        // unsorted (or missing) files go the regular way
+    }
+
+    // a lone file that gets parsed as a whole may be split between threads
+    const int parallel = (flags & UHWI_DB_PARALLEL) && nlayers == 1 && !lazy;
+
+    // every layer is parsed into the same set of lines, which then get merged
+    // into a single index, so lookups never have to go through the layers
+    char** bufs = uhwi_mem_alloc((nlayers ? nlayers : 1) * sizeof(char*));
+    size_t nbufs = 0;
+
+    if (!bufs) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+
+    uhwi_db_lines lines;
+    memset(&lines, 0, sizeof(lines));
+
+    int sorted = 1;
+    uint32_t base = 0;
+
+    int fd = -1;
+    int rc = 0;
+
+    for (const char* next = list;
+         rc == 0 && (next = uhwi_db_next_layer(next, layer)); ) {
+        size_t len = 0;
+        char* buf = uhwi_db_slurp(layer, &len, lazy ? &fd : NULL);
+
+        if (!buf) {
+            // a missing overlay just has nothing to add
+            if (uhwi_last_errno == UHWI_ERRNO_NO_MEM)
+                rc = -1;
+
+            continue;
+        }
+
+        const int scanned = parallel ? 1 : uhwi_db_scan(&lines, buf, len, base);
+
+        if (scanned < 0)
+            rc = -1;
+        else if (!scanned)
+            sorted = 0;
+
+        bufs[nbufs++] = buf;
+        base += (uint32_t)len;
+    }
+
+    if (rc == 0 && nbufs == 0) {
+        uhwi_mem_free(bufs);
+
+        uhwi_last_errno = UHWI_ERRNO_PCI_DB_NO_ACCESS;
+        return NULL;
+    }
+
+    // later layers override the IDs of earlier ones, which the fallback for
+    // unsorted files takes care of
+    if (nbufs > 1)
+        sorted = 0;
+
+    uhwi_db* db = (rc == 0) ? uhwi_mem_alloc(sizeof(uhwi_db)) : NULL;
+
+    if (db) {
+        memset(db, 0, sizeof(uhwi_db));
+
+        db->flags = flags & ~(UHWI_DB_LAZY | UHWI_DB_SKIM | UHWI_DB_SIDECAR);
+
+        if (lazy)
+            db->flags |= UHWI_DB_LAZY;
+        db->fd = fd;
+
+        rc = uhwi_strpool_init(&db->strings);
+    } else if (rc == 0) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        rc = -1;
+    }
+
+    if (rc == 0 && parallel)
+        rc = uhwi_db_parse_parallel(db, bufs[0], base);
+
+    // (unsorted files are left to the serial fallback)
+    if (rc == 0 && parallel) {
+        sorted = uhwi_db_scan(&lines, bufs[0], base, 0);
+        rc = (sorted < 0) ? -1 : 0;
+    }
+
+    if (rc == 0)
+        rc = uhwi_db_index(db, &lines, sorted);
+    else {
+        uhwi_mem_free(lines.vlines);
+        uhwi_mem_free(lines.dlines);
+    }
+
+    // (names are interned by now)
+    for (size_t index = 0; index < nbufs; index++)
+        uhwi_mem_free(bufs[index]);
+
+    uhwi_mem_free(bufs);
+
+    if (rc < 0) {
+        // (the DB owns the file only once it exists)
+        if (db)
+            uhwi_db_close(db);
+        else if (fd >= 0)
+            close(fd);
+
+        return NULL;
+    }
+
+    if (!(db->flags & UHWI_DB_LAZY)) {
+        // either never requested or impossible for this file, the DB won't
+        // grow anymore
+        if (fd >= 0)
+            close(fd);
+
+        db->fd = -1;
+        uhwi_strpool_seal(&db->strings);
+    }
+
+    return db;
+}
+
+uhwi_db* uhwi_db_open_ex(const char* path, const int flags) {
+    UHWI_TRACE_DB_OPEN_BEGIN(since, path ? path : UHWI_PCI_DB_PATH_CONST)
+
+    uhwi_db* db = uhwi_db_load(path, flags);
+
+    UHWI_TRACE_DB_OPEN_END(since, path ? path : UHWI_PCI_DB_PATH_CONST,
+                           db ? (int64_t)db->nvendors : -1)
+    return db;
+}
+
+uhwi_db* uhwi_db_open(const char* path) {
+    return uhwi_db_open_ex(path, 0);
+}
+
+// device IDs of a skimmed vendor are only known once its block is decoded (-1
+// if that ran out of memory)
+#define UHWI_DB_NEED_DEVICE_IDS(db, vindex) \
+    (((db)->flags & UHWI_DB_SKIM) ? uhwi_db_decode_vendor(db, vindex) : 0)
+
+size_t uhwi_db_find_vendor(const uhwi_db* db, const uhwi_id_t id) {
+    size_t lo = 0;
+    size_t hi = db->nvendors;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (db->vendor_ids[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (lo < db->nvendors && db->vendor_ids[lo] == id) ? lo : db->nvendors;
+}
+
+size_t uhwi_db_find_dev(const uhwi_db* db, const size_t vindex,
+                        const uhwi_id_t id) {
+    size_t lo = db->vendor_first[vindex];
+    size_t hi = db->vendor_first[vindex + 1];
+
+    const size_t last = hi;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (db->device_ids[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (lo < last && db->device_ids[lo] == id) ? lo : db->ndevs;
+}
+
+// formats the "vendor device" name out of already looked up DB indices (dindex
+// is db->ndevs for devices unknown to the DB), work & cursor may be provided to
+// carry the front-coding state over between calls, returns -1 (with buf holding
+// "Unknown") if the vendor's names couldn't be decoded
+int uhwi_db_format_name(uhwi_db* db, const size_t vindex, const size_t dindex,
+                        char* buf, const size_t max, char* work,
+                        uhwi_db_fc_cursor* cursor) {
+    // only now the vendor's device names are needed (a skimmed vendor's own
+    // name is in its block as well)
+    if ((dindex < db->ndevs || (db->flags & UHWI_DB_SKIM)) &&
+        uhwi_db_decode_vendor(db, vindex) < 0) {
+        snprintf(buf, max, "%s", "Unknown");
+        return -1;
+    }
+
+    // (the strings pointer might have been moved by the decoding)
+    const char* vname = db->strings.data + db->vendor_names[vindex];
+
+    if (max == 0)
+        return 0;
+
+    size_t len = strlen(vname);
+
+    if (len > max - 1)
+        len = max - 1;
+
+    memcpy(buf, vname, len);
+
+    if (dindex < db->ndevs && db->device_names[dindex] != 0) {
+        // TODO: support subvendor/subdevice IDs
+        char scratch[UHWI_DB_NAME_MAX + 1];
+
+        const size_t dlen = uhwi_db_decode_name(db, vindex, dindex,
+                                                work ? work : scratch, cursor);
+
+        if (len + 1 < max) {
+            // "vendor device"
+            const size_t cpsz = (len + 1 + dlen > max - 1) ? max - 2 - len : dlen;
+
+            buf[len++] = ' ';
+            memcpy(buf + len, work ? work : scratch, cpsz);
+
+            len += cpsz;
+        }
+    } // otherwise only the vendor name C string is known
+
+    buf[len] = '\0';
+    return 0;
+}
+
+int uhwi_db_strncpy_name(uhwi_db* db, const uhwi_id_t vendor,
+                         const uhwi_id_t device, char* buf, const size_t max) {
+    UHWI_TRACE_START(since)
+
+    const size_t vindex = db ? uhwi_db_find_vendor(db, vendor) : 0;
+    int found = 0;
+
+    if (!db || vindex >= db->nvendors)
+        snprintf(buf, max, "%s", "Unknown");
+    else if (UHWI_DB_NEED_DEVICE_IDS(db, vindex) < 0)
+        snprintf(buf, max, "%s", "Unknown"); // out of memory
+    else
+        found = uhwi_db_format_name(db, vindex,
+                                    uhwi_db_find_dev(db, vindex, device),
+                                    buf, max, NULL, NULL) == 0;
+
+    UHWI_TRACE_DB_LOOKUP(since, vendor, device, found)
+    return found;
+}
+
+int uhwi_db_cmp_dev_ptrs(const void* a, const void* b) {
+    const uhwi_dev* da = *(const uhwi_dev* const*)a;
+    const uhwi_dev* db = *(const uhwi_dev* const*)b;
+
+    const uint32_t ka = ((uint32_t)da->vendor << 16) | da->device;
+    const uint32_t kb = ((uint32_t)db->vendor << 16) | db->device;
+
+    return (ka > kb) - (ka < kb);
+}
+
+// returns -1 if some of the vendors couldn't be decoded (out of memory, their
+// devices are named "Unknown")
+int uhwi_db_resolve_ptrs(uhwi_db* db, uhwi_dev** devs, const size_t count) {
+    UHWI_TRACE_START(since)
+
+    int rc = 0;
+
+    // sort the devices by (vendor, device), so that both them and the DB can
+    // be walked in the same direction exactly once
+    qsort(devs, count, sizeof(uhwi_dev*), uhwi_db_cmp_dev_ptrs);
+
+    size_t vindex = 0;
+    size_t dindex = 0;
+
+    // vendor the devices cursor currently walks the range of
+    size_t dvendor = db->nvendors;
+
+    char work[UHWI_DB_NAME_MAX + 1];
+    uhwi_db_fc_cursor cursor = UHWI_DB_FC_CURSOR_INIT;
+
+    for (size_t index = 0; index < count; index++) {
+        uhwi_dev* current = devs[index];
+        const uhwi_dev* prev = (index > 0) ? devs[index - 1] : NULL;
+
+        if (prev && prev->vendor == current->vendor &&
+            prev->device == current->device) {
+            // fleets are full of identical devices, sorting made them neighbours
+            memcpy(current->name, prev->name, UHWI_DEV_NAME_MAX_LEN);
+            continue;
+        }
+
+        while (vindex < db->nvendors && db->vendor_ids[vindex] < current->vendor)
+            vindex++;
+
+        if (vindex >= db->nvendors || db->vendor_ids[vindex] != current->vendor) {
+            snprintf(current->name, UHWI_DEV_NAME_MAX_LEN, "%s", "Unknown");
+            continue;
+        }
+
+        if (dvendor != vindex) {
+            if (UHWI_DB_NEED_DEVICE_IDS(db, vindex) < 0) {
+                // (the next device of the vendor tries again)
+                snprintf(current->name, UHWI_DEV_NAME_MAX_LEN, "%s", "Unknown");
+                rc = -1;
+
+                continue;
+            }
+
+            // a new vendor starts its own range of devices
+            dvendor = vindex;
+            dindex = db->vendor_first[vindex];
+
+            cursor.index = (size_t)-1;
+        }
+
+        const size_t last = db->vendor_first[vindex + 1];
+
+        while (dindex < last && db->device_ids[dindex] < current->device)
+            dindex++;
+
+        if (uhwi_db_format_name(db, vindex,
+                                (dindex < last &&
+                                 db->device_ids[dindex] == current->device) ?
+                                dindex : db->ndevs,
+                                current->name, UHWI_DEV_NAME_MAX_LEN, work,
+                                &cursor) < 0)
+            rc = -1;
+    }
+
+    UHWI_TRACE_DB_RESOLVE(since, count)
+    return rc;
+}
+
+#undef UHWI_DB_NEED_DEVICE_IDS
+
+void uhwi_db_resolve_batch(uhwi_db* db, uhwi_dev* devs, const size_t count) {
+    if (!db || !devs || count == 0)
+        return;
+
+    // the caller's array is left in its original order, only the pointers to
+    // its elements get sorted
+    size_t pcount = 0;
+    uhwi_dev** ptrs = uhwi_mem_alloc(count * sizeof(uhwi_dev*));
+
+    if (!ptrs) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return;
+    }
+
+    for (size_t index = 0; index < count; index++)
+        if (devs[index].type == UHWI_DEV_PCI)
+            ptrs[pcount++] = &devs[index];
+
+    uhwi_db_resolve_ptrs(db, ptrs, pcount);
+    uhwi_mem_free(ptrs);
+}
+
+int uhwi_db_resolve_list(uhwi_db* db, uhwi_dev* first) {
+    size_t count = 0;
+
+    for (uhwi_dev* current = first; current; current = current->next)
+        count++;
+
+    if (!db || count == 0)
+        return 0;
+
+    uhwi_dev** ptrs = uhwi_mem_alloc(count * sizeof(uhwi_dev*));
+    size_t index = 0;
+
+    if (!ptrs) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    for (uhwi_dev* current = first; current; current = current->next)
+        ptrs[index++] = current;
+
+    const int rc = uhwi_db_resolve_ptrs(db, ptrs, count);
+    uhwi_mem_free(ptrs);
+
+    return rc;
+}
+
+size_t uhwi_db_size(const uhwi_db* db) {
+    if (!db)
+        return 0;
+
+    size_t result = sizeof(uhwi_db) + db->strings.cap;
+
+    result += db->nvendors * (sizeof(uhwi_id_t) + sizeof(uhwi_str_t));
+    result += (db->nvendors + 1) * sizeof(uint32_t);
+    result += db->ndevs * (sizeof(uhwi_id_t) + sizeof(uhwi_str_t));
+
+    if (db->flags & UHWI_DB_LAZY)
+        result += db->nvendors * (2 * sizeof(uint32_t) + sizeof(uint8_t)) +
+                  db->strings.nslots * sizeof(uhwi_str_t);
+
+    if (db->search)
+        result += sizeof(uhwi_db_search_index) +
+                  (UHWI_DB_SEARCH_BUCKETS + 1 +
+                   db->search->offsets[UHWI_DB_SEARCH_BUCKETS]) * sizeof(uint32_t);
+
+    return result;
+}
+
+//
+// name search
+//
+
+#define UHWI_DB_FOLD(cc) \
+    ((uint8_t)(((cc) >= 'A' && (cc) <= 'Z') ? ((cc) | 0x20) : (cc)))
+
+#define UHWI_DB_TRIGRAM_BUCKET(from) \
+    ((((uint32_t)UHWI_DB_FOLD((from)[0]) << 16 | \
+       (uint32_t)UHWI_DB_FOLD((from)[1]) << 8 | \
+       (uint32_t)UHWI_DB_FOLD((from)[2])) * 2654435761u) >> 16)
+
+// counts (postings is NULL) or records the buckets of every trigram of a name,
+// last remembers the last document each bucket has seen to skip repeats
+void uhwi_db_search_add(uhwi_db_search_index* index, uint32_t* last,
+                        uint32_t* fill, const char* name, const size_t len,
+                        const uint32_t doc) {
+    for (size_t offset = 0; offset + 3 <= len; offset++) {
+        const uint32_t bucket = UHWI_DB_TRIGRAM_BUCKET(name + offset);
+
+        if (last[bucket] == doc + 1)
+            continue;
+
+        last[bucket] = doc + 1;
+
+        if (fill)
+            index->postings[fill[bucket]++] = doc;
+        else
+            index->offsets[bucket + 1]++;
+    }
+}
+
+// walks every name in document order, either counting or recording trigrams,
+// returns -1 if a lazy DB's names couldn't be decoded
+int uhwi_db_search_pass(uhwi_db* db, uhwi_db_search_index* index,
+                         uint32_t* last, uint32_t* fill) {
+    char work[UHWI_DB_NAME_MAX + 1];
+    uint32_t doc = 0;
+
+    for (size_t vindex = 0; vindex < db->nvendors; vindex++) {
+        // (a lazy DB has to read device names in now, which might move the
+        // string pool around)
+        if (uhwi_db_decode_vendor(db, vindex) < 0)
+            return -1;
+
+        const char* vname = db->strings.data + db->vendor_names[vindex];
+        uhwi_db_search_add(index, last, fill, vname, strlen(vname), doc++);
+
+        uhwi_db_fc_cursor cursor = UHWI_DB_FC_CURSOR_INIT;
+
+        for (size_t dindex = db->vendor_first[vindex];
+             dindex < db->vendor_first[vindex + 1]; dindex++) {
+            const size_t len = uhwi_db_decode_name(db, vindex, dindex, work,
+                                                   &cursor);
+
+            uhwi_db_search_add(index, last, fill, work, len, doc++);
+        }
+    }
+
+    return 0;
+}
+
+void uhwi_db_search_free(uhwi_db_search_index* index) {
+    if (!index)
+        return;
+
+    uhwi_mem_free(index->offsets);
+    uhwi_mem_free(index->postings);
+    uhwi_mem_free(index);
+}
+
+// NULL if out of memory
+uhwi_db_search_index* uhwi_db_search_build(uhwi_db* db) {
+    uhwi_db_search_index* index = uhwi_mem_calloc(1, sizeof(uhwi_db_search_index));
+    uint32_t* last = uhwi_mem_calloc(UHWI_DB_SEARCH_BUCKETS, sizeof(uint32_t));
+    uint32_t* fill = uhwi_mem_alloc(UHWI_DB_SEARCH_BUCKETS * sizeof(uint32_t));
+
+    if (index)
+        index->offsets = uhwi_mem_calloc(UHWI_DB_SEARCH_BUCKETS + 1,
+                                         sizeof(uint32_t));
+
+    // count the postings of each bucket first, so that they can be laid out
+    // back to back without ever sorting them
+    int rc = -1;
+
+    if (index && index->offsets && last && fill)
+        rc = uhwi_db_search_pass(db, index, last, NULL);
+    else
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+
+    if (rc == 0) {
+        for (size_t bucket = 0; bucket < UHWI_DB_SEARCH_BUCKETS; bucket++)
+            index->offsets[bucket + 1] += index->offsets[bucket];
+
+        memcpy(fill, index->offsets, UHWI_DB_SEARCH_BUCKETS * sizeof(uint32_t));
+        memset(last, 0, UHWI_DB_SEARCH_BUCKETS * sizeof(uint32_t));
+
+        index->postings = uhwi_mem_alloc((index->offsets[UHWI_DB_SEARCH_BUCKETS] ?
+                                          index->offsets[UHWI_DB_SEARCH_BUCKETS] :
+                                          1) * sizeof(uint32_t));
+
+        if (index->postings)
+            rc = uhwi_db_search_pass(db, index, last, fill);
+        else {
+            uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+            rc = -1;
+        }
+    }
+
+    uhwi_mem_free(fill);
+    uhwi_mem_free(last);
+
+    if (rc < 0) {
+        uhwi_db_search_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+int uhwi_db_search_has(const uhwi_db_search_index* index, const uint32_t bucket,
+                       const uint32_t doc) {
+    size_t lo = index->offsets[bucket];
+    size_t hi = index->offsets[bucket + 1];
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (index->postings[mid] < doc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo < index->offsets[bucket + 1] && index->postings[lo] == doc;
+}
+
+// whether the (already case-folded) query occurs within the name
+int uhwi_db_search_match(const char* name, const size_t len,
+                         const uint8_t* query, const size_t qlen) {
+    for (size_t offset = 0; offset + qlen <= len; offset++) {
+        size_t index = 0;
+
+        while (index < qlen && UHWI_DB_FOLD(name[offset + index]) == query[index])
+            index++;
+
+        if (index == qlen)
+            return 1;
+    }
+
+    return 0;
+}
+
+size_t uhwi_db_search(uhwi_db* db, const char* query, uhwi_db_match* matches,
+                      const size_t max) {
+    if (!db || !query)
+        return 0;
+
+    const size_t qlen = strlen(query);
+
+    // names never get longer than this, neither does anything they contain
+    if (qlen == 0 || qlen > UHWI_DB_NAME_MAX)
+        return 0;
+
+    uint8_t folded[UHWI_DB_NAME_MAX + 1];
+
+    for (size_t index = 0; index < qlen; index++)
+        folded[index] = UHWI_DB_FOLD(query[index]);
+
+    if (!db->search)
+        db->search = uhwi_db_search_build(db);
+
+    if (!db->search)
+        return 0; // out of memory
+
+    const uhwi_db_search_index* index = db->search;
+    const uint32_t ndocs = (uint32_t)(db->nvendors + db->ndevs);
+
+    // candidates come from the shortest posting list of the query's trigrams
+    // (queries shorter than a trigram have to check every name), probing just
+    // the next shortest one already weeds out most of what the verification
+    // would otherwise decode for nothing
+    uint32_t shortest = UHWI_DB_SEARCH_BUCKETS;
+    uint32_t probe = UHWI_DB_SEARCH_BUCKETS;
+
+#define UHWI_DB_SEARCH_LEN(bucket) \
+    (index->offsets[(bucket) + 1] - index->offsets[bucket])
+
+    for (size_t offset = 0; offset + 3 <= qlen; offset++) {
+        const uint32_t bucket = UHWI_DB_TRIGRAM_BUCKET(query + offset);
+
+        if (bucket == shortest || bucket == probe)
+            continue;
+
+        if (shortest == UHWI_DB_SEARCH_BUCKETS ||
+            UHWI_DB_SEARCH_LEN(bucket) < UHWI_DB_SEARCH_LEN(shortest)) {
+            probe = shortest;
+            shortest = bucket;
+        } else if (probe == UHWI_DB_SEARCH_BUCKETS ||
+                   UHWI_DB_SEARCH_LEN(bucket) < UHWI_DB_SEARCH_LEN(probe))
+            probe = bucket;
+    }
+
+    const uint32_t* candidates = (shortest != UHWI_DB_SEARCH_BUCKETS) ?
+        &index->postings[index->offsets[shortest]] : NULL;
+    const size_t ncandidates = (shortest != UHWI_DB_SEARCH_BUCKETS) ?
+        UHWI_DB_SEARCH_LEN(shortest) : ndocs;
+
+#undef UHWI_DB_SEARCH_LEN
+
+    char work[UHWI_DB_NAME_MAX + 1];
+    uhwi_db_fc_cursor cursor = UHWI_DB_FC_CURSOR_INIT;
+
+    size_t vindex = 0;
+    size_t count = 0;
+
+    for (size_t cindex = 0; cindex < ncandidates; cindex++) {
+        const uint32_t doc = candidates ? candidates[cindex] : (uint32_t)cindex;
+
+        if (probe != UHWI_DB_SEARCH_BUCKETS &&
+            !uhwi_db_search_has(index, probe, doc))
+            continue;
+
+        // documents ascend, so does the vendor they belong to (vendor v is
+        // document vendor_first[v] + v, its devices follow)
+        while (vindex + 1 < db->nvendors &&
+               db->vendor_first[vindex + 1] + vindex + 1 <= doc) {
+            vindex++;
+            cursor.index = (size_t)-1;
+        }
+
+        const size_t vdoc = db->vendor_first[vindex] + vindex;
+        const char* name = work;
+        size_t len = 0;
+
+        if (doc == vdoc) {
+            name = db->strings.data + db->vendor_names[vindex];
+            len = strlen(name);
+        } else
+            len = uhwi_db_decode_name(db, vindex, doc - vindex - 1, work,
+                                      &cursor);
+
+        if (!uhwi_db_search_match(name, len, folded, qlen))
+            continue; // a hash collision or the trigrams are out of order
+
+        if (count < max) {
+            matches[count].vendor = db->vendor_ids[vindex];
+            matches[count].device = (doc == vdoc) ? 0 :
+                                    db->device_ids[doc - vindex - 1];
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+#undef UHWI_DB_TRIGRAM_BUCKET
+#undef UHWI_DB_FOLD
+
+// on_fail has to leave the loop, same as with APPEND_DB_LINE()
+#define INIT_DB_LIST_ENTRY(first, current, vid, did, cstr, on_fail) { \
+    uhwi_dev* entry = uhwi_mem_alloc(sizeof(uhwi_dev)); \
+    \
+    if (!entry) { \
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM; \
+        on_fail; \
+    } \
+    \
+    memset(entry, 0, sizeof(uhwi_dev)); \
+    \
+    entry->type = UHWI_DEV_PCI; \
+    entry->vendor = vid; \
+    entry->device = did; \
+    \
+    snprintf(entry->name, UHWI_DEV_NAME_MAX_LEN, "%s", cstr); \
+    \
+    if (current) \
+        current->next = entry; \
+    else \
+        first = entry; \
+    \
+    current = entry; \
+}
+
+uint64_t uhwi_db_fingerprint(const char* path) {
+    uint64_t hash = UHWI_FNV1A64_INIT;
+    size_t found = 0;
+
+    const char* next = path ? path : UHWI_PCI_DB_PATH_CONST;
+    char layer[UHWI_DB_PATH_MAX];
+
+    // an overlay appearing or going away changes the hash just the same
+    while ((next = uhwi_db_next_layer(next, layer))) {
+        struct stat st;
+
+        if (stat(layer, &st) < 0)
+            memset(&st, 0, sizeof(st));
+        else
+            found++;
+
+        hash = uhwi_db_stat_hash(hash, &st);
+    }
+
+    if (found == 0)
+        return 0;
+
+    return hash ? hash : 1;
+}
+
+uhwi_dev* uhwi_db_init(void) {
+    // every entry gets listed, so every one of them has to be parsed anyway
+    uhwi_db* db = uhwi_db_open_ex(NULL, UHWI_DB_PARALLEL);
+
+    if (!db)
+        return NULL;
+
+    uhwi_dev* first = NULL;
+    uhwi_dev* current = NULL;
+
+    char work[UHWI_DB_NAME_MAX + 1];
+    uhwi_db_fc_cursor cursor = UHWI_DB_FC_CURSOR_INIT;
+
+    int failed = 0;
+
+    // vendor entries are followed by their devices, just like in the DB file
+    for (size_t vindex = 0; vindex < db->nvendors && !failed; vindex++) {
+        INIT_DB_LIST_ENTRY(first, current, db->vendor_ids[vindex], 0,
+                           db->strings.data + db->vendor_names[vindex],
+                           { failed = 1; break; })
+
+        for (size_t dindex = db->vendor_first[vindex];
+             dindex < db->vendor_first[vindex + 1]; dindex++) {
+            uhwi_db_decode_name(db, vindex, dindex, work, &cursor);
+
+            INIT_DB_LIST_ENTRY(first, current, db->vendor_ids[vindex],
+                               db->device_ids[dindex], work,
+                               { failed = 1; break; })
+        }
+    }
+
+    uhwi_db_close(db);
+
+    if (failed) {
+        uhwi_clean_up(first);
+        return NULL;
+    }
+
+    return first;
+}
+
+#undef INIT_DB_LIST_ENTRY
+#undef APPEND_DB_LINE
+
+void uhwi_db_close(uhwi_db* db) {
+    if (!db)
+        return;
+
+    if (db->fd >= 0)
+        close(db->fd);
+
+    uhwi_mem_free(db->vendor_ids);
+    uhwi_mem_free(db->vendor_names);
+    uhwi_mem_free(db->vendor_first);
+
+    uhwi_mem_free(db->device_ids);
+    uhwi_mem_free(db->device_names);
+
+    uhwi_mem_free(db->block_off);
+    uhwi_mem_free(db->block_len);
+    uhwi_mem_free(db->decoded);
+
+    uhwi_db_search_free(db->search);
+
+    uhwi_strpool_free(&db->strings);
+    uhwi_mem_free(db);
+}
+
+#endif
@@ -0,0 +1,260 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifdef UHWI_ENABLE_PCI_DB
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#include "uhwi_internal.h"
+
+#ifndef UHWI_DB_WATCH_INTERVAL_MS
+#define UHWI_DB_WATCH_INTERVAL_MS 1000
+#endif
+
+/// how often a reload checks whether the readers of the old version are gone
+#define UHWI_DB_GRACE_POLL_NS 50000
+
+struct uhwi_db_shared {
+    /// read-side critical section counters, a reader enters the one phase
+    /// currently points to (kept on a cache line of their own)
+    size_t readers[2] __attribute__((aligned(64)));
+    unsigned int phase;
+
+    /// currently published DB version
+    uhwi_db* current __attribute__((aligned(64)));
+
+    /// fingerprint of the file the current version was parsed from
+    uint64_t fingerprint;
+
+    /// DB file path (NULL for the default one) and uhwi_db_flags_t flags
+    char* path;
+    int flags;
+
+    /// serializes reloads, readers never take it
+    pthread_mutex_t reload_lock;
+
+    /// background watcher (UHWI_DB_WATCH)
+    pthread_t watcher;
+    int watching;
+    int stopping;
+
+    pthread_mutex_t watch_lock;
+    pthread_cond_t watch_cond;
+};
+
+// read side: no locks, no waiting, just a counter of the current phase
+#define UHWI_DB_READ_BEGIN(shared, db, phase) { \
+    phase = __atomic_load_n(&(shared)->phase, __ATOMIC_SEQ_CST) & 1; \
+    __atomic_add_fetch(&(shared)->readers[phase], 1, __ATOMIC_SEQ_CST); \
+    db = __atomic_load_n(&(shared)->current, __ATOMIC_SEQ_CST); \
+}
+
+#define UHWI_DB_READ_END(shared, phase) \
+    __atomic_sub_fetch(&(shared)->readers[phase], 1, __ATOMIC_RELEASE);
+
+// waits until every reader which might still see the previous version has
+// left its critical section: the phase is flipped so that new readers go to
+// the other counter, then the old counter is waited out, and the same is done
+// once more for the readers which loaded the phase right before the flip
+void uhwi_db_shared_synchronize(uhwi_db_shared* shared) {
+    for (size_t pass = 0; pass < 2; pass++) {
+        const unsigned int phase = __atomic_fetch_add(&shared->phase, 1,
+                                                      __ATOMIC_SEQ_CST) & 1;
+
+        // (sleeping rather than spinning keeps the counters' cache line from
+        // bouncing between the readers and this thread)
+        const struct timespec backoff = { 0, UHWI_DB_GRACE_POLL_NS };
+
+        while (__atomic_load_n(&shared->readers[phase], __ATOMIC_SEQ_CST) > 0)
+            nanosleep(&backoff, NULL);
+    }
+}
+
+int uhwi_db_shared_reload(uhwi_db_shared* shared, const int force) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    if (!shared)
+        return -1;
+
+    pthread_mutex_lock(&shared->reload_lock);
+
+    // taken before parsing, so that a change racing with it is picked up by
+    // the next reload instead of being missed
+    const uint64_t fingerprint = uhwi_db_fingerprint(shared->path);
+
+    if (fingerprint == 0 || (!force && fingerprint == shared->fingerprint)) {
+        // unchanged, or gone for the moment (e.g. mid-upgrade)
+        pthread_mutex_unlock(&shared->reload_lock);
+        return 0;
+    }
+
+    // lazily decoded vendors would be written to by concurrent readers
+    uhwi_db* db = uhwi_db_open_ex(shared->path,
+                                  shared->flags & ~(UHWI_DB_LAZY | UHWI_DB_SKIM |
+                                                    UHWI_DB_WATCH));
+
+    if (!db) {
+        // readers keep using the previous version
+        pthread_mutex_unlock(&shared->reload_lock);
+        return -1;
+    }
+
+    uhwi_db* old = __atomic_exchange_n(&shared->current, db, __ATOMIC_SEQ_CST);
+    shared->fingerprint = fingerprint;
+
+    uhwi_db_shared_synchronize(shared);
+    uhwi_db_close(old);
+
+    pthread_mutex_unlock(&shared->reload_lock);
+    return 1;
+}
+
+void* uhwi_db_shared_watch(void* userdata) {
+    uhwi_db_shared* shared = userdata;
+
+    pthread_mutex_lock(&shared->watch_lock);
+
+    while (!shared->stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_sec += UHWI_DB_WATCH_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (UHWI_DB_WATCH_INTERVAL_MS % 1000) * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&shared->watch_cond, &shared->watch_lock,
+                               &deadline);
+
+        if (!shared->stopping)
+            uhwi_db_shared_reload(shared, 0);
+    }
+
+    pthread_mutex_unlock(&shared->watch_lock);
+    return NULL;
+}
+
+uhwi_db_shared* uhwi_db_shared_open(const char* path, const int flags) {
+    uhwi_db_shared* shared = uhwi_mem_alloc_aligned(sizeof(uhwi_db_shared), 64);
+
+    if (!shared) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+
+    memset(shared, 0, sizeof(uhwi_db_shared));
+
+    if (path) {
+        const size_t len = strlen(path);
+
+        shared->path = uhwi_mem_alloc(len + 1);
+
+        if (!shared->path) {
+            uhwi_mem_free(shared);
+
+            uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+            return NULL;
+        }
+
+        memcpy(shared->path, path, len + 1);
+    }
+
+    shared->flags = flags;
+
+    pthread_mutex_init(&shared->reload_lock, NULL);
+    pthread_mutex_init(&shared->watch_lock, NULL);
+    pthread_cond_init(&shared->watch_cond, NULL);
+
+    if (uhwi_db_shared_reload(shared, 1) <= 0) {
+        if (uhwi_last_errno == UHWI_ERRNO_OK)
+            uhwi_last_errno = UHWI_ERRNO_PCI_DB_NO_ACCESS;
+
+        uhwi_db_shared_close(shared);
+        return NULL;
+    }
+
+    if ((flags & UHWI_DB_WATCH) &&
+        pthread_create(&shared->watcher, NULL, uhwi_db_shared_watch,
+                       shared) == 0)
+        shared->watching = 1;
+
+    return shared;
+}
+
+int uhwi_db_shared_strncpy_name(uhwi_db_shared* shared, const uhwi_id_t vendor,
+                                const uhwi_id_t device, char* buf,
+                                const size_t max) {
+    uhwi_db* db = NULL;
+    unsigned int phase = 0;
+
+    UHWI_DB_READ_BEGIN(shared, db, phase)
+
+    const int rc = uhwi_db_strncpy_name(db, vendor, device, buf, max);
+
+    UHWI_DB_READ_END(shared, phase)
+    return rc;
+}
+
+void uhwi_db_shared_resolve_batch(uhwi_db_shared* shared, uhwi_dev* devs,
+                                  const size_t count) {
+    uhwi_db* db = NULL;
+    unsigned int phase = 0;
+
+    UHWI_DB_READ_BEGIN(shared, db, phase)
+
+    uhwi_db_resolve_batch(db, devs, count);
+
+    UHWI_DB_READ_END(shared, phase)
+}
+
+void uhwi_db_shared_close(uhwi_db_shared* shared) {
+    if (!shared)
+        return;
+
+    if (shared->watching) {
+        pthread_mutex_lock(&shared->watch_lock);
+
+        shared->stopping = 1;
+        pthread_cond_signal(&shared->watch_cond);
+
+        pthread_mutex_unlock(&shared->watch_lock);
+        pthread_join(shared->watcher, NULL);
+    }
+
+    // there must not be any readers left by now
+    uhwi_db_close(shared->current);
+
+    pthread_cond_destroy(&shared->watch_cond);
+    pthread_mutex_destroy(&shared->watch_lock);
+    pthread_mutex_destroy(&shared->reload_lock);
+
+    uhwi_mem_free(shared->path);
+    uhwi_mem_free(shared);
+}
+#endif
@@ -0,0 +1,433 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+//
+// declarations shared between libuhwi's translation units, not to be included
+// by library users
+//
+
+#include <stddef.h>
+
+#include "uhwi.h"
+
+// per thread, so that concurrent callers don't clobber each other's errors
+extern __thread uhwi_errno_t uhwi_last_errno;
+
+/// whether the device type is one of the buses, which are what UHWI_DEV_NULL
+/// stands for
+#define UHWI_DEV_IS_BUS(type) \
+    ((type) == UHWI_DEV_PCI || (type) == UHWI_DEV_USB)
+
+/// whether an enumeration of the specified type lists devices of another one
+#define UHWI_DEV_TYPE_INCLUDES(type, of) \
+    ((type) == (of) || ((type) == UHWI_DEV_NULL && UHWI_DEV_IS_BUS(of)))
+
+/// CLOCK_MONOTONIC timestamp, in nanoseconds
+uint64_t uhwi_now_ns(void);
+
+// deadline of the enumeration the calling thread is in (0 if there's none),
+// set by the *_ex() entry points
+extern __thread uint64_t uhwi_deadline_ns;
+
+/// whether the deadline of the current enumeration (if any) has passed
+int uhwi_deadline_passed(void);
+
+/// milliseconds left until the deadline (at least 1), or the fallback value if
+/// there is no deadline
+unsigned int uhwi_deadline_left_ms(const unsigned int fallback);
+
+//
+// trace points (uhwi_trace.c), compiled out unless UHWI_ENABLE_TRACE is set
+//
+
+#ifdef UHWI_ENABLE_TRACE
+// USDT probes come from systemtap's header, where there is one
+# if defined(__linux__) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#   include <sys/sdt.h>
+#   define UHWI_USDT(...) STAP_PROBEV(uhwi, __VA_ARGS__);
+#  endif
+# endif
+
+# ifndef UHWI_USDT
+#  define UHWI_USDT(...)
+# endif
+
+// the user's callback (NULL if there's none), only a hint outside of
+// uhwi_trace_emit(), which loads it along with its userdata
+extern uhwi_trace_cb uhwi_trace_fn;
+
+# define UHWI_TRACE_ENABLED() \
+    (__atomic_load_n(&uhwi_trace_fn, __ATOMIC_RELAXED) != NULL)
+
+/// hands an event out to the user's callback, since is when the span (or the
+/// read) started
+void uhwi_trace_emit(const uhwi_trace_point_t point, const uint64_t since,
+                     const uhwi_dev_t type, const char* label, const char* attr,
+                     const uhwi_id_t vendor, const uhwi_id_t device,
+                     const int64_t result);
+
+/// declares since, the start of a span (only timed when there's a callback)
+# define UHWI_TRACE_START(since) \
+    const uint64_t since = UHWI_TRACE_ENABLED() ? uhwi_now_ns() : 0;
+
+# define UHWI_TRACE_EMIT(point, since, type, label, attr, vendor, device, \
+                         result) { \
+    if (UHWI_TRACE_ENABLED()) \
+        uhwi_trace_emit(point, since, type, label, attr, vendor, device, \
+                        (int64_t)(result)); \
+}
+
+# define UHWI_TRACE_DEV_BEGIN(since, type, label) \
+    UHWI_TRACE_START(since) \
+    UHWI_USDT(dev__begin, (int)(type), label) \
+    UHWI_TRACE_EMIT(UHWI_TRACE_DEV_BEGIN, since, type, label, NULL, 0, 0, 0)
+
+/// dev is NULL if the device was skipped
+# define UHWI_TRACE_DEV_END(since, type, label, dev) { \
+    const uhwi_dev* traced = (dev); \
+    \
+    UHWI_USDT(dev__end, (int)(type), label, traced ? traced->vendor : 0, \
+              traced ? traced->device : 0, traced != NULL) \
+    UHWI_TRACE_EMIT(UHWI_TRACE_DEV_END, since, type, label, NULL, \
+                    traced ? traced->vendor : 0, traced ? traced->device : 0, \
+                    traced != NULL) \
+}
+
+# define UHWI_TRACE_ATTR(since, type, label, attr, len) { \
+    UHWI_USDT(attr__read, label, attr, (int64_t)(len)) \
+    UHWI_TRACE_EMIT(UHWI_TRACE_ATTR, since, type, label, attr, 0, 0, len) \
+}
+
+# define UHWI_TRACE_DB_OPEN_BEGIN(since, path) \
+    UHWI_TRACE_START(since) \
+    UHWI_USDT(db__open__begin, path) \
+    UHWI_TRACE_EMIT(UHWI_TRACE_DB_OPEN_BEGIN, since, UHWI_DEV_NULL, path, \
+                    NULL, 0, 0, 0)
+
+# define UHWI_TRACE_DB_OPEN_END(since, path, nvendors) { \
+    UHWI_USDT(db__open__end, path, (int64_t)(nvendors)) \
+    UHWI_TRACE_EMIT(UHWI_TRACE_DB_OPEN_END, since, UHWI_DEV_NULL, path, \
+                    NULL, 0, 0, nvendors) \
+}
+
+# define UHWI_TRACE_DB_LOOKUP(since, vendor, device, found) { \
+    UHWI_USDT(db__lookup, vendor, device, found) \
+    UHWI_TRACE_EMIT(UHWI_TRACE_DB_LOOKUP, since, UHWI_DEV_NULL, NULL, NULL, \
+                    vendor, device, found) \
+}
+
+# define UHWI_TRACE_DB_RESOLVE(since, count) { \
+    UHWI_USDT(db__resolve, (int64_t)(count)) \
+    UHWI_TRACE_EMIT(UHWI_TRACE_DB_RESOLVE, since, UHWI_DEV_NULL, NULL, NULL, \
+                    0, 0, count) \
+}
+#else
+// not even the clock is read
+# define UHWI_TRACE_START(since)
+# define UHWI_TRACE_DEV_BEGIN(since, type, label)
+# define UHWI_TRACE_DEV_END(since, type, label, dev)
+# define UHWI_TRACE_ATTR(since, type, label, attr, len)
+# define UHWI_TRACE_DB_OPEN_BEGIN(since, path)
+# define UHWI_TRACE_DB_OPEN_END(since, path, nvendors)
+# define UHWI_TRACE_DB_LOOKUP(since, vendor, device, found)
+# define UHWI_TRACE_DB_RESOLVE(since, count)
+#endif
+
+//
+// heap allocations through the user's allocator (uhwi_alloc.c)
+//
+
+void* uhwi_mem_alloc(const size_t size);
+
+void* uhwi_mem_calloc(const size_t count, const size_t size);
+
+/// align must be a power of two
+void* uhwi_mem_alloc_aligned(const size_t size, const size_t align);
+
+/// like realloc(), NULL allocates a new block
+void* uhwi_mem_realloc(void* ptr, const size_t size);
+
+void uhwi_mem_free(void* ptr);
+
+/// fills in the memory counters of the stats
+void uhwi_mem_stats(uhwi_stats* stats);
+
+void uhwi_mem_stats_reset(void);
+
+//
+// bulk line scanning & ID decoding (uhwi_scan.c)
+//
+
+typedef enum {
+    UHWI_SCAN_AUTO = 0,
+
+    UHWI_SCAN_SCALAR,
+    UHWI_SCAN_SSE2,
+    UHWI_SCAN_AVX2
+} uhwi_scan_impl_t;
+
+/// newline scanner implementation in use (picked on first use if AUTO)
+extern uhwi_scan_impl_t uhwi_scan_impl;
+
+/// forces a specific newline scanner implementation (used by uhwibench)
+void uhwi_scan_select(const uhwi_scan_impl_t impl);
+
+/// finds every occurrence of a byte within a 64-byte block, as a bit mask
+typedef uint64_t (*uhwi_scan_fn)(const char* block, const char needle);
+
+/// iterator over the lines of a buffer, newlines are located 64 bytes at a
+/// time via SIMD compare masks
+typedef struct {
+    /// the implementation selected when the iterator was started
+    uhwi_scan_fn scan;
+
+    const char* block;
+    const char* end;
+    const char* line;
+
+    /// newline positions within the current block yet to be handed out
+    uint64_t mask;
+} uhwi_lines;
+
+void uhwi_lines_init(uhwi_lines* it, const char* buf, const size_t len);
+
+/// yields the next line (without its newline), returns 0 past the last one
+int uhwi_lines_next(uhwi_lines* it, const char** linep, const char** eolp);
+
+/// hex digit values plus one (0 for anything that isn't a hex digit)
+extern const uint8_t uhwi_hex_digits[256];
+
+#define UHWI_IS_HEX(cc) (uhwi_hex_digits[(uint8_t)(cc)] != 0)
+
+/// decodes a 4-digit hexadecimal ID (optionally 0x-prefixed), at least 4 bytes
+/// past the prefix have to be readable
+uhwi_id_t uhwi_hex_id(const char* from, const int prefixed);
+
+//
+// string pool (uhwi_strpool.c)
+//
+
+typedef struct {
+    /// pool contents, offset 0 always holds the empty C string
+    char* data;
+    size_t len;
+    size_t cap;
+
+    /// open addressing interning table of pool offsets (0 marks a free slot),
+    /// dropped once the pool is sealed
+    uhwi_str_t* slots;
+    size_t nslots;
+    size_t nstrs;
+} uhwi_strpool;
+
+/// offset returned by the pool when it couldn't grow
+#define UHWI_STR_NONE ((uhwi_str_t)UINT32_MAX)
+
+/// returns -1 if out of memory (the pool can still be freed then), every
+/// allocation failure of the pool sets UHWI_ERRNO_NO_MEM
+int uhwi_strpool_init(uhwi_strpool* pool);
+
+/// returns the offset of an existing equal C string or appends a new one
+/// (UHWI_STR_NONE if out of memory)
+uhwi_str_t uhwi_strpool_intern(uhwi_strpool* pool, const char* str,
+                               const size_t len);
+
+/// drops the interning table and trims the pool down to its contents
+void uhwi_strpool_seal(uhwi_strpool* pool);
+
+/// appends the contents of another pool without interning them (so the pool
+/// should be sealed afterwards), returns what to add to that pool's non-zero
+/// offsets for them to refer into this one (UHWI_STR_NONE if out of memory)
+uhwi_str_t uhwi_strpool_append(uhwi_strpool* pool, const uhwi_strpool* other);
+
+void uhwi_strpool_free(uhwi_strpool* pool);
+
+//
+// snapshots (uhwi_snapshot.c)
+//
+
+uhwi_snapshot* uhwi_snapshot_alloc(void);
+
+/// uhwi_dev_cb copying a device into the (uhwi_snapshot*) userdata
+int uhwi_snapshot_append(const uhwi_dev* dev, void* userdata);
+
+/// trims the records array and seals the string pool of an enumerated snapshot
+void uhwi_snapshot_finish(uhwi_snapshot* snap);
+
+/// copies the devices of the specified type (or all of them) into a new snapshot
+uhwi_snapshot* uhwi_snapshot_filter(const uhwi_snapshot* snap,
+                                    const uhwi_dev_t type);
+
+/// serializes the snapshot into the binary format, returns the amount of bytes
+/// it takes (nothing is written unless it fits into max bytes)
+size_t uhwi_snapshot_encode(const uhwi_snapshot* snap, void* into,
+                            const size_t max);
+
+/// maps a binary snapshot file which starts prefix_len (a multiple of 8) bytes
+/// in, the prefix itself is copied into the provided buffer
+uhwi_snapshot* uhwi_snapshot_load_prefixed(const char* path, void* prefix,
+                                           const size_t prefix_len);
+
+/// wraps a malloc()'ed binary snapshot, which is then freed along with it (or
+/// right away if it turns out to be invalid)
+uhwi_snapshot* uhwi_snapshot_adopt(void* data, const size_t len);
+
+//
+// enumeration results cache (uhwi_cache.c)
+//
+
+/// whether uhwi_cache_enable() turned caching on
+int uhwi_cache_enabled(void);
+
+/// FNV-1a over a block of memory, continuing from the specified hash
+uint64_t uhwi_fnv1a64(uint64_t hash, const void* data, const size_t len);
+
+#define UHWI_FNV1A64_INIT 0xcbf29ce484222325ULL
+
+/// where persistent snapshots and PCI DB sidecars are kept
+#ifndef UHWI_DISK_CACHE_DIR
+# ifdef __linux__
+#  define UHWI_DISK_CACHE_DIR "/run/uhwi"
+# else
+#  define UHWI_DISK_CACHE_DIR "/var/run/uhwi"
+# endif
+#endif
+
+#ifdef UHWI_ENABLE_PCI_DB
+/// resolves the names of every device of the linked list in a single pass,
+/// returns -1 if out of memory
+int uhwi_db_resolve_list(uhwi_db* db, uhwi_dev* first);
+
+/// threads UHWI_DB_PARALLEL parses a DB file on (0 = one per online CPU)
+extern size_t uhwi_db_parse_threads;
+
+/// cheap fingerprint of a DB file (inode, size & mtime) at the specified path
+/// (or the default one if NULL), 0 if it can't be accessed
+uint64_t uhwi_db_fingerprint(const char* path);
+
+/// where the UHWI_DB_SIDECAR offsets of the DB file at path are kept
+void uhwi_db_sidecar_path(const char* path, char* buf, const size_t max);
+#else
+// the PCI DB is compiled out, hence there is never anything to close
+#define uhwi_db_close(db) ((void)(db))
+
+#define uhwi_db_fingerprint(path) ((void)(path), (uint64_t)0)
+#endif
+
+//
+// enumeration loops (uhwi.c)
+//
+
+#ifdef __FreeBSD__
+/// pci(4) control device, whose generation number the cache probes as well
+#define UHWI_PCI_DEV_PATH_CONST "/dev/pci"
+#endif
+
+/// db (if not NULL) is used to name PCI devices as they are enumerated
+int uhwi_foreach_pci_dev(uhwi_dev_cb cb, void* userdata, uhwi_db* db);
+int uhwi_foreach_usb_dev(uhwi_dev_cb cb, void* userdata);
+
+/// system devices (CPUs, memory blocks & block devices), Linux-only (fails
+/// with UHWI_ERRNO_UNSUPPORTED elsewhere)
+int uhwi_foreach_sys_dev(const uhwi_dev_t type, uhwi_dev_cb cb, void* userdata);
+
+//
+// device addresses (uhwi_addr.c)
+//
+
+/// reads a number in the specified base, NULL if there are no digits at all or
+/// it doesn't fit into 32 bits
+const char* uhwi_addr_parse_num(const char* from, const unsigned int base,
+                                uint32_t* value);
+
+#ifdef __linux__
+//
+// table-driven sysfs reader (uhwi_sysfs.c)
+//
+
+/// what an attribute is read into
+typedef enum {
+    /// nothing, the attribute merely has to exist
+    UHWI_SYSFS_PRESENT = 0,
+
+    UHWI_SYSFS_VENDOR,
+    UHWI_SYSFS_DEVICE,
+    UHWI_SYSFS_SUBVENDOR,
+    UHWI_SYSFS_SUBDEVICE,
+
+    /// parsed with uhwi_addr_parse()
+    UHWI_SYSFS_ADDR,
+    /// appended to the name, separated by a space
+    UHWI_SYSFS_NAME
+} uhwi_sysfs_field_t;
+
+/// the device is skipped if the attribute can't be read
+#define UHWI_SYSFS_MANDATORY (1 << 0)
+/// left out past the deadline, the device is marked UHWI_DEV_PARTIAL then
+#define UHWI_SYSFS_OPTIONAL (1 << 1)
+/// IDs: hexadecimal with a 0x prefix (values without one are ignored)
+#define UHWI_SYSFS_PREFIXED (1 << 2)
+/// IDs: decimal instead of hexadecimal
+#define UHWI_SYSFS_DECIMAL (1 << 3)
+/// the value is the name of the device's directory instead of a file in it
+#define UHWI_SYSFS_LABEL (1 << 4)
+/// names: looked up in the PCI DB by the IDs read so far
+#define UHWI_SYSFS_PCI_DB (1 << 5)
+
+typedef struct {
+    /// path relative to the device's directory (NULL for UHWI_SYSFS_LABEL &
+    /// UHWI_SYSFS_PCI_DB)
+    const char* path;
+
+    uhwi_sysfs_field_t field;
+    /// UHWI_SYSFS_* flags
+    int flags;
+} uhwi_sysfs_attr;
+
+/// a directory holding one entry per device, all of them read the same way
+typedef struct {
+    uhwi_dev_t type;
+    const char* dir;
+
+    /// read in order, later values of the same ID overwrite earlier ones
+    const uhwi_sysfs_attr* attrs;
+    size_t nattrs;
+} uhwi_sysfs_class;
+
+/// NULL for UHWI_DEV_NULL
+const uhwi_sysfs_class* uhwi_sysfs_class_of(const uhwi_dev_t type);
+
+/// populates the record from an entry of the class directory (open as dfd),
+/// returns NULL if the entry is not a device of the class
+uhwi_dev* uhwi_sysfs_read_dev(const uhwi_sysfs_class* cls, const int dfd,
+                              const char* label, uhwi_dev* result,
+                              uhwi_db* db);
+
+/// streams every device of the class to the callback, db (if not NULL) is
+/// used for UHWI_SYSFS_PCI_DB names
+int uhwi_sysfs_foreach(const uhwi_sysfs_class* cls, uhwi_dev_cb cb,
+                       void* userdata, uhwi_db* db);
+#endif
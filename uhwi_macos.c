@@ -30,7 +30,7 @@
 
 #include "uhwi.h"
 
-extern uhwi_errno_t uhwi_last_errno;
+extern __thread uhwi_errno_t uhwi_last_errno;
 
 #if __MAC_OS_X_VERSION_MIN_REQUIRED < __MAC_12_0
 // macOS 12.0 renamed master port to main
@@ -85,12 +85,55 @@ uhwi_id_t uhwi_get_macos_pci_param(const io_service_t pci,
     return (uhwi_id_t)result;
 }
 
-uhwi_dev* uhwi_get_macos_devs(const uhwi_dev_t type, uhwi_dev** lpp) {
+// IOPCIDevice's "reg" property starts with the Open Firmware phys.hi cell,
+// which holds the bus, device & function numbers
+uhwi_addr_t uhwi_get_macos_pci_addr(const io_service_t pci) {
+    uhwi_addr_t result = 0;
+
+    CFStringRef kcf = CFSTR_FROM_CSTR_ASCII("reg");
+    CFTypeRef raw = IORegistryEntryCreateCFProperty(pci, kcf, kCFAllocatorDefault,
+                                                    0);
+
+    if (raw && CFGetTypeID(raw) == CFDataGetTypeID() &&
+        CFDataGetLength(raw) >= (CFIndex)sizeof(UInt32)) {
+        UInt32 hi = 0;
+        memcpy(&hi, CFDataGetBytePtr(raw), sizeof(UInt32));
+
+        result = UHWI_ADDR_PCI(0, (hi >> 16) & 0xff, (hi >> 11) & 0x1f,
+                               (hi >> 8) & 0x7);
+    }
+
+    if (raw)
+        CFRelease(raw);
+
+    CFRelease(kcf);
+    return result;
+}
+
+// USB location IDs hold the bus number in the top byte followed by 4-bit port
+// numbers
+uhwi_addr_t uhwi_macos_usb_addr(const UInt32 location) {
+    uhwi_addr_t result = UHWI_ADDR_USB(location >> 24);
+
+    for (size_t depth = 0; depth < UHWI_ADDR_USB_DEPTH_MAX; depth++) {
+        const UInt32 port = (location >> (20 - 4 * depth)) & 0xf;
+
+        if (port == 0)
+            break;
+
+        result = UHWI_ADDR_USB_WITH_PORT(result, depth, port);
+    }
+
+    return result;
+}
+
+int uhwi_foreach_macos_dev(const uhwi_dev_t type, uhwi_dev_cb cb,
+                           void* userdata) {
     if (type == UHWI_DEV_NULL)
-        return NULL; // must be a specific device type request
+        return 0; // must be a specific device type request
 
-    uhwi_dev* first = NULL;
-    uhwi_dev* last = NULL;
+    // result of the last callback invocation (non-zero stops the loop)
+    int rc = 0;
 
     uhwi_last_errno = UHWI_ERRNO_OK;
 
@@ -100,7 +143,7 @@ uhwi_dev* uhwi_get_macos_devs(const uhwi_dev_t type, uhwi_dev** lpp) {
 
     if (!matcher) {
         uhwi_last_errno = UHWI_ERRNO_IOKIT_NO_MEM;
-        return NULL;
+        return -1;
     }
 
     // obtain all IOKit IOService instances (these are basically device-representing
@@ -115,13 +158,16 @@ uhwi_dev* uhwi_get_macos_devs(const uhwi_dev_t type, uhwi_dev** lpp) {
         CFRelease(matcher);
 
         uhwi_last_errno = UHWI_ERRNO_IOKIT_SERVICE;
-        return NULL;
+        return -1;
     }
 
     // iterate through all the detected devices
     io_service_t dvv = 0;
 
-    while (1) {
+    // a single record is reused for every device handed out to the callback
+    uhwi_dev record;
+
+    while (rc == 0) {
         dvv = IOIteratorNext(iter);
 
         if (dvv) {
@@ -167,13 +213,18 @@ uhwi_dev* uhwi_get_macos_devs(const uhwi_dev_t type, uhwi_dev** lpp) {
 
                 // finally, obtain device vendor and product ID after the dark
                 // magic performed above
-                current = malloc(sizeof(uhwi_dev));
+                current = &record;
                 memset(current, 0, sizeof(uhwi_dev));
 
                 (*dvdp)->GetDeviceVendor(dvdp, &current->vendor);
                 (*dvdp)->GetDeviceProduct(dvdp, &current->device);
+
+                UInt32 location = 0;
+
+                if ((*dvdp)->GetLocationID(dvdp, &location) == kIOReturnSuccess)
+                    current->addr = uhwi_macos_usb_addr(location);
             } else if (type == UHWI_DEV_PCI) {
-                current = malloc(sizeof(uhwi_dev));
+                current = &record;
                 memset(current, 0, sizeof(uhwi_dev));
 
                 // at least with PCI it's more or less straightforward
@@ -182,9 +233,11 @@ uhwi_dev* uhwi_get_macos_devs(const uhwi_dev_t type, uhwi_dev** lpp) {
 
                 current->subvendor = uhwi_get_macos_pci_param(dvv, "subsystem-vendor-id", 0);
                 current->subdevice = uhwi_get_macos_pci_param(dvv, "subsystem-id", 0);
+
+                current->addr = uhwi_get_macos_pci_addr(dvv);
             }
 
-            // add our UHWI device structure to the linked list if it is valid
+            // hand our UHWI device structure out to the callback if it is valid
             if (current) {
                 current->type = type;
 
@@ -192,12 +245,7 @@ uhwi_dev* uhwi_get_macos_devs(const uhwi_dev_t type, uhwi_dev** lpp) {
                 uhwi_strncpy_macos_dev_name_cstr(type, dvv, current->name,
                                                  UHWI_DEV_NAME_MAX_LEN - 1);
 
-                if (last)
-                    last->next = current;
-                else
-                    first = current;
-
-                last = current;
+                rc = cb(current, userdata);
             }
 
             // clean up the device object reference port thing
@@ -210,9 +258,5 @@ uhwi_dev* uhwi_get_macos_devs(const uhwi_dev_t type, uhwi_dev** lpp) {
     // clean up
     IOObjectRelease(iter);
 
-    // provide the user with the last UHWI device structure pointer, if requested
-    if (lpp)
-        (*lpp) = last;
-
-    return first;
+    return rc;
 }
@@ -0,0 +1,230 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <string.h>
+
+#include <pthread.h>
+
+#include "uhwi_internal.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+# define UHWI_SCAN_X86 1
+# include <immintrin.h>
+#endif
+
+uint64_t uhwi_scan_mask64_scalar(const char* block, const char needle) {
+    uint64_t mask = 0;
+
+    // branchless, so that the compiler is free to vectorize it on its own
+    for (size_t index = 0; index < 64; index++)
+        mask |= (uint64_t)(block[index] == needle) << index;
+
+    return mask;
+}
+
+#ifdef UHWI_SCAN_X86
+uint64_t uhwi_scan_mask64_sse2(const char* block, const char needle) {
+    const __m128i vneedle = _mm_set1_epi8(needle);
+    uint64_t mask = 0;
+
+    for (size_t index = 0; index < 4; index++) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i*)(block + index * 16));
+        const uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk,
+                                                                         vneedle));
+
+        mask |= (uint64_t)(bits & 0xffff) << (index * 16);
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx2")))
+uint64_t uhwi_scan_mask64_avx2(const char* block, const char needle) {
+    const __m256i vneedle = _mm256_set1_epi8(needle);
+
+    const __m256i lo = _mm256_loadu_si256((const __m256i*)block);
+    const __m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+
+    const uint32_t lbits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo,
+                                                                            vneedle));
+    const uint32_t hbits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi,
+                                                                            vneedle));
+
+    return (uint64_t)lbits | ((uint64_t)hbits << 32);
+}
+#endif
+
+uhwi_scan_impl_t uhwi_scan_impl = UHWI_SCAN_AUTO;
+uhwi_scan_fn uhwi_scan_mask64_fn = NULL;
+
+// the first scan picks the implementation, whichever thread it runs on
+pthread_once_t uhwi_scan_once = PTHREAD_ONCE_INIT;
+
+void uhwi_scan_select(const uhwi_scan_impl_t impl) {
+    uhwi_scan_impl_t chosen = impl;
+    uhwi_scan_fn fn = NULL;
+
+    if (chosen == UHWI_SCAN_AUTO) {
+#ifdef UHWI_SCAN_X86
+        // SSE2 is part of the x86-64 baseline, AVX2 has to be asked for
+        __builtin_cpu_init();
+        chosen = __builtin_cpu_supports("avx2") ? UHWI_SCAN_AVX2 : UHWI_SCAN_SSE2;
+#else
+        chosen = UHWI_SCAN_SCALAR;
+#endif
+    }
+
+    switch (chosen) {
+#ifdef UHWI_SCAN_X86
+        case UHWI_SCAN_SSE2: {
+            fn = uhwi_scan_mask64_sse2;
+            break;
+        }
+        case UHWI_SCAN_AVX2: {
+            fn = uhwi_scan_mask64_avx2;
+            break;
+        }
+#endif
+        default: {
+            chosen = UHWI_SCAN_SCALAR;
+            fn = uhwi_scan_mask64_scalar;
+            break;
+        }
+    }
+
+    // (iterators started from now on pick the new one up)
+    __atomic_store_n(&uhwi_scan_impl, chosen, __ATOMIC_RELAXED);
+    __atomic_store_n(&uhwi_scan_mask64_fn, fn, __ATOMIC_RELEASE);
+}
+
+void uhwi_scan_select_default(void) {
+    // (unless one was forced already)
+    if (!__atomic_load_n(&uhwi_scan_mask64_fn, __ATOMIC_ACQUIRE))
+        uhwi_scan_select(__atomic_load_n(&uhwi_scan_impl, __ATOMIC_RELAXED));
+}
+
+// loads the newline mask of the current block, the very last (partial) block
+// is copied into a zero-padded buffer first so that nothing past the end of
+// the input is ever read
+void uhwi_lines_load(uhwi_lines* it) {
+    const size_t left = (size_t)(it->end - it->block);
+
+    if (left >= 64)
+        it->mask = it->scan(it->block, '\n');
+    else {
+        char tail[64];
+
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, it->block, left);
+
+        it->mask = it->scan(tail, '\n') & ((1ull << left) - 1);
+    }
+}
+
+void uhwi_lines_init(uhwi_lines* it, const char* buf, const size_t len) {
+    it->scan = __atomic_load_n(&uhwi_scan_mask64_fn, __ATOMIC_ACQUIRE);
+
+    if (!it->scan) {
+        pthread_once(&uhwi_scan_once, uhwi_scan_select_default);
+        it->scan = __atomic_load_n(&uhwi_scan_mask64_fn, __ATOMIC_ACQUIRE);
+    }
+
+    it->block = buf;
+    it->end = buf + len;
+    it->line = buf;
+
+    it->mask = 0;
+
+    if (len > 0)
+        uhwi_lines_load(it);
+}
+
+int uhwi_lines_next(uhwi_lines* it, const char** linep, const char** eolp) {
+    if (it->line >= it->end)
+        return 0; // no more lines
+
+    while (it->mask == 0) {
+        it->block += 64;
+
+        if (it->block >= it->end) {
+            // the last line isn't newline-terminated
+            (*linep) = it->line;
+            (*eolp) = it->end;
+
+            it->line = it->end;
+            return 1;
+        }
+
+        uhwi_lines_load(it);
+    }
+
+    // every set bit is a newline, so lines are handed out without looking at
+    // the bytes in between at all
+    const char* eol = it->block + __builtin_ctzll(it->mask);
+    it->mask &= it->mask - 1;
+
+    (*linep) = it->line;
+    (*eolp) = eol;
+
+    it->line = eol + 1;
+    return 1;
+}
+
+// hex digit values plus one, 0 marks a non-hex character
+const uint8_t uhwi_hex_digits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+uhwi_id_t uhwi_hex_id(const char* from, const int prefixed) {
+    // afaik only Linux sysfs PCI IDs are prefixed with a 0x
+    if (prefixed && from[0] == '0' && (from[1] == 'x' || from[1] == 'X'))
+        from += 2;
+
+    const int d0 = (int)uhwi_hex_digits[(uint8_t)from[0]] - 1;
+    const int d1 = (int)uhwi_hex_digits[(uint8_t)from[1]] - 1;
+    const int d2 = (int)uhwi_hex_digits[(uint8_t)from[2]] - 1;
+    const int d3 = (int)uhwi_hex_digits[(uint8_t)from[3]] - 1;
+
+    // all four digits are valid -> a single well-predicted branch
+    if ((d0 | d1 | d2 | d3) >= 0)
+        return (uhwi_id_t)((d0 << 12) | (d1 << 8) | (d2 << 4) | d3);
+
+    // shorter IDs are decoded up to the first non-hex character, just like
+    // sscanf("%04x") would
+    uint32_t result = 0;
+
+    for (size_t index = 0; index < 4; index++) {
+        const int digit = (int)uhwi_hex_digits[(uint8_t)from[index]] - 1;
+
+        if (digit < 0)
+            break;
+
+        result = (result << 4) | (uint32_t)digit;
+    }
+
+    return (uhwi_id_t)result;
+}
@@ -0,0 +1,312 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "uhwi_internal.h"
+
+#ifndef UHWI_SHM_NAME
+#define UHWI_SHM_NAME "/uhwi.snapshot"
+#endif
+
+/// fixed, so that attached readers never have to remap the segment
+#define UHWI_SHM_SIZE (1024 * 1024)
+
+#define UHWI_SHM_MAGIC "UHWM"
+#define UHWI_SHM_VERSION 1
+
+/// a reader gives up (and enumerates on its own) after this many torn reads
+#define UHWI_SHM_RETRIES 64
+
+typedef struct {
+    /// UHWI_SHM_MAGIC, set once the segment is initialized
+    char magic[4];
+    /// UHWI_SHM_VERSION
+    uint32_t version;
+
+    /// seqlock sequence number, odd while the publisher is writing
+    uint32_t seq;
+    /// length of the published binary snapshot, in bytes
+    uint32_t len;
+
+    /// CLOCK_MONOTONIC timestamp (ns) the published snapshot goes stale at, 0
+    /// once the publisher is gone
+    uint64_t expires;
+    /// bumped on every publication
+    uint64_t generation;
+} uhwi_shm_hdr;
+
+#define UHWI_SHM_DATA(hdr) ((char*)(hdr) + sizeof(uhwi_shm_hdr))
+#define UHWI_SHM_DATA_MAX (UHWI_SHM_SIZE - sizeof(uhwi_shm_hdr))
+
+// only segments of root or of the calling user are trusted, and never ones
+// anybody else could write to, so that nobody can pre-create the segment and
+// feed forged device lists to every reader on the host
+#define UHWI_SHM_TRUSTED(st) \
+    (((st).st_uid == 0 || (st).st_uid == geteuid()) && \
+     !((st).st_mode & (S_IWGRP | S_IWOTH)))
+
+/// publisher's read/write mapping of the segment
+uhwi_shm_hdr* uhwi_shm_writer = NULL;
+
+/// readers' mapping of the segment, kept for the whole life of the process
+const uhwi_shm_hdr* uhwi_shm_reader = NULL;
+
+// the segment is never unlinked, a restarted publisher reuses it, so that
+// readers which are already attached keep working
+int uhwi_shm_create(void) {
+    const int fd = shm_open(UHWI_SHM_NAME, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+
+    // a segment somebody else created may still be written to through their
+    // own mappings, so it is never published into; umask might have taken the
+    // read permission away from everyone else, which has to be given back
+    if (fstat(fd, &st) < 0 || st.st_uid != geteuid() || fchmod(fd, 0644) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // some systems only allow sizing a shared memory object once
+    if (st.st_size != UHWI_SHM_SIZE && ftruncate(fd, UHWI_SHM_SIZE) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, UHWI_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return -1;
+
+    uhwi_shm_writer = map;
+
+    if (memcmp(uhwi_shm_writer->magic, UHWI_SHM_MAGIC,
+               sizeof(uhwi_shm_writer->magic)) != 0) {
+        uhwi_shm_writer->version = UHWI_SHM_VERSION;
+        memcpy(uhwi_shm_writer->magic, UHWI_SHM_MAGIC,
+               sizeof(uhwi_shm_writer->magic));
+    }
+
+    return 0;
+}
+
+// seqlock write side, there must only ever be a single publisher
+#define UHWI_SHM_WRITE_BEGIN(hdr, seq) { \
+    seq = __atomic_load_n(&(hdr)->seq, __ATOMIC_RELAXED) | 1; \
+    __atomic_store_n(&(hdr)->seq, seq, __ATOMIC_RELAXED); \
+    __atomic_thread_fence(__ATOMIC_RELEASE); \
+}
+
+#define UHWI_SHM_WRITE_END(hdr, seq) \
+    __atomic_store_n(&(hdr)->seq, seq + 1, __ATOMIC_RELEASE);
+
+int uhwi_shm_publish(const uhwi_snapshot* snap, const unsigned int ttl_ms) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    if (!snap)
+        return -1;
+
+    if (!uhwi_shm_writer && uhwi_shm_create() < 0) {
+        uhwi_last_errno = UHWI_ERRNO_SHM_OPEN;
+        return -1;
+    }
+
+    uhwi_shm_hdr* hdr = uhwi_shm_writer;
+    const size_t len = uhwi_snapshot_encode(snap, NULL, 0);
+
+    uint32_t seq;
+    UHWI_SHM_WRITE_BEGIN(hdr, seq)
+
+    if (len > UHWI_SHM_DATA_MAX) {
+        // readers would otherwise keep getting an outdated snapshot
+        __atomic_store_n(&hdr->expires, 0, __ATOMIC_RELAXED);
+        UHWI_SHM_WRITE_END(hdr, seq)
+
+        uhwi_last_errno = UHWI_ERRNO_SHM_FULL;
+        return -1;
+    }
+
+    uhwi_snapshot_encode(snap, UHWI_SHM_DATA(hdr), UHWI_SHM_DATA_MAX);
+
+    __atomic_store_n(&hdr->len, (uint32_t)len, __ATOMIC_RELAXED);
+    __atomic_store_n(&hdr->expires,
+                     (ttl_ms > 0) ?
+                     uhwi_now_ns() + (uint64_t)ttl_ms * 1000000ULL :
+                     UINT64_MAX, __ATOMIC_RELAXED);
+    __atomic_store_n(&hdr->generation, hdr->generation + 1, __ATOMIC_RELAXED);
+
+    UHWI_SHM_WRITE_END(hdr, seq)
+    return 0;
+}
+
+void uhwi_shm_unpublish(void) {
+    uhwi_shm_hdr* hdr = uhwi_shm_writer;
+
+    if (!hdr)
+        return;
+
+    uint32_t seq;
+    UHWI_SHM_WRITE_BEGIN(hdr, seq)
+
+    __atomic_store_n(&hdr->expires, 0, __ATOMIC_RELAXED);
+
+    UHWI_SHM_WRITE_END(hdr, seq)
+
+    munmap(hdr, UHWI_SHM_SIZE);
+    uhwi_shm_writer = NULL;
+}
+
+// maps the segment read-only on first use, NULL if there's no publisher
+const uhwi_shm_hdr* uhwi_shm_attach(void) {
+    const uhwi_shm_hdr* hdr = __atomic_load_n(&uhwi_shm_reader,
+                                              __ATOMIC_ACQUIRE);
+
+    if (hdr)
+        return hdr;
+
+    const int fd = shm_open(UHWI_SHM_NAME, O_RDONLY, 0);
+
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+
+    // (the publisher might not have sized it yet)
+    if (fstat(fd, &st) < 0 || !UHWI_SHM_TRUSTED(st) ||
+        st.st_size < UHWI_SHM_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, UHWI_SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    // another thread might have attached in the meantime
+    const uhwi_shm_hdr* expected = NULL;
+
+    if (!__atomic_compare_exchange_n(&uhwi_shm_reader, &expected, map, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(map, UHWI_SHM_SIZE);
+        return expected;
+    }
+
+    return map;
+}
+
+// copies the currently published snapshot out of the segment, no syscalls are
+// made once attached (CLOCK_MONOTONIC is served from the vDSO where available),
+// NULL with UHWI_ERRNO_NO_MEM if the copy couldn't be allocated
+uhwi_snapshot* uhwi_shm_read(void) {
+    const uhwi_shm_hdr* hdr = uhwi_shm_attach();
+
+    if (!hdr || memcmp(hdr->magic, UHWI_SHM_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != UHWI_SHM_VERSION)
+        return NULL;
+
+    const uint64_t now = uhwi_now_ns();
+
+    char* data = NULL;
+    size_t cap = 0;
+
+    for (size_t attempt = 0; attempt < UHWI_SHM_RETRIES; attempt++) {
+        const uint32_t seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1)
+            continue; // being written right now
+
+        const size_t len = __atomic_load_n(&hdr->len, __ATOMIC_RELAXED);
+        const uint64_t expires = __atomic_load_n(&hdr->expires,
+                                                 __ATOMIC_RELAXED);
+
+        if (len > UHWI_SHM_DATA_MAX || len == 0 || expires <= now) {
+            // a torn read can look stale too, so double check
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != seq)
+                continue;
+
+            break;
+        }
+
+        if (len > cap) {
+            char* grown = uhwi_mem_realloc(data, len);
+
+            if (!grown) {
+                uhwi_mem_free(data);
+
+                uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+                return NULL;
+            }
+
+            data = grown;
+            cap = len;
+        }
+
+        memcpy(data, UHWI_SHM_DATA(hdr), len);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == seq)
+            return uhwi_snapshot_adopt(data, len);
+    }
+
+    uhwi_mem_free(data);
+    return NULL;
+}
+
+uhwi_snapshot* uhwi_snapshot_take_shared(const uhwi_dev_t type) {
+    // the publisher only shares the buses
+    if (type != UHWI_DEV_NULL && !UHWI_DEV_IS_BUS(type))
+        return uhwi_snapshot_take(type);
+
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    uhwi_snapshot* snap = uhwi_shm_read();
+
+    // no (live) publisher, enumerate directly
+    if (!snap && uhwi_last_errno != UHWI_ERRNO_NO_MEM)
+        return uhwi_snapshot_take(type);
+
+    if (!snap || type == UHWI_DEV_NULL)
+        return snap;
+
+    uhwi_snapshot* filtered = uhwi_snapshot_filter(snap, type);
+    uhwi_snapshot_free(snap);
+
+    return filtered;
+}
@@ -0,0 +1,818 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdio.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "uhwi_internal.h"
+
+#define UHWI_SNAPSHOT_CAP_BASE 32
+
+typedef enum {
+    /// records & names were enumerated into heap memory
+    UHWI_SNAPSHOT_HEAP = 0,
+    /// records & names point into a mapped snapshot file
+    UHWI_SNAPSHOT_MMAP,
+    /// records & names point into a caller-owned buffer
+    UHWI_SNAPSHOT_BORROWED,
+    /// records & names point into a heap copy of a binary snapshot
+    UHWI_SNAPSHOT_OWNED
+} uhwi_snapshot_backing_t;
+
+/// open addressing hash table of record indices by bus address
+typedef struct {
+    /// amount of slots minus one (a power of two minus one)
+    size_t mask;
+
+    /// record index plus one (0 marks a free slot)
+    uint32_t slots[];
+} uhwi_snapshot_index;
+
+#define UHWI_SNAPSHOT_LINK_NONE UINT32_MAX
+
+/// USB hub/port tree links of a record, as record indices
+typedef struct {
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+} uhwi_snapshot_link;
+
+struct uhwi_snapshot {
+    /// compact device records
+    uhwi_dev_rec* devs;
+    size_t count;
+    size_t cap;
+
+    /// per-snapshot interned device names
+    uhwi_strpool strings;
+
+    /// references held, the snapshot is freed once the last one is dropped
+    uint32_t refs;
+
+    /// index of the records by bus address, built on first lookup
+    uhwi_snapshot_index* by_addr;
+
+    /// USB topology links, one per record, built on first traversal
+    uhwi_snapshot_link* usb_links;
+
+    /// where the records & names live (and how to release them)
+    uhwi_snapshot_backing_t backing;
+    void* map;
+    size_t map_len;
+};
+
+//
+// binary snapshot file layout (version 2, which added the records' bus
+// addresses): the header, count records exactly as they are laid out in
+// memory, then the string table they refer to
+//
+
+#define UHWI_SNAPSHOT_MAGIC "UHWS"
+#define UHWI_SNAPSHOT_BYTE_ORDER 0x0102
+
+typedef struct {
+    /// UHWI_SNAPSHOT_MAGIC
+    char magic[4];
+    /// UHWI_SNAPSHOT_VERSION
+    uint16_t version;
+    /// UHWI_SNAPSHOT_BYTE_ORDER as written by the producing host
+    uint16_t byte_order;
+
+    /// sizeof(uhwi_dev_rec)
+    uint32_t rec_size;
+    /// amount of records
+    uint32_t count;
+    /// string table length, in bytes (including its trailing NUL)
+    uint32_t strings_len;
+
+    /// unused, always 0
+    uint32_t reserved[3];
+} uhwi_snapshot_hdr;
+
+uhwi_snapshot* uhwi_snapshot_alloc(void) {
+    uhwi_snapshot* snap = uhwi_mem_alloc(sizeof(uhwi_snapshot));
+
+    if (!snap) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+
+    memset(snap, 0, sizeof(uhwi_snapshot));
+
+    snap->refs = 1;
+
+    if (uhwi_strpool_init(&snap->strings) < 0) {
+        uhwi_mem_free(snap);
+        return NULL;
+    }
+
+    return snap;
+}
+
+int uhwi_snapshot_append(const uhwi_dev* dev, void* userdata) {
+    uhwi_snapshot* snap = userdata;
+
+    if (snap->count == snap->cap) {
+        const size_t cap = snap->cap ? snap->cap * 2 : UHWI_SNAPSHOT_CAP_BASE;
+        uhwi_dev_rec* devs = uhwi_mem_realloc(snap->devs,
+                                              cap * sizeof(uhwi_dev_rec));
+
+        // (stops the enumeration, which then fails as a whole)
+        if (!devs) {
+            uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+            return -1;
+        }
+
+        snap->devs = devs;
+        snap->cap = cap;
+    }
+
+    // identical devices (e.g. a bunch of the same virtio controllers) end up
+    // sharing a single copy of their name
+    const char* nul = memchr(dev->name, '\0', UHWI_DEV_NAME_MAX_LEN);
+    const size_t len = nul ? (size_t)(nul - dev->name) : UHWI_DEV_NAME_MAX_LEN;
+
+    const uhwi_str_t name = uhwi_strpool_intern(&snap->strings, dev->name, len);
+
+    if (name == UHWI_STR_NONE)
+        return -1;
+
+    uhwi_dev_rec* rec = &snap->devs[snap->count++];
+    memset(rec, 0, sizeof(uhwi_dev_rec));
+
+    rec->type = (uint16_t)dev->type;
+
+    rec->vendor = dev->vendor;
+    rec->device = dev->device;
+
+    rec->subvendor = dev->subvendor;
+    rec->subdevice = dev->subdevice;
+
+    rec->addr = dev->addr;
+    rec->flags = dev->flags;
+    rec->name = name;
+
+    return 0;
+}
+
+void uhwi_snapshot_finish(uhwi_snapshot* snap) {
+    // the snapshot is immutable from now on (the slack is kept if even
+    // shrinking the records fails)
+    if (snap->count > 0 && snap->count < snap->cap) {
+        uhwi_dev_rec* devs = uhwi_mem_realloc(snap->devs,
+                                              snap->count * sizeof(uhwi_dev_rec));
+
+        if (devs) {
+            snap->devs = devs;
+            snap->cap = snap->count;
+        }
+    }
+
+    uhwi_strpool_seal(&snap->strings);
+}
+
+uhwi_snapshot* uhwi_snapshot_take(const uhwi_dev_t type) {
+    return uhwi_snapshot_take_ex(type, NULL);
+}
+
+uhwi_snapshot* uhwi_snapshot_take_ex(const uhwi_dev_t type,
+                                     const uhwi_opts* opts) {
+    uhwi_snapshot* snap = uhwi_snapshot_alloc();
+
+    if (!snap)
+        return NULL;
+
+    if (uhwi_foreach_dev_ex(type, opts, uhwi_snapshot_append, snap) < 0 &&
+        (snap->count == 0 || uhwi_last_errno == UHWI_ERRNO_NO_MEM)) {
+        // nothing at all could be enumerated, or not everything that was fit
+        // into the snapshot
+        uhwi_snapshot_free(snap);
+        return NULL;
+    }
+
+    uhwi_snapshot_finish(snap);
+    return snap;
+}
+
+uhwi_snapshot* uhwi_snapshot_filter(const uhwi_snapshot* snap,
+                                    const uhwi_dev_t type) {
+    uhwi_snapshot* filtered = uhwi_snapshot_alloc();
+    uhwi_dev current;
+
+    if (!filtered)
+        return NULL;
+
+    for (size_t index = 0; index < uhwi_snapshot_count(snap); index++) {
+        uhwi_snapshot_view(snap, index, &current);
+
+        if ((type == UHWI_DEV_NULL || current.type == type) &&
+            uhwi_snapshot_append(&current, filtered) < 0) {
+            uhwi_snapshot_free(filtered);
+            return NULL;
+        }
+    }
+
+    uhwi_snapshot_finish(filtered);
+    return filtered;
+}
+
+size_t uhwi_snapshot_count(const uhwi_snapshot* snap) {
+    return snap ? snap->count : 0;
+}
+
+const uhwi_dev_rec* uhwi_snapshot_get(const uhwi_snapshot* snap,
+                                      const size_t index) {
+    if (!snap || index >= snap->count)
+        return NULL;
+
+    return &snap->devs[index];
+}
+
+const char* uhwi_snapshot_str(const uhwi_snapshot* snap, const uhwi_str_t str) {
+    if (!snap || str >= snap->strings.len)
+        return "";
+
+    return snap->strings.data + str;
+}
+
+// a multiply-shift mix, addresses differ mostly in their low bits
+#define UHWI_SNAPSHOT_ADDR_HASH(addr) \
+    ((size_t)(((addr) * 0x9e3779b97f4a7c15ULL) >> 32))
+
+// NULL if out of memory
+uhwi_snapshot_index* uhwi_snapshot_index_build(const uhwi_snapshot* snap) {
+    // at most half full
+    size_t nslots = 8;
+
+    while (nslots < snap->count * 2)
+        nslots *= 2;
+
+    uhwi_snapshot_index* index = uhwi_mem_calloc(1, sizeof(uhwi_snapshot_index) +
+                                           nslots * sizeof(uint32_t));
+
+    if (!index)
+        return NULL;
+
+    index->mask = nslots - 1;
+
+    for (size_t rindex = 0; rindex < snap->count; rindex++) {
+        const uhwi_addr_t addr = snap->devs[rindex].addr;
+
+        if (addr == 0)
+            continue; // unknown
+
+        size_t slot = UHWI_SNAPSHOT_ADDR_HASH(addr) & index->mask;
+
+        while (index->slots[slot] != 0) {
+            // the first one of duplicate addresses wins
+            if (snap->devs[index->slots[slot] - 1].addr == addr)
+                break;
+
+            slot = (slot + 1) & index->mask;
+        }
+
+        if (index->slots[slot] == 0)
+            index->slots[slot] = (uint32_t)rindex + 1;
+    }
+
+    return index;
+}
+
+const uhwi_dev_rec* uhwi_find_by_addr(const uhwi_snapshot* snap,
+                                      const uhwi_addr_t addr) {
+    if (!snap || addr == 0)
+        return NULL;
+
+    uhwi_snapshot_index* index = __atomic_load_n(&snap->by_addr,
+                                                 __ATOMIC_ACQUIRE);
+
+    if (!index) {
+        // snapshots are shared between threads, whoever publishes an index
+        // first wins and the rest drop theirs
+        uhwi_snapshot_index* expected = NULL;
+        index = uhwi_snapshot_index_build(snap);
+
+        if (!index) {
+            // (out of memory, the records can still be searched one by one)
+            for (size_t rindex = 0; rindex < snap->count; rindex++)
+                if (snap->devs[rindex].addr == addr)
+                    return &snap->devs[rindex];
+
+            return NULL;
+        }
+
+        if (!__atomic_compare_exchange_n(&((uhwi_snapshot*)snap)->by_addr,
+                                         &expected, index, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            uhwi_mem_free(index);
+            index = expected;
+        }
+    }
+
+    size_t slot = UHWI_SNAPSHOT_ADDR_HASH(addr) & index->mask;
+
+    while (index->slots[slot] != 0) {
+        const uhwi_dev_rec* rec = &snap->devs[index->slots[slot] - 1];
+
+        if (rec->addr == addr)
+            return rec;
+
+        slot = (slot + 1) & index->mask;
+    }
+
+    return NULL;
+}
+
+// the hub a USB device is plugged into has the same address minus the last
+// port of the chain (root hubs have no parent)
+uhwi_addr_t uhwi_usb_parent_addr(const uhwi_addr_t addr) {
+    if (UHWI_ADDR_TYPE(addr) != UHWI_DEV_USB || UHWI_ADDR_USB_PORT(addr, 0) == 0)
+        return 0;
+
+    size_t depth = 1;
+
+    while (depth < UHWI_ADDR_USB_DEPTH_MAX &&
+           UHWI_ADDR_USB_PORT(addr, depth) != 0)
+        depth++;
+
+    return addr & ~((uhwi_addr_t)0xff << (40 - 8 * (depth - 1)));
+}
+
+// snapshot whose USB record indices uhwi_snapshot_links_build() is sorting
+// (qsort() has no context argument)
+__thread const uhwi_snapshot* uhwi_snapshot_sorting = NULL;
+
+int uhwi_snapshot_cmp_addrs(const void* lhs, const void* rhs) {
+    const uhwi_addr_t laddr = uhwi_snapshot_sorting->devs[*(const uint32_t*)lhs].addr;
+    const uhwi_addr_t raddr = uhwi_snapshot_sorting->devs[*(const uint32_t*)rhs].addr;
+
+    return (laddr > raddr) - (laddr < raddr);
+}
+
+// NULL (with UHWI_ERRNO_NO_MEM) if out of memory
+uhwi_snapshot_link* uhwi_snapshot_links_build(const uhwi_snapshot* snap) {
+    // (the extra link at the end chains the roots of the tree)
+    uhwi_snapshot_link* links = uhwi_mem_alloc((snap->count + 1) *
+                                       sizeof(uhwi_snapshot_link));
+    uint32_t* order = uhwi_mem_alloc((snap->count ? snap->count : 1) * sizeof(uint32_t));
+    size_t norder = 0;
+
+    if (!links || !order) {
+        uhwi_mem_free(links);
+        uhwi_mem_free(order);
+
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+
+    for (size_t index = 0; index <= snap->count; index++) {
+        links[index].parent = UHWI_SNAPSHOT_LINK_NONE;
+        links[index].first_child = UHWI_SNAPSHOT_LINK_NONE;
+        links[index].next_sibling = UHWI_SNAPSHOT_LINK_NONE;
+
+        if (index < snap->count && snap->devs[index].type == UHWI_DEV_USB)
+            order[norder++] = (uint32_t)index;
+    }
+
+    // addresses sort hubs by bus and then by port, so linking children in
+    // reverse order leaves every child list sorted by port
+    uhwi_snapshot_sorting = snap;
+    qsort(order, norder, sizeof(uint32_t), uhwi_snapshot_cmp_addrs);
+    uhwi_snapshot_sorting = NULL;
+
+    while (norder > 0) {
+        const uint32_t index = order[--norder];
+        const uhwi_addr_t parent_addr =
+            uhwi_usb_parent_addr(snap->devs[index].addr);
+
+        const uhwi_dev_rec* parent = (parent_addr != 0) ?
+            uhwi_find_by_addr(snap, parent_addr) : NULL;
+
+        // (devices behind a hub that isn't part of the snapshot are roots)
+        const uint32_t pindex = (parent) ? (uint32_t)(parent - snap->devs) :
+                                           (uint32_t)snap->count;
+
+        if (parent)
+            links[index].parent = pindex;
+
+        links[index].next_sibling = links[pindex].first_child;
+        links[pindex].first_child = index;
+    }
+
+    uhwi_mem_free(order);
+    return links;
+}
+
+const uhwi_snapshot_link* uhwi_snapshot_links(const uhwi_snapshot* snap) {
+    uhwi_snapshot_link* links = __atomic_load_n(&snap->usb_links,
+                                                __ATOMIC_ACQUIRE);
+
+    if (links)
+        return links;
+
+    uhwi_snapshot_link* expected = NULL;
+    links = uhwi_snapshot_links_build(snap);
+
+    if (!links)
+        return NULL;
+
+    // same as with the address index, the first one to publish wins
+    if (!__atomic_compare_exchange_n(&((uhwi_snapshot*)snap)->usb_links,
+                                     &expected, links, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        uhwi_mem_free(links);
+        links = expected;
+    }
+
+    return links;
+}
+
+// (a tree that couldn't be allocated has no links at all)
+#define UHWI_SNAPSHOT_LINK(snap, index, field) { \
+    const uhwi_snapshot_link* links = ((snap) && (index) < (snap)->count) ? \
+                                      uhwi_snapshot_links(snap) : NULL; \
+    \
+    if (!links || links[index].field == UHWI_SNAPSHOT_LINK_NONE) \
+        return UHWI_NO_DEV; \
+    \
+    return (size_t)links[index].field; \
+}
+
+size_t uhwi_usb_parent(const uhwi_snapshot* snap, const size_t index) {
+    UHWI_SNAPSHOT_LINK(snap, index, parent)
+}
+
+size_t uhwi_usb_first_child(const uhwi_snapshot* snap, const size_t index) {
+    UHWI_SNAPSHOT_LINK(snap, index, first_child)
+}
+
+size_t uhwi_usb_next_sibling(const uhwi_snapshot* snap, const size_t index) {
+    UHWI_SNAPSHOT_LINK(snap, index, next_sibling)
+}
+
+int uhwi_usb_walk(const uhwi_snapshot* snap, uhwi_usb_walk_cb cb,
+                  void* userdata) {
+    if (!snap || !cb)
+        return 0;
+
+    const uhwi_snapshot_link* links = uhwi_snapshot_links(snap);
+
+    if (!links)
+        return -1;
+
+    // depth-first, climbing back up through the parent links instead of
+    // keeping a stack
+    uint32_t current = links[snap->count].first_child;
+    size_t depth = 0;
+
+    while (current != UHWI_SNAPSHOT_LINK_NONE) {
+        const int rc = cb(snap, current, depth, userdata);
+
+        if (rc != 0)
+            return rc;
+
+        if (links[current].first_child != UHWI_SNAPSHOT_LINK_NONE) {
+            current = links[current].first_child;
+            depth++;
+            continue;
+        }
+
+        while (depth > 0 &&
+               links[current].next_sibling == UHWI_SNAPSHOT_LINK_NONE) {
+            current = links[current].parent;
+            depth--;
+        }
+
+        // (roots are chained as siblings too)
+        current = links[current].next_sibling;
+    }
+
+    return 0;
+}
+
+uhwi_dev* uhwi_snapshot_view(const uhwi_snapshot* snap, const size_t index,
+                             uhwi_dev* into) {
+    const uhwi_dev_rec* rec = uhwi_snapshot_get(snap, index);
+
+    if (!rec)
+        return NULL;
+
+    memset(into, 0, sizeof(uhwi_dev));
+
+    into->type = (uhwi_dev_t)rec->type;
+
+    into->vendor = rec->vendor;
+    into->device = rec->device;
+
+    into->subvendor = rec->subvendor;
+    into->subdevice = rec->subdevice;
+
+    into->addr = rec->addr;
+    into->flags = rec->flags;
+
+    snprintf(into->name, UHWI_DEV_NAME_MAX_LEN, "%s",
+             uhwi_snapshot_str(snap, rec->name));
+
+    return into;
+}
+
+uhwi_dev* uhwi_snapshot_to_list(const uhwi_snapshot* snap) {
+    uhwi_dev* first = NULL;
+    uhwi_dev* last = NULL;
+
+    for (size_t index = 0; index < uhwi_snapshot_count(snap); index++) {
+        uhwi_dev* current = uhwi_mem_alloc(sizeof(uhwi_dev));
+
+        if (!current) {
+            uhwi_clean_up(first);
+
+            uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+            return NULL;
+        }
+
+        uhwi_snapshot_view(snap, index, current);
+
+        if (last)
+            last->next = current;
+        else
+            first = current;
+
+        last = current;
+    }
+
+    return first;
+}
+
+int uhwi_snapshot_write_all(const int fd, const void* data, size_t len) {
+    const char* from = data;
+
+    while (len > 0) {
+        const ssize_t written = write(fd, from, len);
+
+        if (written < 0)
+            return -1;
+
+        from += written;
+        len -= (size_t)written;
+    }
+
+    return 0;
+}
+
+size_t uhwi_snapshot_encode(const uhwi_snapshot* snap, void* into,
+                            const size_t max) {
+    const size_t recs_len = snap->count * sizeof(uhwi_dev_rec);
+    const size_t len = sizeof(uhwi_snapshot_hdr) + recs_len + snap->strings.len;
+
+    if (len > max)
+        return len;
+
+    uhwi_snapshot_hdr* hdr = into;
+    memset(hdr, 0, sizeof(uhwi_snapshot_hdr));
+
+    memcpy(hdr->magic, UHWI_SNAPSHOT_MAGIC, sizeof(hdr->magic));
+    hdr->version = UHWI_SNAPSHOT_VERSION;
+    hdr->byte_order = UHWI_SNAPSHOT_BYTE_ORDER;
+
+    hdr->rec_size = sizeof(uhwi_dev_rec);
+    hdr->count = (uint32_t)snap->count;
+    hdr->strings_len = (uint32_t)snap->strings.len;
+
+    char* to = (char*)into + sizeof(uhwi_snapshot_hdr);
+
+    if (recs_len > 0)
+        memcpy(to, snap->devs, recs_len);
+
+    memcpy(to + recs_len, snap->strings.data, snap->strings.len);
+    return len;
+}
+
+int uhwi_snapshot_save(const uhwi_snapshot* snap, const int fd) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    if (!snap)
+        return -1;
+
+    const size_t len = uhwi_snapshot_encode(snap, NULL, 0);
+    void* data = uhwi_mem_alloc(len);
+
+    if (!data) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    uhwi_snapshot_encode(snap, data, len);
+
+    const int rc = uhwi_snapshot_write_all(fd, data, len);
+    uhwi_mem_free(data);
+
+    if (rc < 0) {
+        uhwi_last_errno = UHWI_ERRNO_SNAPSHOT_IO;
+        return -1;
+    }
+
+    return 0;
+}
+
+// validates the header and points a new snapshot into the data as is, nothing
+// but the header is looked at (string references are bounds-checked lazily by
+// uhwi_snapshot_str())
+uhwi_snapshot* uhwi_snapshot_wrap(void* data, const size_t len,
+                                  const uhwi_snapshot_backing_t backing) {
+    const uhwi_snapshot_hdr* hdr = data;
+
+    if (len < sizeof(uhwi_snapshot_hdr) ||
+        ((uintptr_t)data % sizeof(uint64_t)) != 0 ||
+        memcmp(hdr->magic, UHWI_SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != UHWI_SNAPSHOT_VERSION ||
+        hdr->byte_order != UHWI_SNAPSHOT_BYTE_ORDER ||
+        hdr->rec_size != sizeof(uhwi_dev_rec) || hdr->strings_len == 0) {
+        uhwi_last_errno = UHWI_ERRNO_SNAPSHOT_FORMAT;
+        return NULL;
+    }
+
+    // (a bogus count can't overflow the multiplication on 32-bit hosts)
+    if (hdr->count > (len - sizeof(uhwi_snapshot_hdr)) / sizeof(uhwi_dev_rec)) {
+        uhwi_last_errno = UHWI_ERRNO_SNAPSHOT_FORMAT;
+        return NULL;
+    }
+
+    const size_t recs_len = (size_t)hdr->count * sizeof(uhwi_dev_rec);
+
+    if ((len - sizeof(uhwi_snapshot_hdr)) < recs_len ||
+        (len - sizeof(uhwi_snapshot_hdr) - recs_len) < hdr->strings_len) {
+        // truncated
+        uhwi_last_errno = UHWI_ERRNO_SNAPSHOT_FORMAT;
+        return NULL;
+    }
+
+    char* strings = (char*)data + sizeof(uhwi_snapshot_hdr) + recs_len;
+
+    // every name is then guaranteed to end within the string table
+    if (strings[hdr->strings_len - 1] != '\0') {
+        uhwi_last_errno = UHWI_ERRNO_SNAPSHOT_FORMAT;
+        return NULL;
+    }
+
+    uhwi_snapshot* snap = uhwi_mem_alloc(sizeof(uhwi_snapshot));
+
+    if (!snap) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return NULL;
+    }
+
+    memset(snap, 0, sizeof(uhwi_snapshot));
+
+    snap->devs = (uhwi_dev_rec*)((char*)data + sizeof(uhwi_snapshot_hdr));
+    snap->count = hdr->count;
+    snap->cap = hdr->count;
+
+    snap->strings.data = strings;
+    snap->strings.len = hdr->strings_len;
+    snap->strings.cap = hdr->strings_len;
+
+    snap->refs = 1;
+
+    snap->backing = backing;
+    snap->map = data;
+    snap->map_len = len;
+
+    return snap;
+}
+
+uhwi_snapshot* uhwi_snapshot_load_prefixed(const char* path, void* prefix,
+                                           const size_t prefix_len) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size <= 0) {
+        if (fd >= 0)
+            close(fd);
+
+        uhwi_last_errno = UHWI_ERRNO_SNAPSHOT_IO;
+        return NULL;
+    }
+
+    const size_t len = (size_t)st.st_size;
+    void* data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // the mapping stays valid on its own
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        uhwi_last_errno = UHWI_ERRNO_SNAPSHOT_IO;
+        return NULL;
+    }
+
+    uhwi_snapshot* snap = NULL;
+
+    if (len >= prefix_len) {
+        if (prefix_len > 0)
+            memcpy(prefix, data, prefix_len);
+
+        snap = uhwi_snapshot_wrap((char*)data + prefix_len, len - prefix_len,
+                                  UHWI_SNAPSHOT_MMAP);
+    } else
+        uhwi_last_errno = UHWI_ERRNO_SNAPSHOT_FORMAT;
+
+    if (!snap) {
+        munmap(data, len);
+        return NULL;
+    }
+
+    // the whole mapping is released along with the snapshot
+    snap->map = data;
+    snap->map_len = len;
+
+    return snap;
+}
+
+uhwi_snapshot* uhwi_snapshot_load(const char* path) {
+    return uhwi_snapshot_load_prefixed(path, NULL, 0);
+}
+
+uhwi_snapshot* uhwi_snapshot_adopt(void* data, const size_t len) {
+    uhwi_snapshot* snap = uhwi_snapshot_wrap(data, len, UHWI_SNAPSHOT_OWNED);
+
+    if (!snap)
+        uhwi_mem_free(data);
+
+    return snap;
+}
+
+uhwi_snapshot* uhwi_snapshot_from_buf(const void* data, const size_t len) {
+    uhwi_last_errno = UHWI_ERRNO_OK;
+
+    // (nothing is ever written through the pointer)
+    return uhwi_snapshot_wrap((void*)data, len, UHWI_SNAPSHOT_BORROWED);
+}
+
+uhwi_snapshot* uhwi_snapshot_ref(uhwi_snapshot* snap) {
+    if (snap)
+        __atomic_add_fetch(&snap->refs, 1, __ATOMIC_RELAXED);
+
+    return snap;
+}
+
+void uhwi_snapshot_free(uhwi_snapshot* snap) {
+    if (!snap)
+        return;
+
+    // still shared with someone else (e.g. the cache)
+    if (__atomic_sub_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    uhwi_mem_free(snap->by_addr);
+    uhwi_mem_free(snap->usb_links);
+
+    switch (snap->backing) {
+        case UHWI_SNAPSHOT_HEAP: {
+            uhwi_mem_free(snap->devs);
+            uhwi_strpool_free(&snap->strings);
+            break;
+        }
+        case UHWI_SNAPSHOT_MMAP: {
+            munmap(snap->map, snap->map_len);
+            break;
+        }
+        case UHWI_SNAPSHOT_OWNED: {
+            uhwi_mem_free(snap->map);
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    uhwi_mem_free(snap);
+}
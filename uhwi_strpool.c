@@ -0,0 +1,192 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "uhwi_internal.h"
+
+#define UHWI_STRPOOL_CAP_BASE 256
+#define UHWI_STRPOOL_SLOTS_BASE 64
+
+// FNV-1a, good enough for short device name C strings
+uint32_t uhwi_strpool_hash(const char* str, const size_t len) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t index = 0; index < len; index++) {
+        hash ^= (uint8_t)str[index];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+int uhwi_strpool_init(uhwi_strpool* pool) {
+    memset(pool, 0, sizeof(uhwi_strpool));
+
+    // reserve offset 0 for the empty C string, so that zero-initialized
+    // records refer to a valid name
+    pool->data = uhwi_mem_alloc(UHWI_STRPOOL_CAP_BASE);
+
+    if (!pool->data) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    pool->cap = UHWI_STRPOOL_CAP_BASE;
+
+    pool->data[0] = '\0';
+    pool->len = 1;
+
+    return 0;
+}
+
+int uhwi_strpool_rehash(uhwi_strpool* pool, const size_t nslots) {
+    uhwi_str_t* slots = uhwi_mem_calloc(nslots, sizeof(uhwi_str_t));
+
+    if (!slots) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    for (size_t index = 0; index < pool->nslots; index++) {
+        const uhwi_str_t str = pool->slots[index];
+
+        if (str == 0)
+            continue;
+
+        const char* cstr = pool->data + str;
+        size_t slot = uhwi_strpool_hash(cstr, strlen(cstr)) & (nslots - 1);
+
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (nslots - 1);
+
+        slots[slot] = str;
+    }
+
+    uhwi_mem_free(pool->slots);
+
+    pool->slots = slots;
+    pool->nslots = nslots;
+
+    return 0;
+}
+
+// makes room for len more bytes, the pool is left as it was if that fails
+int uhwi_strpool_grow(uhwi_strpool* pool, const size_t len) {
+    if (pool->len + len <= pool->cap)
+        return 0;
+
+    size_t cap = pool->cap ? pool->cap : UHWI_STRPOOL_CAP_BASE;
+
+    while (pool->len + len > cap)
+        cap *= 2;
+
+    char* data = uhwi_mem_realloc(pool->data, cap);
+
+    if (!data) {
+        uhwi_last_errno = UHWI_ERRNO_NO_MEM;
+        return -1;
+    }
+
+    pool->data = data;
+    pool->cap = cap;
+
+    return 0;
+}
+
+uhwi_str_t uhwi_strpool_intern(uhwi_strpool* pool, const char* str,
+                               const size_t len) {
+    if (len == 0)
+        return 0; // the empty C string is always there
+
+    // keep the interning table at most half full
+    if ((!pool->slots || (pool->nstrs + 1) * 2 > pool->nslots) &&
+        uhwi_strpool_rehash(pool, pool->nslots ? pool->nslots * 2 :
+                                                 UHWI_STRPOOL_SLOTS_BASE) < 0)
+        return UHWI_STR_NONE;
+
+    size_t slot = uhwi_strpool_hash(str, len) & (pool->nslots - 1);
+
+    while (pool->slots[slot] != 0) {
+        const char* cstr = pool->data + pool->slots[slot];
+
+        if (memcmp(cstr, str, len) == 0 && cstr[len] == '\0')
+            return pool->slots[slot]; // already interned
+
+        slot = (slot + 1) & (pool->nslots - 1);
+    }
+
+    // append a brand new C string to the pool
+    if (uhwi_strpool_grow(pool, len + 1) < 0)
+        return UHWI_STR_NONE;
+
+    const uhwi_str_t result = (uhwi_str_t)pool->len;
+
+    memcpy(pool->data + pool->len, str, len);
+    pool->data[pool->len + len] = '\0';
+    pool->len += len + 1;
+
+    pool->slots[slot] = result;
+    pool->nstrs++;
+
+    return result;
+}
+
+void uhwi_strpool_seal(uhwi_strpool* pool) {
+    uhwi_mem_free(pool->slots);
+
+    pool->slots = NULL;
+    pool->nslots = 0;
+
+    // the pool won't grow anymore, give the slack back (or keep it, if even
+    // shrinking fails)
+    char* data = uhwi_mem_realloc(pool->data, pool->len);
+
+    if (data) {
+        pool->data = data;
+        pool->cap = pool->len;
+    }
+}
+
+uhwi_str_t uhwi_strpool_append(uhwi_strpool* pool, const uhwi_strpool* other) {
+    // (the other pool's leading empty C string is the same as ours)
+    const size_t len = other->len - 1;
+
+    if (uhwi_strpool_grow(pool, len) < 0)
+        return UHWI_STR_NONE;
+
+    const uhwi_str_t delta = (uhwi_str_t)(pool->len - 1);
+
+    memcpy(pool->data + pool->len, other->data + 1, len);
+    pool->len += len;
+
+    return delta;
+}
+
+void uhwi_strpool_free(uhwi_strpool* pool) {
+    uhwi_mem_free(pool->slots);
+    uhwi_mem_free(pool->data);
+
+    memset(pool, 0, sizeof(uhwi_strpool));
+}
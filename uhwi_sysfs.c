@@ -0,0 +1,361 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifdef __linux__
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <dirent.h>
+
+#include "uhwi_internal.h"
+
+#define UHWI_PCI_DIR_PATH_CONST "/sys/bus/pci/devices"
+#define UHWI_USB_DIR_PATH_CONST "/sys/bus/usb/devices"
+
+#define UHWI_CPU_DIR_PATH_CONST "/sys/devices/system/cpu"
+#define UHWI_MEM_DIR_PATH_CONST "/sys/devices/system/memory"
+#define UHWI_BLOCK_DIR_PATH_CONST "/sys/block"
+
+// "label/path" of an attribute, longer ones are never read
+#define UHWI_SYSFS_REL_PATH_MAX 256
+
+// IDs & addresses are short, names are read right into what is left of the
+// record's buffer
+#define UHWI_SYSFS_VALUE_MAX 32
+
+#define UHWI_SYSFS_CLASS(type, dir, attrs) \
+    { type, dir, attrs, sizeof(attrs) / sizeof(attrs[0]) }
+
+// every device's label is its address, anything else in the directories
+// (interfaces, cpufreq/, ...) fails to parse and is skipped without a single
+// read
+const uhwi_sysfs_attr uhwi_sysfs_pci_attrs[] = {
+    { NULL, UHWI_SYSFS_ADDR, UHWI_SYSFS_LABEL | UHWI_SYSFS_MANDATORY },
+
+    { "vendor", UHWI_SYSFS_VENDOR, UHWI_SYSFS_PREFIXED | UHWI_SYSFS_MANDATORY },
+    { "device", UHWI_SYSFS_DEVICE, UHWI_SYSFS_PREFIXED | UHWI_SYSFS_MANDATORY },
+
+    { "subsystem_vendor", UHWI_SYSFS_SUBVENDOR,
+      UHWI_SYSFS_PREFIXED | UHWI_SYSFS_OPTIONAL },
+    { "subsystem_device", UHWI_SYSFS_SUBDEVICE,
+      UHWI_SYSFS_PREFIXED | UHWI_SYSFS_OPTIONAL },
+
+    { NULL, UHWI_SYSFS_NAME, UHWI_SYSFS_PCI_DB | UHWI_SYSFS_OPTIONAL }
+};
+
+const uhwi_sysfs_attr uhwi_sysfs_usb_attrs[] = {
+    { NULL, UHWI_SYSFS_ADDR, UHWI_SYSFS_LABEL | UHWI_SYSFS_MANDATORY },
+
+    { "idVendor", UHWI_SYSFS_VENDOR, UHWI_SYSFS_MANDATORY },
+    { "idProduct", UHWI_SYSFS_DEVICE, UHWI_SYSFS_MANDATORY },
+
+    // self-reported strings make the kernel query the device
+    { "manufacturer", UHWI_SYSFS_NAME, UHWI_SYSFS_OPTIONAL },
+    { "product", UHWI_SYSFS_NAME, UHWI_SYSFS_OPTIONAL }
+};
+
+const uhwi_sysfs_attr uhwi_sysfs_cpu_attrs[] = {
+    { NULL, UHWI_SYSFS_ADDR, UHWI_SYSFS_LABEL | UHWI_SYSFS_MANDATORY },
+
+    // (offline CPUs have no topology)
+    { "topology/physical_package_id", UHWI_SYSFS_VENDOR, UHWI_SYSFS_DECIMAL },
+    { "topology/core_id", UHWI_SYSFS_DEVICE, UHWI_SYSFS_DECIMAL }
+};
+
+const uhwi_sysfs_attr uhwi_sysfs_mem_attrs[] = {
+    { NULL, UHWI_SYSFS_ADDR, UHWI_SYSFS_LABEL | UHWI_SYSFS_MANDATORY },
+
+    // "online" or "offline"
+    { "state", UHWI_SYSFS_NAME, 0 }
+};
+
+const uhwi_sysfs_attr uhwi_sysfs_block_attrs[] = {
+    { "dev", UHWI_SYSFS_ADDR, UHWI_SYSFS_MANDATORY },
+
+    // virtual devices (loop, zram, ...) have nothing behind them
+    { "device", UHWI_SYSFS_PRESENT, UHWI_SYSFS_MANDATORY },
+
+    // virtio disks carry IDs of their own, NVMe namespaces sit on a controller
+    // which in turn sits on a PCI device
+    { "device/vendor", UHWI_SYSFS_VENDOR, UHWI_SYSFS_PREFIXED },
+    { "device/device", UHWI_SYSFS_DEVICE, UHWI_SYSFS_PREFIXED },
+    { "device/device/vendor", UHWI_SYSFS_VENDOR, UHWI_SYSFS_PREFIXED },
+    { "device/device/device", UHWI_SYSFS_DEVICE, UHWI_SYSFS_PREFIXED },
+
+    { "device/device/subsystem_vendor", UHWI_SYSFS_SUBVENDOR,
+      UHWI_SYSFS_PREFIXED | UHWI_SYSFS_OPTIONAL },
+    { "device/device/subsystem_device", UHWI_SYSFS_SUBDEVICE,
+      UHWI_SYSFS_PREFIXED | UHWI_SYSFS_OPTIONAL },
+
+    // "nvme0n1 Samsung SSD 980 1TB"
+    { NULL, UHWI_SYSFS_NAME, UHWI_SYSFS_LABEL },
+    { "device/model", UHWI_SYSFS_NAME, UHWI_SYSFS_OPTIONAL }
+};
+
+const uhwi_sysfs_class uhwi_sysfs_classes[] = {
+    UHWI_SYSFS_CLASS(UHWI_DEV_PCI, UHWI_PCI_DIR_PATH_CONST, uhwi_sysfs_pci_attrs),
+    UHWI_SYSFS_CLASS(UHWI_DEV_USB, UHWI_USB_DIR_PATH_CONST, uhwi_sysfs_usb_attrs),
+    UHWI_SYSFS_CLASS(UHWI_DEV_CPU, UHWI_CPU_DIR_PATH_CONST, uhwi_sysfs_cpu_attrs),
+    UHWI_SYSFS_CLASS(UHWI_DEV_MEM, UHWI_MEM_DIR_PATH_CONST, uhwi_sysfs_mem_attrs),
+    UHWI_SYSFS_CLASS(UHWI_DEV_BLOCK, UHWI_BLOCK_DIR_PATH_CONST,
+                     uhwi_sysfs_block_attrs)
+};
+
+#undef UHWI_SYSFS_CLASS
+
+const uhwi_sysfs_class* uhwi_sysfs_class_of(const uhwi_dev_t type) {
+    // (the table is in uhwi_dev_t order, starting with PCI)
+    if (type == UHWI_DEV_NULL || (size_t)type >
+        sizeof(uhwi_sysfs_classes) / sizeof(uhwi_sysfs_classes[0]))
+        return NULL;
+
+    return &uhwi_sysfs_classes[type - 1];
+}
+
+// reads an attribute relative to the class directory into the buffer (which
+// ends up NUL-terminated, without trailing whitespace), returns its length or
+// -1 if it can't be read
+ssize_t uhwi_sysfs_read_attr(const int dfd, const char* label, const char* path,
+                             char* buf, const size_t max) {
+    char rel[UHWI_SYSFS_REL_PATH_MAX];
+
+    const size_t label_len = strlen(label);
+    const size_t path_len = strlen(path);
+
+    if (label_len + path_len + 2 > sizeof(rel))
+        return -1;
+
+    // (cheaper than snprintf() in a loop that mostly waits on syscalls anyway,
+    // but still)
+    memcpy(rel, label, label_len);
+    rel[label_len] = '/';
+    memcpy(rel + label_len + 1, path, path_len + 1);
+
+    // a single openat() instead of access() + open() of an absolute path
+    const int fd = openat(dfd, rel, O_RDONLY | O_CLOEXEC, 0);
+
+    if (fd < 0)
+        return -1;
+
+    // the mere existence of directories is checked with a zero-sized buffer
+    ssize_t len = (max > 1) ? read(fd, buf, max - 1) : 0;
+    close(fd);
+
+    if (len < 0)
+        return -1;
+
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' '))
+        len--;
+
+    if (max > 0)
+        buf[len] = '\0';
+
+    return len;
+}
+
+// appends a C string to the name, separated by a space from what is there
+void uhwi_sysfs_name_cat(uhwi_dev* result, const char* str, size_t len) {
+    size_t used = strlen(result->name);
+
+    if (len == 0)
+        return;
+
+    if (used > 0 && used < UHWI_DEV_NAME_MAX_LEN - 1)
+        result->name[used++] = ' ';
+
+    // never append past the end of the buffer
+    if (used + len > UHWI_DEV_NAME_MAX_LEN - 1)
+        len = UHWI_DEV_NAME_MAX_LEN - 1 - used;
+
+    memcpy(result->name + used, str, len);
+    result->name[used + len] = '\0';
+}
+
+uhwi_dev* uhwi_sysfs_read_dev(const uhwi_sysfs_class* cls, const int dfd,
+                              const char* label, uhwi_dev* result,
+                              uhwi_db* db) {
+    memset(result, 0, sizeof(uhwi_dev));
+    result->type = cls->type;
+
+    for (size_t index = 0; index < cls->nattrs; index++) {
+        const uhwi_sysfs_attr* attr = &cls->attrs[index];
+
+        // past the deadline, the optional values are left out
+        if ((attr->flags & UHWI_SYSFS_OPTIONAL) && uhwi_deadline_passed()) {
+            result->flags |= UHWI_DEV_PARTIAL;
+            continue;
+        }
+
+        if (attr->flags & UHWI_SYSFS_PCI_DB) {
+#ifdef UHWI_ENABLE_PCI_DB
+            if (db)
+                uhwi_db_strncpy_name(db, result->vendor, result->device,
+                                     result->name, UHWI_DEV_NAME_MAX_LEN);
+#endif
+            continue;
+        }
+
+        char value[UHWI_SYSFS_VALUE_MAX];
+        const char* str = value;
+        ssize_t len = 0;
+
+        UHWI_TRACE_START(since)
+
+        if (attr->flags & UHWI_SYSFS_LABEL) {
+            str = label;
+            len = (ssize_t)strlen(label);
+        } else if (attr->field == UHWI_SYSFS_NAME) {
+            // names go straight into the record, right where they belong
+            const size_t used = strlen(result->name);
+            const size_t at = used + (used > 0);
+
+            if (at >= UHWI_DEV_NAME_MAX_LEN - 1)
+                continue;
+
+            len = uhwi_sysfs_read_attr(dfd, label, attr->path,
+                                       result->name + at,
+                                       UHWI_DEV_NAME_MAX_LEN - at);
+
+            if (len > 0 && at > used)
+                result->name[used] = ' ';
+            else if (len <= 0)
+                result->name[used] = '\0';
+        } else
+            len = uhwi_sysfs_read_attr(dfd, label, attr->path, value,
+                                       (attr->field == UHWI_SYSFS_PRESENT) ?
+                                       0 : sizeof(value));
+
+        // (labels are the entry's name, nothing is read for them)
+        if (!(attr->flags & UHWI_SYSFS_LABEL)) {
+            UHWI_TRACE_ATTR(since, cls->type, label, attr->path, len)
+        }
+
+        if (len < 0) {
+            if (attr->flags & UHWI_SYSFS_MANDATORY)
+                return NULL;
+
+            continue;
+        }
+
+        switch (attr->field) {
+            case UHWI_SYSFS_VENDOR:
+            case UHWI_SYSFS_DEVICE:
+            case UHWI_SYSFS_SUBVENDOR:
+            case UHWI_SYSFS_SUBDEVICE: {
+                uint32_t id = 0;
+
+                if (attr->flags & UHWI_SYSFS_DECIMAL) {
+                    if (!uhwi_addr_parse_num(str, 10, &id))
+                        continue;
+                } else if (attr->flags & UHWI_SYSFS_PREFIXED) {
+                    // (the decoder reads 4 digits past the prefix no matter
+                    // what, the rest of the buffer is zeroed for it)
+                    if (len < 3 || str[0] != '0' || str[1] != 'x')
+                        continue;
+
+                    memset(value + len, 0, sizeof(value) - (size_t)len);
+                    id = uhwi_hex_id(str, 1);
+                } else {
+                    memset(value + len, 0, sizeof(value) - (size_t)len);
+                    id = uhwi_hex_id(str, 0);
+                }
+
+                uhwi_id_t* ids[] = { &result->vendor, &result->device,
+                                     &result->subvendor, &result->subdevice };
+
+                *ids[attr->field - UHWI_SYSFS_VENDOR] = (uhwi_id_t)id;
+                break;
+            }
+            case UHWI_SYSFS_ADDR: {
+                result->addr = uhwi_addr_parse(str);
+
+                if (result->addr == 0 && (attr->flags & UHWI_SYSFS_MANDATORY))
+                    return NULL;
+
+                break;
+            }
+            case UHWI_SYSFS_NAME: {
+                // (attribute values are in the name already)
+                if (attr->flags & UHWI_SYSFS_LABEL)
+                    uhwi_sysfs_name_cat(result, str, (size_t)len);
+
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    return result;
+}
+
+int uhwi_sysfs_foreach(const uhwi_sysfs_class* cls, uhwi_dev_cb cb,
+                       void* userdata, uhwi_db* db) {
+    DIR* dir = opendir(cls->dir);
+
+    if (!dir) {
+        // failed to access the class directory -> fail
+        uhwi_last_errno = UHWI_ERRNO_SYSFS_OPEN;
+        return -1;
+    }
+
+    // attributes are opened relative to the directory itself
+    const int dfd = dirfd(dir);
+
+    // each device is represented by an entry of its own
+    struct dirent* entry = NULL;
+    uhwi_dev current;
+
+    // result of the last callback invocation (non-zero stops the loop)
+    int rc = 0;
+
+    while (rc == 0) {
+        entry = readdir(dir);
+
+        if (!entry)
+            break; // end of directory listing
+        else if (entry->d_name[0] == '.')
+            continue; // skip all hidden or parent reference entries
+
+        UHWI_TRACE_DEV_BEGIN(since, cls->type, entry->d_name)
+
+        // populate the reusable record, skipping whatever isn't a device
+        const uhwi_dev* dev = uhwi_sysfs_read_dev(cls, dfd, entry->d_name,
+                                                  &current, db);
+
+        UHWI_TRACE_DEV_END(since, cls->type, entry->d_name, dev)
+
+        if (!dev)
+            continue;
+
+        rc = cb(&current, userdata);
+    }
+
+    // clean up
+    closedir(dir);
+    return rc;
+}
+#endif
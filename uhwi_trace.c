@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <string.h>
+
+#include "uhwi_internal.h"
+
+#ifdef UHWI_ENABLE_TRACE
+
+uhwi_trace_cb uhwi_trace_fn = NULL;
+void* uhwi_trace_userdata = NULL;
+
+// odd while a registration is in progress, bumped twice by each of them, so
+// that an event never pairs one callback with the userdata of another one
+unsigned int uhwi_trace_seq = 0;
+
+void uhwi_set_trace_cb(uhwi_trace_cb cb, void* userdata) {
+    unsigned int seq = __atomic_load_n(&uhwi_trace_seq, __ATOMIC_RELAXED);
+
+    // (registrations made concurrently take turns)
+    while ((seq & 1) ||
+           !__atomic_compare_exchange_n(&uhwi_trace_seq, &seq, seq + 1, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        seq = __atomic_load_n(&uhwi_trace_seq, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&uhwi_trace_userdata, userdata, __ATOMIC_RELAXED);
+    __atomic_store_n(&uhwi_trace_fn, cb, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&uhwi_trace_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void uhwi_trace_emit(const uhwi_trace_point_t point, const uint64_t since,
+                     const uhwi_dev_t type, const char* label, const char* attr,
+                     const uhwi_id_t vendor, const uhwi_id_t device,
+                     const int64_t result) {
+    uhwi_trace_cb cb = NULL;
+    void* userdata = NULL;
+
+    unsigned int seq = 0;
+
+    // retried if a registration came in between the two loads
+    do {
+        seq = __atomic_load_n(&uhwi_trace_seq, __ATOMIC_ACQUIRE);
+
+        cb = __atomic_load_n(&uhwi_trace_fn, __ATOMIC_RELAXED);
+        userdata = __atomic_load_n(&uhwi_trace_userdata, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) ||
+             seq != __atomic_load_n(&uhwi_trace_seq, __ATOMIC_RELAXED));
+
+    // (the callback may have been unregistered since the span started)
+    if (!cb)
+        return;
+
+    uhwi_trace_event event;
+    memset(&event, 0, sizeof(event));
+
+    event.point = point;
+    event.ns = uhwi_now_ns();
+
+    // spans that started before the callback was registered have no start
+    if (point != UHWI_TRACE_DEV_BEGIN && point != UHWI_TRACE_DB_OPEN_BEGIN &&
+        since != 0)
+        event.elapsed_ns = event.ns - since;
+
+    event.type = type;
+    event.label = label;
+    event.attr = attr;
+
+    event.vendor = vendor;
+    event.device = device;
+
+    event.result = result;
+
+    cb(&event, userdata);
+}
+
+#endif
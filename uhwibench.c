@@ -0,0 +1,438 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+//
+// uhwibench - throughput micro-benchmarks for libuhwi's hot paths, run it as
+//
+//    $ ./uhwibench [/path/to/pci.ids]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+#include <pthread.h>
+
+#include "uhwi_internal.h"
+
+#define UHWIBENCH_DEFAULT_DB_PATH "/usr/share/misc/pci.ids"
+#define UHWIBENCH_ROUNDS 5
+
+double uhwibench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// runs the statement UHWIBENCH_ROUNDS times and keeps the fastest round
+#define UHWIBENCH_BEST(best, stmt) { \
+    best = 0.0; \
+    \
+    for (size_t round = 0; round < UHWIBENCH_ROUNDS; round++) { \
+        const double started = uhwibench_now(); \
+        stmt; \
+        const double took = uhwibench_now() - started; \
+        \
+        if (round == 0 || took < best) \
+            best = took; \
+    } \
+}
+
+#define UHWIBENCH_REPORT_MBPS(label, bytes, secs) \
+    fprintf(stdout, "%-28s %10.1f MB/s\n", label, (double)(bytes) / (secs) / 1e6)
+
+#define UHWIBENCH_REPORT_RATE(label, count, secs, unit) \
+    fprintf(stdout, "%-28s %10.1f M%s/s\n", label, (double)(count) / (secs) / 1e6, unit)
+
+const char* uhwibench_scan_names[] = { "auto", "scalar", "sse2", "avx2" };
+
+size_t uhwibench_count_lines(const char* buf, const size_t len) {
+    const char* line = NULL;
+    const char* eol = NULL;
+
+    size_t count = 0;
+
+    uhwi_lines it;
+    uhwi_lines_init(&it, buf, len);
+
+    while (uhwi_lines_next(&it, &line, &eol))
+        count++;
+
+    return count;
+}
+
+size_t uhwibench_count_lines_memchr(const char* buf, const size_t len) {
+    const char* line = buf;
+    const char* end = buf + len;
+
+    size_t count = 0;
+
+    while (line < end) {
+        const char* eol = memchr(line, '\n', (size_t)(end - line));
+
+        count++;
+        line = eol ? eol + 1 : end;
+    }
+
+    return count;
+}
+
+void uhwibench_scan(const char* buf, const size_t len) {
+    double best = 0.0;
+    volatile size_t sink = 0;
+
+    UHWIBENCH_BEST(best, sink += uhwibench_count_lines_memchr(buf, len))
+    UHWIBENCH_REPORT_MBPS("lines/memchr", len, best);
+
+    for (int impl = UHWI_SCAN_SCALAR; impl <= UHWI_SCAN_AVX2; impl++) {
+        uhwi_scan_select((uhwi_scan_impl_t)impl);
+
+        if (uhwi_scan_impl != (uhwi_scan_impl_t)impl)
+            continue; // not supported by this CPU
+
+        char label[32];
+        snprintf(label, sizeof(label), "lines/%s", uhwibench_scan_names[impl]);
+
+        UHWIBENCH_BEST(best, sink += uhwibench_count_lines(buf, len))
+        UHWIBENCH_REPORT_MBPS(label, len, best);
+    }
+
+    uhwi_scan_select(UHWI_SCAN_AUTO);
+}
+
+void uhwibench_hex_ids(const char* buf, const size_t len) {
+    // collect every vendor & device ID token of the DB
+    size_t count = 0;
+    const char** ids = malloc((len / 4 + 1) * sizeof(const char*));
+
+    const char* line = NULL;
+    const char* eol = NULL;
+
+    uhwi_lines it;
+    uhwi_lines_init(&it, buf, len);
+
+    while (uhwi_lines_next(&it, &line, &eol)) {
+        if (UHWI_IS_HEX(line[0]))
+            ids[count++] = line;
+        else if (line[0] == '\t' && UHWI_IS_HEX(line[1]))
+            ids[count++] = line + 1;
+    }
+
+    double best = 0.0;
+    volatile uint32_t sink = 0;
+
+    // what SSCANF_ID used to do: sscanf() of a tiny NUL-terminated token
+    UHWIBENCH_BEST(best, {
+        for (size_t index = 0; index < count; index++) {
+            char token[5];
+            uint32_t conv = 0;
+
+            memcpy(token, ids[index], 4);
+            token[4] = '\0';
+
+            sscanf(token, "%04x", &conv);
+            sink += conv;
+        }
+    })
+    UHWIBENCH_REPORT_RATE("ids/sscanf", count, best, "ID");
+
+    UHWIBENCH_BEST(best, {
+        for (size_t index = 0; index < count; index++)
+            sink += uhwi_hex_id(ids[index], 0);
+    })
+    UHWIBENCH_REPORT_RATE("ids/table", count, best, "ID");
+
+    free(ids);
+}
+
+#ifdef UHWI_ENABLE_PCI_DB
+void uhwibench_db(const char* path, const size_t len) {
+    double best = 0.0;
+
+    for (int impl = UHWI_SCAN_SCALAR; impl <= UHWI_SCAN_AVX2; impl++) {
+        uhwi_scan_select((uhwi_scan_impl_t)impl);
+
+        if (uhwi_scan_impl != (uhwi_scan_impl_t)impl)
+            continue;
+
+        char label[32];
+
+        snprintf(label, sizeof(label), "db/eager/%s", uhwibench_scan_names[impl]);
+        UHWIBENCH_BEST(best, uhwi_db_close(uhwi_db_open(path)))
+        UHWIBENCH_REPORT_MBPS(label, len, best);
+
+        snprintf(label, sizeof(label), "db/lazy/%s", uhwibench_scan_names[impl]);
+        UHWIBENCH_BEST(best, uhwi_db_close(uhwi_db_open_ex(path, UHWI_DB_LAZY)))
+        UHWIBENCH_REPORT_MBPS(label, len, best);
+
+        snprintf(label, sizeof(label), "db/skim/%s", uhwibench_scan_names[impl]);
+        UHWIBENCH_BEST(best, uhwi_db_close(uhwi_db_open_ex(path, UHWI_DB_SKIM)))
+        UHWIBENCH_REPORT_MBPS(label, len, best);
+    }
+
+    uhwi_scan_select(UHWI_SCAN_AUTO);
+
+    // a single thread is the serial parser, 0 picks a thread per online CPU
+    const size_t threads[] = { 1, 2, 4, 8, 0 };
+
+    for (size_t index = 0; index < sizeof(threads) / sizeof(threads[0]);
+         index++) {
+        char label[32];
+
+        if (threads[index])
+            snprintf(label, sizeof(label), "db/parallel/%u",
+                     (unsigned)threads[index]);
+        else
+            snprintf(label, sizeof(label), "db/parallel/auto");
+
+        uhwi_db_parse_threads = threads[index];
+
+        UHWIBENCH_BEST(best, uhwi_db_close(uhwi_db_open_ex(path,
+                                                           UHWI_DB_PARALLEL)))
+        UHWIBENCH_REPORT_MBPS(label, len, best);
+    }
+
+    uhwi_db_parse_threads = 0;
+}
+
+// a host's worth of devices from a handful of vendors
+const uhwi_id_t uhwibench_host_devs[][2] = {
+    { 0x8086, 0x1572 }, { 0x8086, 0x0d57 }, { 0x8086, 0x2922 },
+    { 0x15b3, 0x1017 }, { 0x10de, 0x1eb8 }, { 0x1af4, 0x1041 },
+    { 0x1022, 0x1480 }, { 0x144d, 0xa808 }
+};
+
+// cold-start naming of a host's devices: open the DB, resolve, close
+size_t uhwibench_db_cold_names(const char* path, const int flags) {
+    uhwi_db* db = uhwi_db_open_ex(path, flags);
+    char name[UHWI_DEV_NAME_MAX_LEN];
+    size_t sink = 0;
+
+    for (size_t index = 0; index < sizeof(uhwibench_host_devs) /
+                                     sizeof(uhwibench_host_devs[0]); index++)
+        sink += (size_t)uhwi_db_strncpy_name(db, uhwibench_host_devs[index][0],
+                                             uhwibench_host_devs[index][1],
+                                             name, sizeof(name));
+
+    uhwi_db_close(db);
+    return sink;
+}
+
+void uhwibench_db_cold(const char* path) {
+    const char* labels[] = { "db/cold/eager", "db/cold/lazy", "db/cold/skim",
+                             "db/cold/skim+sidecar" };
+    const int flags[] = { 0, UHWI_DB_LAZY, UHWI_DB_SKIM,
+                          UHWI_DB_SKIM | UHWI_DB_SIDECAR };
+
+    double best = 0.0;
+    size_t sink = 0;
+
+    // (the first sidecar round writes the file, the best one reads it)
+    for (size_t index = 0; index < sizeof(flags) / sizeof(flags[0]); index++) {
+        UHWIBENCH_BEST(best, sink += uhwibench_db_cold_names(path, flags[index]))
+        fprintf(stdout, "%-28s %10.1f us\n", labels[index], best * 1e6);
+    }
+
+    (void)sink;
+}
+
+// a couple of typical operator queries, from broad to narrow
+const char* uhwibench_search_queries[] = { "ethernet", "ConnectX", "X710" };
+
+void uhwibench_db_search(const char* path) {
+    uhwi_db* db = uhwi_db_open(path);
+
+    if (!db)
+        return;
+
+    double best = 0.0;
+    size_t sink = 0;
+
+    // the first search builds the index
+    UHWIBENCH_BEST(best, {
+        uhwi_db_close(db);
+        db = uhwi_db_open(path);
+        sink += uhwi_db_search(db, "x", NULL, 0);
+    })
+    fprintf(stdout, "%-28s %10.1f ms\n", "db/search/index+open", best * 1e3);
+
+    for (size_t index = 0; index < sizeof(uhwibench_search_queries) /
+                                     sizeof(uhwibench_search_queries[0]); index++) {
+        char label[32];
+        snprintf(label, sizeof(label), "db/search/%s",
+                 uhwibench_search_queries[index]);
+
+        UHWIBENCH_BEST(best, sink += uhwi_db_search(db,
+                                         uhwibench_search_queries[index],
+                                         NULL, 0))
+        fprintf(stdout, "%-28s %10.1f us\n", label, best * 1e6);
+    }
+
+    uhwi_db_close(db);
+    (void)sink;
+}
+
+#define UHWIBENCH_LOOKUPS 1000000
+
+typedef struct {
+    uhwi_db_shared* shared;
+
+    volatile int stop;
+    size_t reloads;
+} uhwibench_reloader;
+
+void* uhwibench_reload(void* userdata) {
+    uhwibench_reloader* reloader = userdata;
+
+    // as if the DB file kept getting replaced every few milliseconds
+    const struct timespec pause = { 0, 10000000L };
+
+    while (!reloader->stop) {
+        uhwi_db_shared_reload(reloader->shared, 1);
+        reloader->reloads++;
+
+        nanosleep(&pause, NULL);
+    }
+
+    return NULL;
+}
+
+size_t uhwibench_db_lookups(uhwi_db_shared* shared) {
+    char name[UHWI_DEV_NAME_MAX_LEN];
+    size_t found = 0;
+
+    // IDs spread over the whole DB, known or not
+    for (uint32_t index = 0; index < UHWIBENCH_LOOKUPS; index++)
+        found += uhwi_db_shared_strncpy_name(shared,
+                                             (uhwi_id_t)(index * 40503u),
+                                             (uhwi_id_t)(index * 2654435761u),
+                                             name, sizeof(name));
+
+    return found;
+}
+
+void uhwibench_db_shared(const char* path) {
+    uhwi_db_shared* shared = uhwi_db_shared_open(path, 0);
+
+    if (!shared)
+        return;
+
+    double best = 0.0;
+    volatile size_t sink = 0;
+
+    UHWIBENCH_BEST(best, sink += uhwibench_db_lookups(shared))
+    UHWIBENCH_REPORT_RATE("db/shared/idle", UHWIBENCH_LOOKUPS, best, "lookup");
+
+    // lookups are supposed to stay just as fast while versions are swapped
+    uhwibench_reloader reloader = { shared, 0, 0 };
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, uhwibench_reload, &reloader) == 0) {
+        UHWIBENCH_BEST(best, sink += uhwibench_db_lookups(shared))
+
+        reloader.stop = 1;
+        pthread_join(thread, NULL);
+
+        UHWIBENCH_REPORT_RATE("db/shared/reloading", UHWIBENCH_LOOKUPS, best,
+                              "lookup");
+        fprintf(stdout, "%-28s %10zu\n", "db/shared/reloads", reloader.reloads);
+    }
+
+    uhwi_db_shared_close(shared);
+}
+#endif
+
+#ifdef __linux__
+int uhwibench_count_dev(const uhwi_dev* dev, void* userdata) {
+    (void)dev;
+    (*(size_t*)userdata)++;
+
+    return 0;
+}
+
+// every device class goes through the same table-driven sysfs reader, so these
+// are the actual syscall costs per device (PCI devices are not named here)
+void uhwibench_sysfs(void) {
+    const char* names[] = { NULL, "pci", "usb", "cpu", "mem", "block" };
+
+    for (uhwi_dev_t type = UHWI_DEV_PCI; type <= UHWI_DEV_BLOCK; type++) {
+        double best = 0.0;
+        size_t count = 0;
+
+        UHWIBENCH_BEST(best, {
+            count = 0;
+            uhwi_sysfs_foreach(uhwi_sysfs_class_of(type), uhwibench_count_dev,
+                               &count, NULL);
+        })
+
+        char label[32];
+        snprintf(label, sizeof(label), "sysfs/%s (%zu)", names[type], count);
+
+        fprintf(stdout, "%-28s %10.1f us/dev\n", label,
+                        best * 1e6 / (double)(count ? count : 1));
+    }
+}
+#endif
+
+int main(const int argc, const char** argv) {
+    const char* path = (argc > 1) ? argv[1] : UHWIBENCH_DEFAULT_DB_PATH;
+    FILE* fp = fopen(path, "rb");
+
+    if (!fp) {
+        fprintf(stderr, "%s: unable to open %s\n", argv[0], path);
+        return 1;
+    }
+
+    // the whole DB stays in memory so that only the parsing is measured
+    fseek(fp, 0, SEEK_END);
+    const size_t len = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char* buf = malloc(len + 1);
+    const size_t rdsz = fread(buf, 1, len, fp);
+
+    buf[rdsz] = '\0';
+    fclose(fp);
+
+    fprintf(stdout, "%s: %zu bytes, best of %d rounds\n", path, rdsz,
+                    UHWIBENCH_ROUNDS);
+
+    uhwibench_scan(buf, rdsz);
+    uhwibench_hex_ids(buf, rdsz);
+
+#ifdef __linux__
+    uhwibench_sysfs();
+#endif
+
+#ifdef UHWI_ENABLE_PCI_DB
+    uhwibench_db(path, rdsz);
+    uhwibench_db_cold(path);
+    uhwibench_db_shared(path);
+    uhwibench_db_search(path);
+#endif
+
+    free(buf);
+    return 0;
+}
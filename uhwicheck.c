@@ -0,0 +1,536 @@
+//
+// Copyright (C) 2023 Universe-OS
+// Copyright (C) 2023 Tim K. <timk@xfen.page>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+//
+// uhwicheck - regression checks for inputs libuhwi has to survive, run it (best
+// built with -fsanitize=address) as
+//
+//    $ ./uhwicheck
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "uhwi_internal.h"
+
+size_t uhwicheck_failures = 0;
+
+#define UHWICHECK(cond, ...) { \
+    if (!(cond)) { \
+        fprintf(stdout, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stdout, __VA_ARGS__); \
+        fputc('\n', stdout); \
+        \
+        uhwicheck_failures++; \
+    } \
+}
+
+// writes the contents into a fresh temporary file, whose path goes into path
+// (which must hold UHWICHECK_PATH_MAX bytes)
+#define UHWICHECK_PATH_MAX 64
+
+int uhwicheck_write_tmp(const char* contents, const size_t len, char* path) {
+    snprintf(path, UHWICHECK_PATH_MAX, "/tmp/uhwicheck.XXXXXX");
+    const int fd = mkstemp(path);
+
+    if (fd < 0)
+        return -1;
+
+    const int rc = (write(fd, contents, len) == (ssize_t)len) ? 0 : -1;
+    close(fd);
+
+    return rc;
+}
+
+// addresses of every type, which have to survive being formatted and parsed
+// back
+typedef struct {
+    uhwi_addr_t addr;
+    const char* str;
+} uhwicheck_addr_case;
+
+#define UHWICHECK_USB_CHAIN(bus, depth) \
+    UHWI_ADDR_USB_WITH_PORT(UHWI_ADDR_USB_WITH_PORT( \
+        UHWI_ADDR_USB_WITH_PORT(UHWI_ADDR_USB_WITH_PORT( \
+            UHWI_ADDR_USB_WITH_PORT(UHWI_ADDR_USB_WITH_PORT(UHWI_ADDR_USB(bus), \
+                0, 1), 1, 2), 2, 3), 3, 4), 4, 5), 5, (depth) == 6 ? 255 : 0)
+
+const uhwicheck_addr_case uhwicheck_addr_cases[] = {
+    { UHWI_ADDR_PCI(0, 0, 0x1f, 3), "0000:00:1f.3" },
+    { UHWI_ADDR_PCI(0x10000, 0xff, 0x1f, 7), "10000:ff:1f.7" },
+    { UHWI_ADDR_USB(1), "usb1" },
+    { UHWI_ADDR_USB_WITH_PORT(UHWI_ADDR_USB(255), 0, 255), "255-255" },
+    { UHWICHECK_USB_CHAIN(3, 5), "3-1.2.3.4.5" },
+    { UHWICHECK_USB_CHAIN(3, 6), "3-1.2.3.4.5.255" },
+    { UHWI_ADDR_CPU(0), "cpu0" },
+    { UHWI_ADDR_CPU(4294967295u), "cpu4294967295" },
+    { UHWI_ADDR_MEM(12), "memory12" },
+    { UHWI_ADDR_BLOCK(259, 0), "259:0" },
+    { UHWI_ADDR_BLOCK(0xffffff, 4294967295u), "16777215:4294967295" }
+};
+
+// things that look like addresses, but aren't any
+const char* const uhwicheck_addr_rejects[] = {
+    "", "1-1:1.0", "cpufreq", "cpu", "cpu1x", "memory", "usb", "usb256",
+    "1-1.2.3.4.5.6.7", "1-0", "256-1", "1-256", "1-", "1", "0000:100:00.0",
+    "0000:00:20.0", "0000:00:1f.8", "0000:00:1f.", "0000:00:1f.3x", "00:1f",
+    "0000:00:1f.3.1", "8:", ":0", "16777216:0", "8:4294967296",
+    "cpu4294967296", "100000000:00:00.0"
+};
+
+void uhwicheck_addr(void) {
+    for (size_t index = 0; index < sizeof(uhwicheck_addr_cases) /
+                                     sizeof(uhwicheck_addr_cases[0]); index++) {
+        const uhwicheck_addr_case* addrcase = &uhwicheck_addr_cases[index];
+        char str[64];
+
+        uhwi_addr_format(addrcase->addr, str, sizeof(str));
+
+        UHWICHECK(strcmp(str, addrcase->str) == 0,
+                  "address: \"%s\" formatted as \"%s\"", addrcase->str, str)
+        UHWICHECK(uhwi_addr_parse(str) == addrcase->addr,
+                  "address: \"%s\" doesn't parse back", str)
+    }
+
+    for (size_t index = 0; index < sizeof(uhwicheck_addr_rejects) /
+                                     sizeof(uhwicheck_addr_rejects[0]); index++)
+        UHWICHECK(uhwi_addr_parse(uhwicheck_addr_rejects[index]) == 0,
+                  "address: \"%s\" accepted", uhwicheck_addr_rejects[index])
+
+    // the PCI domain may be left out
+    UHWICHECK(uhwi_addr_parse("00:1f.3") == UHWI_ADDR_PCI(0, 0, 0x1f, 3),
+              "address: \"00:1f.3\" isn't in domain 0")
+}
+
+
+// binary snapshots have to come back exactly as saved, whereas truncated or
+// forged ones must be rejected before anything past the buffer is looked at
+#define UHWICHECK_SNAPSHOT_DEVS 5
+
+// offsets of the record count & the string table length within the header
+#define UHWICHECK_SNAPSHOT_COUNT_AT 12
+#define UHWICHECK_SNAPSHOT_STRINGS_LEN_AT 16
+
+// wraps a copy of the (possibly patched) encoding that is exactly len bytes
+// long and placed skew bytes past an 8-byte boundary, returns whether it was
+// rejected as malformed
+int uhwicheck_snapshot_rejects(const char* data, const size_t len,
+                               const size_t at, const uint32_t value,
+                               const size_t skew) {
+    char* copy = malloc(len + skew);
+
+    if (!copy)
+        return 0;
+
+    memcpy(copy + skew, data, len);
+
+    if (at + sizeof(value) <= len)
+        memcpy(copy + skew + at, &value, sizeof(value));
+
+    uhwi_snapshot* snap = uhwi_snapshot_from_buf(copy + skew, len);
+    const int rejected = !snap &&
+                         uhwi_last_errno == UHWI_ERRNO_SNAPSHOT_FORMAT;
+
+    uhwi_snapshot_free(snap);
+    free(copy);
+
+    return rejected;
+}
+
+void uhwicheck_snapshot_binary(void) {
+    uhwi_snapshot* snap = uhwi_snapshot_alloc();
+
+    if (!snap) {
+        UHWICHECK(0, "snapshot: not allocated")
+        return;
+    }
+
+    for (size_t index = 0; index < UHWICHECK_SNAPSHOT_DEVS; index++) {
+        uhwi_dev dev;
+        memset(&dev, 0, sizeof(uhwi_dev));
+
+        dev.type = (index % 2) ? UHWI_DEV_USB : UHWI_DEV_PCI;
+        dev.vendor = (uhwi_id_t)(0x1af4 + index);
+        dev.device = (uhwi_id_t)(0x1000 + index);
+        dev.subvendor = (uhwi_id_t)index;
+        dev.subdevice = (uhwi_id_t)(index * 2);
+        dev.addr = UHWI_ADDR_PCI(0, 0, index, 0);
+        dev.flags = (uint16_t)(index % 2);
+
+        // (a couple of them share their name)
+        snprintf(dev.name, sizeof(dev.name), "Device %zu", index / 2);
+
+        UHWICHECK(uhwi_snapshot_append(&dev, snap) == 0,
+                  "snapshot: device %zu not appended", index)
+    }
+
+    uhwi_snapshot_finish(snap);
+
+    // malloc()ed buffers are suitably aligned
+    const size_t len = uhwi_snapshot_encode(snap, NULL, 0);
+    char* data = malloc(len);
+
+    if (!data) {
+        UHWICHECK(0, "snapshot: %zu bytes not allocated", len)
+        uhwi_snapshot_free(snap);
+        return;
+    }
+
+    UHWICHECK(uhwi_snapshot_encode(snap, data, len) == len,
+              "snapshot: encoding isn't %zu bytes long", len)
+
+    uhwi_snapshot* decoded = uhwi_snapshot_from_buf(data, len);
+
+    UHWICHECK(decoded, "snapshot: encoding rejected (errno %d)",
+              (int)uhwi_last_errno)
+    UHWICHECK(uhwi_snapshot_count(decoded) == uhwi_snapshot_count(snap),
+              "snapshot: %zu devices instead of %zu",
+              uhwi_snapshot_count(decoded), uhwi_snapshot_count(snap))
+
+    for (size_t index = 0; decoded && index < uhwi_snapshot_count(snap);
+         index++) {
+        const uhwi_dev_rec* saved = uhwi_snapshot_get(snap, index);
+        const uhwi_dev_rec* loaded = uhwi_snapshot_get(decoded, index);
+
+        UHWICHECK(loaded && memcmp(saved, loaded, sizeof(uhwi_dev_rec)) == 0,
+                  "snapshot: device %zu differs", index)
+        UHWICHECK(loaded && strcmp(uhwi_snapshot_str(decoded, loaded->name),
+                                   uhwi_snapshot_str(snap, saved->name)) == 0,
+                  "snapshot: device %zu is named differently", index)
+    }
+
+    uhwi_snapshot_free(decoded);
+
+    // every prefix of the encoding is missing something
+    for (size_t cut = 0; cut < len; cut++)
+        UHWICHECK(uhwicheck_snapshot_rejects(data, cut, len, 0, 0),
+                  "snapshot: truncated to %zu of %zu bytes, but accepted", cut,
+                  len)
+
+    uint32_t strings_len;
+    memcpy(&strings_len, data + UHWICHECK_SNAPSHOT_STRINGS_LEN_AT,
+           sizeof(strings_len));
+
+    UHWICHECK(uhwicheck_snapshot_rejects(data, len,
+                                         UHWICHECK_SNAPSHOT_STRINGS_LEN_AT,
+                                         0, 0),
+              "snapshot: empty string table accepted")
+    UHWICHECK(uhwicheck_snapshot_rejects(data, len,
+                                         UHWICHECK_SNAPSHOT_STRINGS_LEN_AT,
+                                         strings_len + 1, 0),
+              "snapshot: string table past the end accepted")
+    UHWICHECK(uhwicheck_snapshot_rejects(data, len,
+                                         UHWICHECK_SNAPSHOT_STRINGS_LEN_AT,
+                                         UINT32_MAX, 0),
+              "snapshot: huge string table accepted")
+    UHWICHECK(uhwicheck_snapshot_rejects(data, len, UHWICHECK_SNAPSHOT_COUNT_AT,
+                                         UINT32_MAX, 0),
+              "snapshot: huge record count accepted")
+
+    // a shorter table ends on the last character of a name instead of its NUL
+    UHWICHECK(uhwicheck_snapshot_rejects(data, len,
+                                         UHWICHECK_SNAPSHOT_STRINGS_LEN_AT,
+                                         strings_len - 1, 0),
+              "snapshot: string table cut short accepted")
+
+    data[len - 1] = 'x';
+    UHWICHECK(uhwicheck_snapshot_rejects(data, len, len, 0, 0),
+              "snapshot: unterminated string table accepted")
+    data[len - 1] = '\0';
+
+    UHWICHECK(uhwicheck_snapshot_rejects(data, len, len, 0, 1),
+              "snapshot: misaligned buffer accepted")
+
+    free(data);
+    uhwi_snapshot_free(snap);
+}
+
+#ifdef UHWI_ENABLE_PCI_DB
+// every way a DB can be opened, each has its own line parser
+const int uhwicheck_db_flags[] = { 0, UHWI_DB_LAZY, UHWI_DB_SKIM,
+                                   UHWI_DB_PARALLEL };
+
+typedef struct {
+    const char* what;
+    const char* contents;
+
+    /// a device that has to be found despite the rest of the file
+    uhwi_id_t vendor;
+    uhwi_id_t device;
+    const char* name;
+} uhwicheck_db_case;
+
+// truncated & ID-only lines are comments, they mustn't be read past their end
+const uhwicheck_db_case uhwicheck_db_cases[] = {
+    { "device line cut after its ID", "8086  Intel\n\t0001  A\n\t02",
+      0x8086, 0x0001, "Intel A" },
+    { "vendor line cut after its ID", "1af4  Red Hat\n\t1000  Virtio\n80",
+      0x1af4, 0x1000, "Red Hat Virtio" },
+    { "IDs without names", "1af4  Red Hat\n\t1000  Virtio\n10de\n\t0001\n",
+      0x1af4, 0x1000, "Red Hat Virtio" },
+    { "tab-only line at the end", "1af4  Red Hat\n\t1000  Virtio\n\t",
+      0x1af4, 0x1000, "Red Hat Virtio" }
+};
+
+void uhwicheck_db_malformed(void) {
+    for (size_t index = 0; index < sizeof(uhwicheck_db_cases) /
+                                     sizeof(uhwicheck_db_cases[0]); index++) {
+        const uhwicheck_db_case* dbcase = &uhwicheck_db_cases[index];
+        char path[UHWICHECK_PATH_MAX];
+
+        if (uhwicheck_write_tmp(dbcase->contents, strlen(dbcase->contents),
+                                path) != 0) {
+            UHWICHECK(0, "%s: unable to write %s", dbcase->what, path)
+            continue;
+        }
+
+        for (size_t findex = 0; findex < sizeof(uhwicheck_db_flags) /
+                                         sizeof(uhwicheck_db_flags[0]); findex++) {
+            uhwi_db* db = uhwi_db_open_ex(path, uhwicheck_db_flags[findex]);
+            char name[UHWI_DEV_NAME_MAX_LEN];
+
+            UHWICHECK(db, "%s (flags %d): not opened", dbcase->what,
+                      uhwicheck_db_flags[findex])
+
+            // (the short lines themselves name nothing)
+            uhwi_db_strncpy_name(db, 0x10de, 0x0001, name, sizeof(name));
+            uhwi_db_strncpy_name(db, 0x8086, 0x0002, name, sizeof(name));
+
+            uhwi_db_strncpy_name(db, dbcase->vendor, dbcase->device, name,
+                                 sizeof(name));
+
+            UHWICHECK(strcmp(name, dbcase->name) == 0,
+                      "%s (flags %d): \"%s\" instead of \"%s\"", dbcase->what,
+                      uhwicheck_db_flags[findex], name, dbcase->name)
+
+            uhwi_db_close(db);
+        }
+
+        unlink(path);
+    }
+}
+
+// generated DB large enough to be split into 16 chunks (of at least 64 KiB),
+// devices are named after both IDs so that a name attributed to the wrong
+// vendor shows
+#define UHWICHECK_DB_VENDORS 1024
+#define UHWICHECK_DB_DEVICES 32
+
+char* uhwicheck_db_generate(const int unsorted, size_t* lenp) {
+    const size_t cap = UHWICHECK_DB_VENDORS * (UHWICHECK_DB_DEVICES + 2) * 64;
+    char* buf = malloc(cap);
+    size_t len = 0;
+
+    if (!buf)
+        return NULL;
+
+    len += (size_t)snprintf(buf + len, cap - len, "# generated by uhwicheck\n");
+
+    for (size_t vindex = 0; vindex < UHWICHECK_DB_VENDORS; vindex++) {
+        // (two neighbours swapped halfway through make the file unsorted)
+        size_t vendor = vindex + 1;
+
+        if (unsorted && vindex == UHWICHECK_DB_VENDORS / 2)
+            vendor++;
+        else if (unsorted && vindex == UHWICHECK_DB_VENDORS / 2 + 1)
+            vendor--;
+
+        len += (size_t)snprintf(buf + len, cap - len, "%04zx  Vendor %zu\n",
+                                vendor, vendor);
+
+        for (size_t device = 1; device <= UHWICHECK_DB_DEVICES; device++) {
+            len += (size_t)snprintf(buf + len, cap - len,
+                                    "\t%04zx  Device %zu of vendor %zu\n",
+                                    device * 3, device, vendor);
+
+            if (device % 8 == 0)
+                len += (size_t)snprintf(buf + len, cap - len,
+                                        "\t\t%04zx %04zx  Subsystem\n", vendor,
+                                        device);
+        }
+    }
+
+    len += (size_t)snprintf(buf + len, cap - len,
+                            "C 00  Unclassified device\n\t00  Non-VGA\n");
+
+    *lenp = len;
+    return buf;
+}
+
+// UHWI_DB_PARALLEL has to name everything just like a serial parse does, on
+// any number of threads, and fall back to it for unsorted files
+void uhwicheck_db_parallel(void) {
+    const size_t threads[] = { 2, 3, 8, 16 };
+
+    for (int unsorted = 0; unsorted <= 1; unsorted++) {
+        size_t len = 0;
+        char* contents = uhwicheck_db_generate(unsorted, &len);
+        char path[UHWICHECK_PATH_MAX];
+
+        if (!contents || uhwicheck_write_tmp(contents, len, path) != 0) {
+            UHWICHECK(0, "parallel: unable to write the generated DB")
+
+            free(contents);
+            continue;
+        }
+
+        free(contents);
+
+        uhwi_db* serial = uhwi_db_open_ex(path, 0);
+        UHWICHECK(serial, "parallel: serial DB not opened")
+
+        for (size_t tindex = 0; serial && tindex < sizeof(threads) /
+                                                   sizeof(threads[0]); tindex++) {
+            uhwi_db_parse_threads = threads[tindex];
+
+            uhwi_db* db = uhwi_db_open_ex(path, UHWI_DB_PARALLEL);
+            size_t mismatches = 0;
+
+            UHWICHECK(db, "parallel (%zu threads): not opened", threads[tindex])
+
+            // every device, plus IDs in between that no vendor has
+            for (size_t vendor = 0; db && vendor <= UHWICHECK_DB_VENDORS + 1;
+                 vendor++) {
+                for (size_t device = 0; device <= UHWICHECK_DB_DEVICES * 3 + 1;
+                     device++) {
+                    char expected[UHWI_DEV_NAME_MAX_LEN];
+                    char name[UHWI_DEV_NAME_MAX_LEN];
+
+                    uhwi_db_strncpy_name(serial, (uhwi_id_t)vendor,
+                                         (uhwi_id_t)device, expected,
+                                         sizeof(expected));
+                    uhwi_db_strncpy_name(db, (uhwi_id_t)vendor,
+                                         (uhwi_id_t)device, name, sizeof(name));
+
+                    if (strcmp(name, expected) != 0 && mismatches++ == 0)
+                        UHWICHECK(0, "parallel (%zu threads%s): \"%s\" instead "
+                                  "of \"%s\" for %04zx:%04zx", threads[tindex],
+                                  unsorted ? ", unsorted" : "", name, expected,
+                                  vendor, device)
+                }
+            }
+
+            uhwi_db_close(db);
+        }
+
+        // (the generated names have to be there in the first place)
+        char name[UHWI_DEV_NAME_MAX_LEN];
+        uhwi_db_strncpy_name(serial, 0x0200, 0x0003, name, sizeof(name));
+
+        UHWICHECK(strcmp(name, "Vendor 512 Device 1 of vendor 512") == 0,
+                  "parallel%s: serial DB names \"%s\"",
+                  unsorted ? " (unsorted)" : "", name)
+
+        uhwi_db_parse_threads = 0;
+
+        uhwi_db_close(serial);
+        unlink(path);
+    }
+}
+
+// a sidecar that fits its DB's fingerprint, but whose offsets point past the
+// end of the DB and whose device ranges lie outside of the device arrays, has
+// to be dropped in favor of a fresh skim
+void uhwicheck_db_sidecar_corrupt(void) {
+    const char* contents = "1af4  Red Hat\n\t1000  Virtio\n";
+    char path[UHWICHECK_PATH_MAX];
+
+    if (uhwicheck_write_tmp(contents, strlen(contents), path) != 0) {
+        UHWICHECK(0, "sidecar: unable to write %s", path)
+        return;
+    }
+
+    char sidecar[256];
+    uhwi_db_sidecar_path(path, sidecar, sizeof(sidecar));
+
+    // magic, version, fingerprint, vendor & device counts, then the block
+    // offset & length, the first device indices and the vendor ID
+    char forged[24 + 4 * sizeof(uint32_t) + sizeof(uhwi_id_t)];
+    const uint32_t version = 1;
+    const uint64_t fingerprint = uhwi_db_fingerprint(path);
+    const uint32_t counts[2] = { 1, 1 };
+    const uint32_t arrays[4] = { 0x10000, 0x7fffffff, 2, 1 };
+    const uhwi_id_t vendor = 0x1af4;
+
+    memcpy(forged, "UHWX", 4);
+    memcpy(forged + 4, &version, sizeof(version));
+    memcpy(forged + 8, &fingerprint, sizeof(fingerprint));
+    memcpy(forged + 16, counts, sizeof(counts));
+    memcpy(forged + 24, arrays, sizeof(arrays));
+    memcpy(forged + 24 + sizeof(arrays), &vendor, sizeof(vendor));
+
+    FILE* fp = NULL;
+
+    // (the cache directory usually is only writable by root)
+    if ((mkdir(UHWI_DISK_CACHE_DIR, 0755) < 0 && errno != EEXIST) ||
+        !(fp = fopen(sidecar, "wb"))) {
+        fprintf(stdout, "SKIP sidecar: %s isn't writable\n", UHWI_DISK_CACHE_DIR);
+        unlink(path);
+        return;
+    }
+
+    fwrite(forged, 1, sizeof(forged), fp);
+    fclose(fp);
+
+    uhwi_db* db = uhwi_db_open_ex(path, UHWI_DB_SKIM | UHWI_DB_SIDECAR);
+    char name[UHWI_DEV_NAME_MAX_LEN];
+
+    UHWICHECK(db, "sidecar: not opened")
+    uhwi_db_strncpy_name(db, 0x1af4, 0x1000, name, sizeof(name));
+
+    UHWICHECK(strcmp(name, "Red Hat Virtio") == 0,
+              "sidecar: \"%s\" instead of \"Red Hat Virtio\"", name)
+
+    uhwi_db_close(db);
+
+    unlink(sidecar);
+    unlink(path);
+}
+#endif
+
+int main(const int argc, const char** argv) {
+    (void)argc;
+
+    uhwicheck_addr();
+    uhwicheck_snapshot_binary();
+
+#ifdef UHWI_ENABLE_PCI_DB
+    uhwicheck_db_malformed();
+    uhwicheck_db_sidecar_corrupt();
+    uhwicheck_db_parallel();
+#endif
+
+    if (uhwicheck_failures > 0) {
+        fprintf(stdout, "%s: %zu check(s) failed\n", argv[0], uhwicheck_failures);
+        return 1;
+    }
+
+    fprintf(stdout, "%s: all checks passed\n", argv[0]);
+    return 0;
+}